@@ -130,6 +130,7 @@ typedef struct
 } memory_config_t;
 
 static memory_config_t g_memory_config_a[4];
+static bus_event_write_t g_event_write_log_fp; /* Gets vic, color ram and $DD00 writes */
 memory_t g_memory;
 
 void bus_mem_conifig(uint8_t mem_config)
@@ -257,6 +258,15 @@ void bus_event_write_unsubscribe(uint16_t addr, bus_event_write_t bus_event_writ
   g_memory.event_write_fpp[addr] = NULL;
 }
 
+/*
+ * Only one log subscription can exist, NULL removes it. The log is
+ * called before any ordinary write subscription for the same address.
+ */
+void bus_event_write_log_subscribe(bus_event_write_t bus_event_write_fp)
+{
+  g_event_write_log_fp = bus_event_write_fp;
+}
+
 void bus_init()
 {
   bus_mem_conifig(MASK_MEMORY_CONFIG_7);
@@ -384,6 +394,12 @@ void bus_write_byte(uint16_t addr, uint8_t byte)
           addr &= ~0x00F0;
         }
 
+        if(g_event_write_log_fp != NULL &&
+           (addr < 0xD400 || (addr >= OFFSET_COLOR_RAM && addr < 0xDC00) || addr == 0xDD00))
+        {
+          g_event_write_log_fp(addr, byte);
+        }
+
         if(g_memory.event_write_fpp[addr] != NULL)
         {
           /* If subscribed, then bus takes no responsibility for this address */
@@ -78,5 +78,6 @@ void bus_event_read_subscribe(uint16_t addr, bus_event_read_t bus_event_read_fp)
 void bus_event_read_unsubscribe(uint16_t addr, bus_event_read_t bus_event_read_fp);
 void bus_event_write_subscribe(uint16_t addr, bus_event_write_t bus_event_write_fp);
 void bus_event_write_unsubscribe(uint16_t addr, bus_event_write_t bus_event_write_fp);
+void bus_event_write_log_subscribe(bus_event_write_t bus_event_write_fp);
 
 #endif
@@ -34,7 +34,6 @@
 #include "vic.h"
 #include "key.h"
 #include "joy.h"
-#include "tap.h"
 #include <string.h>
 
 #define CIA1 0
@@ -43,13 +42,16 @@
 #define A    0
 #define B    1
 
-/* Much higher than this and many tapes stop working */
-#define MIN_QUEUE_SIZE  0x20
+/* Power line is 50 Hz on a PAL machine, clocked at 985248 Hz */
+#define TOD_TICK_CYCLES    19705
 
 static uint8_t cia1_event_read_irq_ctrl(uint16_t addr);
 static uint8_t cia1_event_read_porta(uint16_t addr);
 static uint8_t cia1_event_read_portb(uint16_t addr);
 static uint8_t cia1_event_read_ctrla(uint16_t addr);
+static uint8_t cia_event_read_timer(uint16_t addr);
+static uint8_t cia_event_read_tod(uint16_t addr);
+static void cia_event_write_tod(uint16_t addr, uint8_t value);
 static void cia1_event_write_porta(uint16_t addr, uint8_t value);
 static void cia1_event_write_portb(uint16_t addr, uint8_t value);
 static void cia1_event_write_dira(uint16_t addr, uint8_t value);
@@ -61,7 +63,6 @@ static void cia1_event_write_timera_hb(uint16_t addr, uint8_t value);
 static void cia1_event_write_timera_lb(uint16_t addr, uint8_t value);
 static void cia1_event_write_timerb_hb(uint16_t addr, uint8_t value);
 static void cia1_event_write_timerb_lb(uint16_t addr, uint8_t value);
-static void cia1_event_write_tod_tenth(uint16_t addr, uint8_t value);
 static uint8_t cia2_event_read_irq_ctrl(uint16_t addr);
 static void cia2_event_write_porta(uint16_t addr, uint8_t value);
 static void cia2_event_write_portb(uint16_t addr, uint8_t value);
@@ -74,41 +75,46 @@ static void cia2_event_write_timera_hb(uint16_t addr, uint8_t value);
 static void cia2_event_write_timera_lb(uint16_t addr, uint8_t value);
 static void cia2_event_write_timerb_hb(uint16_t addr, uint8_t value);
 static void cia2_event_write_timerb_lb(uint16_t addr, uint8_t value);
-static void cia2_event_write_tod_tenth(uint16_t addr, uint8_t value);
+
+typedef struct
+{
+  uint8_t clock_a[4]; /* Tenth, seconds, minutes and hours in BCD */
+  uint8_t alarm_a[4];
+  uint8_t latch_a[4];
+  uint8_t latched; /* Hours read, clock is frozen in latch until tenth is read */
+  uint8_t halted; /* Hours written, clock is stopped until tenth is written */
+  uint8_t ticks; /* Power line ticks since last tenth */
+} tod_t;
 
 typedef struct
 {
   uint32_t timer_latch[2];
   uint32_t status_control_reg[2];
   uint32_t status_irq_mask_reg;
-  uint16_t *timer[2];
-  uint8_t tod_started;
+  uint16_t timer_value[2]; /* Counter value at timer_start */
+  uint32_t timer_start[2]; /* Cycle when counter was timer_value */
+  uint32_t timer_underflow[2]; /* Cycle when counter will underflow */
+  uint8_t timer_clocked[2]; /* Started and counting system clock */
+  tod_t tod;
 } cia_t;
 
-/* Contains matrix of pushed keys, key.c is responsible for this memory */
-extern uint8_t g_matrix_active_aa[8][8];
+/* Contains masks of pushed keys, key.c is responsible for this memory */
+extern uint8_t g_key_row_mask_a[8];
+extern uint8_t g_key_col_mask_a[8];
 
-/* Contains matrix of joystick status, key.c is responsible for this memory */
-extern joy_action_state_t g_joy_action_state_aa[2][5];
+/* Contains port lines pulled by joysticks, joy.c is responsible for this memory */
+extern uint8_t g_joy_port_mask_a[2];
 
 extern memory_t g_memory; /* Memory interface */
 extern if_host_t g_if_host; /* Main interface */
 
 static cia_t g_cia_a[2];
-static uint32_t g_cycles_in_queue;
-static uint8_t g_tenth_second;
-static uint8_t g_seconds;
-static uint8_t g_minutes;
-static uint8_t g_hours;
+static uint32_t g_cycle; /* Cycles passed, all timer cycles are relative to this */
+static uint32_t g_next_event; /* Cycle of the closest timer underflow or tod tick */
+static uint32_t g_tod_next; /* Cycle of next power line tick */
 static uint8_t g_serial_port_input;
 static uint8_t g_serial_port_output;
 
-static uint16_t cia_reg_timer_low[2][2] =
-{
-  {REG_CIA1_TIMER_A_LOW_BYTE, REG_CIA1_TIMER_B_LOW_BYTE},
-  {REG_CIA2_TIMER_A_LOW_BYTE, REG_CIA2_TIMER_B_LOW_BYTE}
-};
-
 static uint16_t cia_reg_ctrl[2][2] =
 {
   {REG_CIA1_CONTROL_A, REG_CIA1_CONTROL_B},
@@ -121,23 +127,232 @@ static uint16_t cia_reg_int[2] =
   REG_CIA2_INTERRUPT_CONTROL_REG
 };
 
-static uint8_t cia_int_reason_and_msb[2] =
+static uint8_t cia_int_mask[2] =
 {
-  0x81,
-  0x82
+  MASK_CIA_INTERRUPT_CONTROL_REG_TIMER_A,
+  MASK_CIA_INTERRUPT_CONTROL_REG_TIMER_B
 };
 
-static uint8_t cia_int_reason[2] =
+/*
+ * Timers are not counted down every cycle. Instead the cycle when a
+ * counter was loaded is kept, and the current value is calculated when
+ * read. Underflows are scheduled at the exact cycle they will happen and
+ * handled in cia_step when that cycle has passed.
+ */
+static uint16_t timer_get(uint32_t i, uint32_t j)
 {
-  0x1,
-  0x2
-};
+  if(!g_cia_a[i].timer_clocked[j])
+  {
+    return g_cia_a[i].timer_value[j];
+  }
 
-static uint8_t cia_int_mask[2] =
+  return g_cia_a[i].timer_value[j] - (g_cycle - g_cia_a[i].timer_start[j]);
+}
+
+static void timer_set(uint32_t i, uint32_t j, uint16_t value, uint32_t cycle)
 {
-  MASK_CIA_INTERRUPT_CONTROL_REG_TIMER_A,
-  MASK_CIA_INTERRUPT_CONTROL_REG_TIMER_B
-};
+  g_cia_a[i].timer_value[j] = value;
+  g_cia_a[i].timer_start[j] = cycle;
+
+  /* Counter reaches zero after value cycles and underflows on the next */
+  g_cia_a[i].timer_underflow[j] = cycle + value + 1;
+}
+
+static void event_schedule()
+{
+  uint32_t next = g_tod_next;
+  uint32_t i; /* cia */
+  uint32_t j; /* a or b */
+
+  for(i = 0; i < 2; i++)
+  {
+    for(j = 0; j < 2; j++)
+    {
+      if(g_cia_a[i].timer_clocked[j] &&
+         (int32_t)(g_cia_a[i].timer_underflow[j] - next) < 0)
+      {
+        next = g_cia_a[i].timer_underflow[j];
+      }
+    }
+  }
+
+  g_next_event = next;
+}
+
+static void irq_raise(uint32_t i, uint8_t reason)
+{
+  /* Is the interrupt enabled? */
+  if(g_cia_a[i].status_irq_mask_reg & reason)
+  {
+    if(i == CIA1)
+    {
+      /* Set flag about what caused IRQ and raise IRQ */
+      g_memory.io_p[cia_reg_int[CIA1]] |= reason | MASK_CIA_INTERRUPT_CONTROL_REG_MULTI; /* Set IRQ line low*/
+    }
+    else
+    {
+      /* NMI must have been cleared before entering again */
+      if(!cpu_get_nmi())
+      {
+        /* Set flag about what caused IRQ and raise IRQ */
+        g_memory.io_p[cia_reg_int[CIA2]] |= reason | MASK_CIA_INTERRUPT_CONTROL_REG_MULTI; /* Set NMI line low*/
+      }
+    }
+  }
+  else
+  {
+    /* Report reason, since the interrupt is not enabled bit 7 should not be set */
+    g_memory.io_p[cia_reg_int[i]] |= reason;
+  }
+}
+
+static void timer_underflow(uint32_t i, uint32_t j, uint32_t cycle)
+{
+  irq_raise(i, cia_int_mask[j]);
+
+  /* Both modes reload the latch */
+  timer_set(i, j, g_cia_a[i].timer_latch[j], cycle);
+
+  if(g_cia_a[i].status_control_reg[j] & MASK_CIA_CONTROL_RUN_MODE) /* Single shot */
+  {
+    /*
+     * In one-shot mode, the timer will count down from the latched value
+     * to zero, generate an interrupt, reload the latched value,
+     * then stop.
+     */
+    g_cia_a[i].timer_clocked[j] = 0;
+    g_memory.io_p[cia_reg_ctrl[i][j]] &= ~MASK_CIA_CONTROL_START_STOP_TIMER;
+    g_cia_a[i].status_control_reg[j] &= ~MASK_CIA_CONTROL_START_STOP_TIMER;
+  }
+
+  /* Timer B can count timer A underflows instead of system clock */
+  if(j == A &&
+     (g_cia_a[i].status_control_reg[B] & MASK_CIA_CONTROL_START_STOP_TIMER) &&
+     (g_cia_a[i].status_control_reg[B] & MASK_CIA_CONTROL_B_TIMER_B_MODE_SELECT_TIMER_A))
+  {
+    if(g_cia_a[i].timer_value[B] == 0)
+    {
+      timer_underflow(i, B, cycle);
+    }
+    else
+    {
+      g_cia_a[i].timer_value[B]--;
+    }
+  }
+}
+
+static void timer_write_ctrl(uint32_t i, uint32_t j, uint16_t addr, uint8_t value)
+{
+  uint16_t counter = timer_get(i, j);
+  uint8_t mode_mask = (j == A) ? MASK_CIA_CONTROL_A_TIMER_A_COUNTS : MASK_CIA_CONTROL_B_TIMER_B_MODE_SELECT;
+
+  /*
+   * A strobe bit allows the timer latch to be loaded
+   * into the timer counter at any time, whetherthe timer
+   * is running or not.
+   */
+  if(value & MASK_CIA_CONTROL_FORCE_LOAD_TIMER)
+  {
+    counter = g_cia_a[i].timer_latch[j];
+    value &= ~MASK_CIA_CONTROL_FORCE_LOAD_TIMER;
+  }
+  g_cia_a[i].status_control_reg[j] = value;
+
+  /* Counting of CNT transitions is not supported, such timer stands still */
+  g_cia_a[i].timer_clocked[j] = (value & MASK_CIA_CONTROL_START_STOP_TIMER) && !(value & mode_mask);
+  timer_set(i, j, counter, g_cycle);
+  event_schedule();
+
+  g_memory.io_p[addr] = value;
+}
+
+static void timer_write_latch_hb(uint32_t i, uint32_t j, uint8_t value)
+{
+  g_cia_a[i].timer_latch[j] &= 0x00FF;
+  g_cia_a[i].timer_latch[j] |= value << 8;
+
+  /* A stopped timer is loaded as well */
+  if((g_cia_a[i].status_control_reg[j] & MASK_CIA_CONTROL_START_STOP_TIMER) == 0x00)
+  {
+    timer_set(i, j, g_cia_a[i].timer_latch[j], g_cycle);
+  }
+}
+
+static uint8_t bcd_inc(uint8_t bcd)
+{
+  bcd++;
+  if((bcd & 0x0F) == 0x0A)
+  {
+    bcd += 0x06;
+  }
+  return bcd;
+}
+
+static void tod_tenth(uint32_t i)
+{
+  tod_t *tod_p = &g_cia_a[i].tod;
+  uint8_t hours;
+
+  tod_p->clock_a[0] = (tod_p->clock_a[0] + 1) % 10;
+  if(tod_p->clock_a[0] == 0)
+  {
+    tod_p->clock_a[1] = bcd_inc(tod_p->clock_a[1]);
+    if(tod_p->clock_a[1] == 0x60)
+    {
+      tod_p->clock_a[1] = 0;
+      tod_p->clock_a[2] = bcd_inc(tod_p->clock_a[2]);
+      if(tod_p->clock_a[2] == 0x60)
+      {
+        tod_p->clock_a[2] = 0;
+
+        /* Hours are 1 - 12 with PM flag in bit 7, flipped when passing 11 */
+        hours = tod_p->clock_a[3] & 0x1F;
+        if(hours == 0x11)
+        {
+          tod_p->clock_a[3] = (tod_p->clock_a[3] ^ 0x80) & 0x80;
+          tod_p->clock_a[3] |= 0x12;
+        }
+        else if(hours == 0x12)
+        {
+          tod_p->clock_a[3] = (tod_p->clock_a[3] & 0x80) | 0x01;
+        }
+        else
+        {
+          tod_p->clock_a[3] = (tod_p->clock_a[3] & 0x80) | bcd_inc(hours);
+        }
+      }
+    }
+  }
+
+  if(memcmp(tod_p->clock_a, tod_p->alarm_a, sizeof(tod_p->clock_a)) == 0)
+  {
+    irq_raise(i, MASK_CIA_INTERRUPT_CONTROL_REG_TOD);
+  }
+}
+
+static void tod_tick()
+{
+  uint32_t i; /* cia */
+  uint8_t ticks_per_tenth;
+
+  for(i = 0; i < 2; i++)
+  {
+    if(g_cia_a[i].tod.halted)
+    {
+      continue;
+    }
+
+    /* Divider is set by software, a 60 Hz setting makes the clock run slow */
+    ticks_per_tenth = (g_cia_a[i].status_control_reg[A] & MASK_CIA_CONTROL_A_TOD_CLOCK_FREQ) ? 5 : 6;
+
+    g_cia_a[i].tod.ticks++;
+    if(g_cia_a[i].tod.ticks >= ticks_per_tenth)
+    {
+      g_cia_a[i].tod.ticks = 0;
+      tod_tenth(i);
+    }
+  }
+}
 
 static uint8_t eval_cia2_porta()
 {
@@ -210,47 +425,19 @@ static uint8_t eval_cia1_portb()
 
   /* First save the current value for port b */
   uint8_t reg_result = g_memory.io_p[REG_CIA1_DATA_PORT_B];
-
-  uint32_t i; /* col */
+  uint8_t lines_low = ~g_memory.io_p[REG_CIA1_DATA_PORT_A];
   uint32_t j; /* row */
 
-  /* Go through the matrix to see if button is pressed */
-  for(i = 0; i < 8; i++)
+  /* Pushed keys on a low port a line also pull their port b line low */
+  for(j = 0; lines_low != 0; j++, lines_low >>= 1)
   {
-    for(j = 0; j < 8; j++)
+    if(lines_low & 0x1)
     {
-      /* If button pressed and the corresponding bit in port a is unset ... */
-      if(g_matrix_active_aa[i][j] &&
-         !(g_memory.io_p[REG_CIA1_DATA_PORT_A] & (1 << j)))
-      {
-        /* ... then also unset resulting register bit in portb */
-        reg_result &= ~(1 << i);
-      }
+      reg_result &= ~g_key_col_mask_a[j];
     }
   }
 
-  if(g_joy_action_state_aa[JOY_PORT_A][JOY_ACTION_UP] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_A_UP_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_A][JOY_ACTION_DOWN] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_A_DOWN_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_A][JOY_ACTION_RIGHT] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_A_RIGHT_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_A][JOY_ACTION_LEFT] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_A_LEFT_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_A][JOY_ACTION_FIRE] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_A_FIRE_PORT_VAL;
-  }
-
-  return reg_result;
+  return reg_result & ~g_joy_port_mask_a[JOY_PORT_A];
 }
 
 static uint8_t eval_cia1_porta()
@@ -260,49 +447,21 @@ static uint8_t eval_cia1_porta()
    * and what is set on port B.
    */
 
-  /* First save the current value for port b */
+  /* First save the current value for port a */
   uint8_t reg_result = g_memory.io_p[REG_CIA1_DATA_PORT_A];
-
+  uint8_t lines_low = ~g_memory.io_p[REG_CIA1_DATA_PORT_B];
   uint32_t i; /* col */
-  uint32_t j; /* row */
 
-  /* Go through the matrix to see if button is pressed */
-  for(i = 0; i < 8; i++)
+  /* Pushed keys on a low port b line also pull their port a line low */
+  for(i = 0; lines_low != 0; i++, lines_low >>= 1)
   {
-    for(j = 0; j < 8; j++)
+    if(lines_low & 0x1)
     {
-      /* If button pressed and the corresponding bit in port a is unset ... */
-      if(g_matrix_active_aa[i][j] &&
-         !(g_memory.io_p[REG_CIA1_DATA_PORT_B] & (1 << j)))
-      {
-        /* ... then also unset resulting register bit in portb */
-        reg_result &= ~(1 << i);
-      }
+      reg_result &= ~g_key_row_mask_a[i];
     }
   }
 
-  if(g_joy_action_state_aa[JOY_PORT_B][JOY_ACTION_UP] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_B_UP_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_B][JOY_ACTION_DOWN] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_B_DOWN_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_B][JOY_ACTION_RIGHT] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_B_RIGHT_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_B][JOY_ACTION_LEFT] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_B_LEFT_PORT_VAL;
-  }
-  if(g_joy_action_state_aa[JOY_PORT_B][JOY_ACTION_FIRE] == JOY_ACTION_STATE_PRESSED)
-  {
-    reg_result &= JOY_B_FIRE_PORT_VAL;
-  }
-
-  return reg_result;
+  return reg_result & ~g_joy_port_mask_a[JOY_PORT_B];
 }
 
 
@@ -329,6 +488,65 @@ static uint8_t cia1_event_read_ctrla(uint16_t addr)
   return g_memory.io_p[addr] & ~MASK_CIA_CONTROL_FORCE_LOAD_TIMER;
 }
 
+static uint8_t cia_event_read_timer(uint16_t addr) /* Shared by $DC04-$DC07 and $DD04-$DD07 */
+{
+  uint32_t i = (addr >> 8) & 0x1; /* $DCxx or $DDxx */
+  uint32_t j = (addr >> 1) & 0x1; /* Timer A or B */
+  uint16_t counter = timer_get(i, j);
+
+  return (addr & 0x1) ? counter >> 8 : counter & 0xFF;
+}
+
+static uint8_t cia_event_read_tod(uint16_t addr) /* Shared by $DC08-$DC0B and $DD08-$DD0B */
+{
+  tod_t *tod_p = &g_cia_a[(addr >> 8) & 0x1].tod;
+  uint32_t reg = addr & 0x3; /* Tenth, seconds, minutes or hours */
+  uint8_t value;
+
+  /* Reading hours freezes what is read until tenth is read, the clock keeps running */
+  if(reg == 3 && !tod_p->latched)
+  {
+    memcpy(tod_p->latch_a, tod_p->clock_a, sizeof(tod_p->latch_a));
+    tod_p->latched = 1;
+  }
+
+  value = tod_p->latched ? tod_p->latch_a[reg] : tod_p->clock_a[reg];
+
+  if(reg == 0)
+  {
+    tod_p->latched = 0;
+  }
+
+  return value;
+}
+
+static void cia_event_write_tod(uint16_t addr, uint8_t value) /* Shared by $DC08-$DC0B and $DD08-$DD0B */
+{
+  static const uint8_t mask_a[4] = {0x0F, 0x7F, 0x7F, 0x9F};
+  uint32_t i = (addr >> 8) & 0x1;
+  uint32_t reg = addr & 0x3;
+  tod_t *tod_p = &g_cia_a[i].tod;
+
+  if(g_cia_a[i].status_control_reg[B] & MASK_CIA_CONTROL_B_SET_ALARM_TOD_CLOCK)
+  {
+    tod_p->alarm_a[reg] = value & mask_a[reg];
+    return;
+  }
+
+  tod_p->clock_a[reg] = value & mask_a[reg];
+
+  /* Writing hours stops the clock, writing tenth starts it again */
+  if(reg == 3)
+  {
+    tod_p->halted = 1;
+  }
+  else if(reg == 0)
+  {
+    tod_p->halted = 0;
+    tod_p->ticks = 0;
+  }
+}
+
 static void cia1_event_write_porta(uint16_t addr, uint8_t value)
 {
   uint8_t mask = g_memory.io_p[REG_CIA1_DATA_DIRECTION_A];
@@ -361,36 +579,12 @@ static void cia1_event_write_dirb(uint16_t addr, uint8_t value)
 
 static void cia1_event_write_ctrla(uint16_t addr, uint8_t value)
 {
-  /*
-   * A strobe bit allows the timer latch to be loaded
-   * into the timer counter at any time, whetherthe timer
-   * is running or not.
-   */
-  if(value & MASK_CIA_CONTROL_FORCE_LOAD_TIMER)
-  {
-    *g_cia_a[CIA1].timer[A] = g_cia_a[CIA1].timer_latch[A];
-    value &= ~MASK_CIA_CONTROL_FORCE_LOAD_TIMER;
-  }
-  g_cia_a[CIA1].status_control_reg[A] = value;
-
-  g_memory.io_p[addr] = value;
+  timer_write_ctrl(CIA1, A, addr, value);
 }
 
 static void cia1_event_write_ctrlb(uint16_t addr, uint8_t value)
 {
-  /*
-   * A strobe bit allows the timer latch to be loaded
-   * into the timer counter at any time, whetherthe timer
-   * is running or not.
-   */
-  if(value & MASK_CIA_CONTROL_FORCE_LOAD_TIMER)
-  {
-    *g_cia_a[CIA1].timer[B] = g_cia_a[CIA1].timer_latch[B];
-    value &= ~MASK_CIA_CONTROL_FORCE_LOAD_TIMER;
-  }
-  g_cia_a[CIA1].status_control_reg[B] = value;
-
-  g_memory.io_p[addr] = value;
+  timer_write_ctrl(CIA1, B, addr, value);
 }
 
 static void cia1_event_write_irq_ctrl(uint16_t addr, uint8_t value)
@@ -409,12 +603,7 @@ static void cia1_event_write_irq_ctrl(uint16_t addr, uint8_t value)
 
 static void cia1_event_write_timera_hb(uint16_t addr, uint8_t value)
 {
-  g_cia_a[CIA1].timer_latch[A] &= 0x00FF;
-  g_cia_a[CIA1].timer_latch[A] |= value << 8;
-  if((g_cia_a[CIA1].status_control_reg[A] & MASK_CIA_CONTROL_START_STOP_TIMER) == 0x00)
-  {
-    *g_cia_a[CIA1].timer[A] = g_cia_a[CIA1].timer_latch[A];
-  }
+  timer_write_latch_hb(CIA1, A, value);
 }
 
 static void cia1_event_write_timera_lb(uint16_t addr, uint8_t value)
@@ -425,12 +614,7 @@ static void cia1_event_write_timera_lb(uint16_t addr, uint8_t value)
 
 static void cia1_event_write_timerb_hb(uint16_t addr, uint8_t value)
 {
-  g_cia_a[CIA1].timer_latch[B] &= 0x00FF;
-  g_cia_a[CIA1].timer_latch[B] |= value << 8;
-  if((g_cia_a[CIA1].status_control_reg[B] & MASK_CIA_CONTROL_START_STOP_TIMER) == 0x00)
-  {
-    *g_cia_a[CIA1].timer[B] = g_cia_a[CIA1].timer_latch[B];
-  }
+  timer_write_latch_hb(CIA1, B, value);
 }
 
 static void cia1_event_write_timerb_lb(uint16_t addr, uint8_t value)
@@ -439,14 +623,10 @@ static void cia1_event_write_timerb_lb(uint16_t addr, uint8_t value)
   g_cia_a[CIA1].timer_latch[B] |= value;
 }
 
-static void cia1_event_write_tod_tenth(uint16_t addr, uint8_t value)
-{
-  g_cia_a[CIA1].tod_started = 1;
-}
-
 static uint8_t cia2_event_read_porta(uint16_t addr)
 {
-  /* This port is the serial port ! */
+  /* This port is the serial port, let dd catch up before it is sampled */
+  g_if_host.if_host_ports.ports_read_serial_fp(IF_EMU_DEV_CC);
   return eval_cia2_porta();
 }
 
@@ -507,36 +687,12 @@ static void cia2_event_write_dirb(uint16_t addr, uint8_t value)
 
 static void cia2_event_write_ctrla(uint16_t addr, uint8_t value)
 {
-  /*
-   * A strobe bit allows the timer latch to be loaded
-   * into the timer counter at any time, whetherthe timer
-   * is running or not.
-   */
-  if(value & MASK_CIA_CONTROL_FORCE_LOAD_TIMER)
-  {
-    *g_cia_a[CIA2].timer[A] = g_cia_a[CIA2].timer_latch[A];
-    value &= ~MASK_CIA_CONTROL_FORCE_LOAD_TIMER;
-  }
-  g_cia_a[CIA2].status_control_reg[A] = value;
-
-  g_memory.io_p[addr] = value;
+  timer_write_ctrl(CIA2, A, addr, value);
 }
 
 static void cia2_event_write_ctrlb(uint16_t addr, uint8_t value)
 {
-  /*
-   * A strobe bit allows the timer latch to be loaded
-   * into the timer counter at any time, whetherthe timer
-   * is running or not.
-   */
-  if(value & MASK_CIA_CONTROL_FORCE_LOAD_TIMER)
-  {
-    *g_cia_a[CIA2].timer[B] = g_cia_a[CIA2].timer_latch[B];
-    value &= ~MASK_CIA_CONTROL_FORCE_LOAD_TIMER;
-  }
-  g_cia_a[CIA2].status_control_reg[B] = value;
-
-  g_memory.io_p[addr] = value;
+  timer_write_ctrl(CIA2, B, addr, value);
 }
 
 static void cia2_event_write_irq_ctrl(uint16_t addr, uint8_t value)
@@ -555,13 +711,7 @@ static void cia2_event_write_irq_ctrl(uint16_t addr, uint8_t value)
 
 static void cia2_event_write_timera_hb(uint16_t addr, uint8_t value)
 {
-  /* Latch the value into the timer latch */
-  g_cia_a[CIA2].timer_latch[A] &= 0x00FF;
-  g_cia_a[CIA2].timer_latch[A] |= value << 8;
-  if((g_cia_a[CIA2].status_control_reg[A] & MASK_CIA_CONTROL_START_STOP_TIMER) == 0x00)
-  {
-    *g_cia_a[CIA2].timer[A] = g_cia_a[CIA2].timer_latch[A];
-  }
+  timer_write_latch_hb(CIA2, A, value);
 }
 
 static void cia2_event_write_timera_lb(uint16_t addr, uint8_t value)
@@ -573,13 +723,7 @@ static void cia2_event_write_timera_lb(uint16_t addr, uint8_t value)
 
 static void cia2_event_write_timerb_hb(uint16_t addr, uint8_t value)
 {
-  /* Latch the value into the timer latch */
-  g_cia_a[CIA2].timer_latch[B] &= 0x00FF;
-  g_cia_a[CIA2].timer_latch[B] |= value << 8;
-  if((g_cia_a[CIA2].status_control_reg[B] & MASK_CIA_CONTROL_START_STOP_TIMER) == 0x00)
-  {
-    *g_cia_a[CIA2].timer[B] = g_cia_a[CIA2].timer_latch[B];
-  }
+  timer_write_latch_hb(CIA2, B, value);
 }
 
 static void cia2_event_write_timerb_lb(uint16_t addr, uint8_t value)
@@ -589,23 +733,6 @@ static void cia2_event_write_timerb_lb(uint16_t addr, uint8_t value)
   g_cia_a[CIA2].timer_latch[B] |= value;
 }
 
-static void cia2_event_write_tod_tenth(uint16_t addr, uint8_t value)
-{
-  g_cia_a[CIA2].tod_started = 1;
-}
-
-static uint32_t dec2bcd(uint32_t num)
-{
-    uint32_t ones = 0;
-    uint32_t tens = 0;
-    uint32_t temp = 0;
-
-    ones = num%10;
-    temp = num/10;
-    tens = temp<<4;
-    return (tens + ones);
-}
-
 void cia_init()
 {
   uint32_t i; /* cia 1 and 2 */
@@ -613,15 +740,7 @@ void cia_init()
 
   memset(g_cia_a, 0, sizeof(cia_t) * 2);
 
-  g_cycles_in_queue = 0;
-
-  for(i = 0; i < 2; i++)
-  {
-    for(j = 0; j < 2; j++)
-    {
-      g_cia_a[i].timer[j] = (uint16_t *)(g_memory.io_p + cia_reg_timer_low[i][j]);
-    }
-  }
+  g_cycle = 0;
 
   /* Default values */
   g_memory.io_p[REG_CIA1_DATA_DIRECTION_A] = 0xFF;
@@ -631,23 +750,47 @@ void cia_init()
 
   /* Default port value */
   g_memory.io_p[REG_CIA2_DATA_PORT_A] = 0x03;
-  g_memory.io_p[REG_CIA1_TIME_OF_DAY_HOURS] = 0x01;
   vic_set_bank(0x03);
 
+  /*
+   * The Time of Day Clock does not start running until you write to
+   * the tenth of second register. The Operating System never starts this
+   * clock, and therefore the two registers used as part of the floating
+   * point RND(0) value always have a value of 0
+   */
+  for(i = 0; i < 2; i++)
+  {
+    g_cia_a[i].tod.clock_a[3] = 0x01;
+    g_cia_a[i].tod.halted = 1;
+  }
+  g_tod_next = g_cycle + TOD_TICK_CYCLES;
+
   /*
    * Unclear what these registers will be if read before written
    * to, set them to random value.
    */
   
-  *g_cia_a[CIA1].timer[A] = g_if_host.if_host_rand.rand_get_fp();
-  *g_cia_a[CIA1].timer[B] = g_if_host.if_host_rand.rand_get_fp();
-  *g_cia_a[CIA2].timer[A] = g_if_host.if_host_rand.rand_get_fp();
-  *g_cia_a[CIA2].timer[B] = g_if_host.if_host_rand.rand_get_fp();
+  for(i = 0; i < 2; i++)
+  {
+    for(j = 0; j < 2; j++)
+    {
+      timer_set(i, j, g_if_host.if_host_rand.rand_get_fp(), g_cycle);
+    }
+  }
+  event_schedule();
 
   bus_event_read_subscribe(REG_CIA1_INTERRUPT_CONTROL_REG, cia1_event_read_irq_ctrl);
   bus_event_read_subscribe(REG_CIA1_DATA_PORT_A, cia1_event_read_porta);
   bus_event_read_subscribe(REG_CIA1_DATA_PORT_B, cia1_event_read_portb);
   bus_event_read_subscribe(REG_CIA1_CONTROL_A, cia1_event_read_ctrla);
+  bus_event_read_subscribe(REG_CIA1_TIMER_A_LOW_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA1_TIMER_A_HIGH_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA1_TIMER_B_LOW_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA1_TIMER_B_HIGH_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA1_TIME_OF_DAY_TENTH_SEC, cia_event_read_tod);
+  bus_event_read_subscribe(REG_CIA1_TIME_OF_DAY_SEC, cia_event_read_tod);
+  bus_event_read_subscribe(REG_CIA1_TIME_OF_DAY_MIN, cia_event_read_tod);
+  bus_event_read_subscribe(REG_CIA1_TIME_OF_DAY_HOURS, cia_event_read_tod);
 
   bus_event_write_subscribe(REG_CIA1_DATA_PORT_A, cia1_event_write_porta);
   bus_event_write_subscribe(REG_CIA1_DATA_PORT_B, cia1_event_write_portb);
@@ -660,11 +803,22 @@ void cia_init()
   bus_event_write_subscribe(REG_CIA1_TIMER_A_LOW_BYTE, cia1_event_write_timera_lb);
   bus_event_write_subscribe(REG_CIA1_TIMER_B_HIGH_BYTE, cia1_event_write_timerb_hb);
   bus_event_write_subscribe(REG_CIA1_TIMER_B_LOW_BYTE, cia1_event_write_timerb_lb);
-  bus_event_write_subscribe(REG_CIA1_TIME_OF_DAY_TENTH_SEC, cia1_event_write_tod_tenth);
+  bus_event_write_subscribe(REG_CIA1_TIME_OF_DAY_TENTH_SEC, cia_event_write_tod);
+  bus_event_write_subscribe(REG_CIA1_TIME_OF_DAY_SEC, cia_event_write_tod);
+  bus_event_write_subscribe(REG_CIA1_TIME_OF_DAY_MIN, cia_event_write_tod);
+  bus_event_write_subscribe(REG_CIA1_TIME_OF_DAY_HOURS, cia_event_write_tod);
 
   bus_event_read_subscribe(REG_CIA2_DATA_PORT_A, cia2_event_read_porta);
   bus_event_read_subscribe(REG_CIA2_INTERRUPT_CONTROL_REG, cia2_event_read_irq_ctrl);
   bus_event_read_subscribe(REG_CIA2_CONTROL_A, cia2_event_read_ctrla);
+  bus_event_read_subscribe(REG_CIA2_TIMER_A_LOW_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA2_TIMER_A_HIGH_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA2_TIMER_B_LOW_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA2_TIMER_B_HIGH_BYTE, cia_event_read_timer);
+  bus_event_read_subscribe(REG_CIA2_TIME_OF_DAY_TENTH_SEC, cia_event_read_tod);
+  bus_event_read_subscribe(REG_CIA2_TIME_OF_DAY_SEC, cia_event_read_tod);
+  bus_event_read_subscribe(REG_CIA2_TIME_OF_DAY_MIN, cia_event_read_tod);
+  bus_event_read_subscribe(REG_CIA2_TIME_OF_DAY_HOURS, cia_event_read_tod);
 
   bus_event_write_subscribe(REG_CIA2_DATA_PORT_A, cia2_event_write_porta);
   bus_event_write_subscribe(REG_CIA2_DATA_PORT_B, cia2_event_write_portb);
@@ -677,96 +831,45 @@ void cia_init()
   bus_event_write_subscribe(REG_CIA2_TIMER_A_LOW_BYTE, cia2_event_write_timera_lb);
   bus_event_write_subscribe(REG_CIA2_TIMER_B_HIGH_BYTE, cia2_event_write_timerb_hb);
   bus_event_write_subscribe(REG_CIA2_TIMER_B_LOW_BYTE, cia2_event_write_timerb_lb);
-  bus_event_write_subscribe(REG_CIA2_TIME_OF_DAY_TENTH_SEC, cia2_event_write_tod_tenth);
+  bus_event_write_subscribe(REG_CIA2_TIME_OF_DAY_TENTH_SEC, cia_event_write_tod);
+  bus_event_write_subscribe(REG_CIA2_TIME_OF_DAY_SEC, cia_event_write_tod);
+  bus_event_write_subscribe(REG_CIA2_TIME_OF_DAY_MIN, cia_event_write_tod);
+  bus_event_write_subscribe(REG_CIA2_TIME_OF_DAY_HOURS, cia_event_write_tod);
 }
 
 void cia_step(uint32_t cc)
 {
   uint32_t i; /* cia */
   uint32_t j; /* a or b */
-  uint8_t cycles;
 
-  if(tap_get_play()) /* If tape is active then do not use queue */
-  {
-    cycles = cc;
-    g_cycles_in_queue = 0;
-  }
-  else
-  {
-    g_cycles_in_queue += cc;
+  g_cycle += cc;
 
-    if(g_cycles_in_queue >= MIN_QUEUE_SIZE)
-    {
-      g_cycles_in_queue -= MIN_QUEUE_SIZE;
-      cycles = MIN_QUEUE_SIZE;
-    }
-    else
-    {
-      return;
-    }
+  /* Nothing happens between underflows and tod ticks */
+  if((int32_t)(g_cycle - g_next_event) < 0)
+  {
+    return;
   }
 
   for(i = 0; i < 2; i++)
   {
     for(j = 0; j < 2; j++)
     {
-      /* First check if the timer is on or not */
-      if(g_cia_a[i].status_control_reg[j] & MASK_CIA_CONTROL_START_STOP_TIMER)
+      /* Short timers may underflow more than once during one step */
+      while(g_cia_a[i].timer_clocked[j] &&
+            (int32_t)(g_cycle - g_cia_a[i].timer_underflow[j]) >= 0)
       {
-        /* Will this timer underflow? */
-        if(*g_cia_a[i].timer[j] <= cycles)
-        {
-          *g_cia_a[i].timer[j] = 0;
-
-          /* Is the interrupt enabled? */
-          if(g_cia_a[i].status_irq_mask_reg & cia_int_mask[j]) /* Interrupt enable? */
-          {
-            if(i == CIA1)
-            {
-              /* Set flag about what caused IRQ and raise IRQ */
-              g_memory.io_p[cia_reg_int[CIA1]] = cia_int_reason_and_msb[j]; /* Set IRQ line low*/
-            }
-            else
-            {
-              /* NMI must have been cleared before entering again */
-              if(!cpu_get_nmi())
-              {
-                /* Set flag about what caused IRQ and raise IRQ */
-                g_memory.io_p[cia_reg_int[CIA2]] = cia_int_reason_and_msb[j]; /* Set NMI line low*/
-              }
-            }
-          }
-          else
-          {
-            /* Report underrun, since the interrupt is not enabled bit 7 should not be set */
-            g_memory.io_p[cia_reg_int[i]] = cia_int_reason[j];
-          }
-
-          if(g_cia_a[i].status_control_reg[j] & MASK_CIA_CONTROL_RUN_MODE) /* Single shot */
-          {
-            /*
-             * In one-shot mode, the timer will count down from the latched value
-             * to zero, generate an interrupt, reload the latched value,
-             * then stop.
-             */
-            *g_cia_a[i].timer[j] = g_cia_a[i].timer_latch[j];
-            g_memory.io_p[cia_reg_ctrl[i][j]] &= ~MASK_CIA_CONTROL_START_STOP_TIMER;
-            g_cia_a[i].status_control_reg[j] &= ~MASK_CIA_CONTROL_START_STOP_TIMER;
-
-          }
-          else /* Contineuous */
-          {
-            /* In continous mode just reload the latch and continue */
-            *g_cia_a[i].timer[j] = g_cia_a[i].timer_latch[j];
-          }
-        }
-        else
-        {
-          *g_cia_a[i].timer[j] -= cycles;
-        }
+        timer_underflow(i, j, g_cia_a[i].timer_underflow[j]);
       }
     }
   }
+
+  while((int32_t)(g_cycle - g_tod_next) >= 0)
+  {
+    tod_tick();
+    g_tod_next += TOD_TICK_CYCLES;
+  }
+
+  event_schedule();
 }
 
 void cia_request_irq_tape()
@@ -780,64 +883,6 @@ void cia_request_irq_tape()
   }
 }
 
-void cia_tenth_second()
-{
-  /*
-   * The Time of Day Clock on CIA #1 (see
-   * 56328-56331 ($DC08-$DC0B)) does not start running until you write to
-   * the tenth of second register. The Operating System never starts this
-   * clock, and therefore the two registers used as part of the floating
-   * point RND(0) value always have a value of 0
-   */
-  g_tenth_second++;
-
-  if(g_tenth_second == 10)
-  {
-    g_seconds++;
-    g_tenth_second = 0;
-  }
-
-  if(g_seconds == 60)
-  {
-    g_minutes++;
-    g_seconds = 0;
-  }
-
-  if(g_minutes == 60)
-  {
-    g_hours++;
-    g_minutes = 0;
-  }
-
-  if(g_hours == 24)
-  {
-    g_hours = 0;
-  }
-
-  /*
-   * Unlike most host-emu interface functionality, this function can be called
-   * before emulator has been initialized. This is why NULL check is needed.
-   */
-  if(g_memory.io_p != NULL)
-  {
-    if(g_cia_a[CIA1].tod_started)
-    {
-      g_memory.io_p[REG_CIA1_TIME_OF_DAY_TENTH_SEC] = g_tenth_second;
-      g_memory.io_p[REG_CIA1_TIME_OF_DAY_SEC] = dec2bcd(g_seconds);
-      g_memory.io_p[REG_CIA1_TIME_OF_DAY_MIN] = dec2bcd(g_minutes);
-      g_memory.io_p[REG_CIA1_TIME_OF_DAY_HOURS] = dec2bcd(g_hours);
-    }
-
-    if(g_cia_a[CIA2].tod_started)
-    {
-      g_memory.io_p[REG_CIA2_TIME_OF_DAY_TENTH_SEC] = g_tenth_second;
-      g_memory.io_p[REG_CIA2_TIME_OF_DAY_SEC] = dec2bcd(g_seconds);
-      g_memory.io_p[REG_CIA2_TIME_OF_DAY_MIN] = dec2bcd(g_minutes);
-      g_memory.io_p[REG_CIA2_TIME_OF_DAY_HOURS] = dec2bcd(g_hours);
-    }
-  }
-}
-
 void cia_serial_port_activity(uint8_t data)
 {
   /*
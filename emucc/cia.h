@@ -223,11 +223,11 @@
 #define MASK_CIA_CONTROL_B_SET_ALARM_TOD_CLOCK   0x80
 #define MASK_CIA_CONTROL_B_TIMER_B_MODE_SELECT   0x60
 #define MASK_CIA_CONTROL_B_TIMER_B_MODE_SELECT_CNT   0x20
+#define MASK_CIA_CONTROL_B_TIMER_B_MODE_SELECT_TIMER_A   0x40
 
 void cia_init();
 void cia_step(uint32_t cc);
 void cia_request_irq_tape();
-void cia_tenth_second();
 void cia_serial_port_activity(uint8_t data);
 
 #endif
@@ -30,6 +30,7 @@
 #include "vic.h"
 #include "cia.h"
 #include "tap.h"
+#include "dsk.h"
 #include "if.h"
 
 #include <assert.h>
@@ -174,6 +175,61 @@ N - Negative: Indicates whether the result of an arithmetic (ADC,SBC) or increme
 #define NMI_VECTOR      0xFFFA
 #define RST_VECTOR      0xFFFC
 
+/*
+ * Kernal tape routines that are trapped when fast load is active. Each
+ * trap address holds a JSR that is verified so that nothing else than
+ * the kernal rom is trapped.
+ */
+#define TRAP_TAPE_HEADER          0xF72F /* JSR $F841, read any header block */
+#define TRAP_TAPE_HEADER_JSR      0xF841
+#define TRAP_TAPE_HEADER_RETURN   0xF732
+#define TRAP_TAPE_DATA            0xF8A1 /* JSR $FCBD, start reading data block */
+#define TRAP_TAPE_DATA_JSR        0xFCBD
+#define TRAP_TAPE_DATA_RETURN     0xFC93 /* Restores irq and screen, motor off */
+#define TRAP_TAPE_READ_IRQ        0x0E /* X at $F8A1 when reading, write path shares it */
+#define TRAP_CYCLES               6
+
+/*
+ * Kernal disk routines that are trapped for the virtual drive, only
+ * when kernal rom is mapped. Load and save are trapped after their
+ * vectors, the serial bus routines serve open, chkin and friends.
+ */
+#define TRAP_DISK_LOAD            0xF4A5 /* A is verify flag */
+#define TRAP_DISK_SAVE            0xF5ED
+#define KERNAL_MSG_SEARCHING      0xF5AF /* "SEARCHING FOR" name, direct mode only */
+#define KERNAL_MSG_LOADING        0xF5D2 /* "LOADING" or "VERIFYING" */
+#define KERNAL_LOAD_END           0xF5A9 /* Clears carry, end address in X and Y */
+#define KERNAL_ERROR_BASE         0xF6FB /* Three bytes per error code from 1 */
+#define TRAP_SERIAL_TALK          0xED09
+#define TRAP_SERIAL_LISTEN        0xED0C
+#define TRAP_SERIAL_SECOND        0xEDB9
+#define TRAP_SERIAL_TKSA          0xEDC7
+#define TRAP_SERIAL_CIOUT         0xEDDD
+#define TRAP_SERIAL_UNTLK         0xEDEF
+#define TRAP_SERIAL_UNLSN         0xEDFE
+#define TRAP_SERIAL_ACPTR         0xEE13
+
+#define KERNAL_STATUS             0x90
+#define KERNAL_VERIFY             0x93
+#define KERNAL_END_ADDRESS        0xAE
+#define KERNAL_TAPE_BUFFER        0xB2
+#define KERNAL_START_ADDRESS      0xC1
+#define KERNAL_IRQ_TEMP           0x02A0 /* High byte of saved irq vector */
+#define KERNAL_NAME_LENGTH        0xB7
+#define KERNAL_SECONDARY          0xB9
+#define KERNAL_DEVICE             0xBA
+#define KERNAL_NAME               0xBB
+#define KERNAL_LOAD_ADDRESS       0xC3
+
+#define KERNAL_STATUS_ERROR       0x10
+#define KERNAL_STATUS_END         0x80
+#define KERNAL_STATUS_READ_TIMEOUT 0x02
+#define KERNAL_STATUS_EOI         0x40
+
+#define KERNAL_ERROR_NOT_FOUND    4
+#define KERNAL_ERROR_NO_DEVICE    5
+#define KERNAL_ERROR_NO_NAME      8
+
 #define LOGIC_AND       0
 #define LOGIC_OR        1
 #define LOGIC_EOR       2
@@ -478,6 +534,9 @@ static uint8_t g_op_code_add_mode_array[]=
 
 static cpu_t g_cpu;
 static uint8_t g_nmi_triggered; /* NMI is triggered only HIGH to LOW */
+static uint8_t g_tape_trap; /* Kernal tape loader is trapped */
+static uint8_t g_tape_header_trapped; /* Next data block read belongs to trapped header */
+static uint8_t g_disk_trap; /* Kernal disk routines go to virtual drive */
 
 static uint8_t get_address_mode(uint8_t op_code)
 {
@@ -1764,6 +1823,12 @@ static void event_write_address_one(uint16_t addr, uint8_t value)
   {
     tap_set_motor(g_cpu_on_chip_port.addr_one);
   }
+
+  if((g_cpu_on_chip_port.addr_one & MASK_DATASETTE_OUTPUT_SIGNAL_LEVEL) !=
+     (saved & MASK_DATASETTE_OUTPUT_SIGNAL_LEVEL))
+  {
+    tap_write_line(g_cpu_on_chip_port.addr_one);
+  }
 }
 
 static void reset(uint16_t reset_vector)
@@ -1783,11 +1848,371 @@ static void reset(uint16_t reset_vector)
   g_cpu.pc_inc = 1;
 }
 
+static uint8_t trap_match(uint16_t target)
+{
+  return g_cpu.PC[0] == 0x20 &&
+         g_cpu.PC[1] == (target & 0xFF) &&
+         g_cpu.PC[2] == (target >> 8);
+}
+
+static uint8_t trap_status(tap_trap_t result)
+{
+  switch(result)
+  {
+  case TAP_TRAP_OK:
+    return 0;
+  case TAP_TRAP_END:
+    return KERNAL_STATUS_END | KERNAL_STATUS_ERROR;
+  default:
+    return KERNAL_STATUS_ERROR;
+  }
+}
+
+static uint8_t tape_trap()
+{
+  uint8_t *ram_p = g_memory.ram_p;
+  uint16_t start;
+  uint16_t end;
+  tap_trap_t result;
+
+  switch((uint32_t)g_cpu.PC & 0xFFFF)
+  {
+  case TRAP_TAPE_HEADER:
+    start = ram_p[KERNAL_TAPE_BUFFER] | (ram_p[KERNAL_TAPE_BUFFER + 1] << 8);
+    if(!trap_match(TRAP_TAPE_HEADER_JSR) ||
+       start + TAP_TRAP_HEADER_SIZE > 0x10000)
+    {
+      return 0;
+    }
+
+    result = tap_trap_header(ram_p + start);
+    g_tape_header_trapped = (result == TAP_TRAP_OK);
+    if(result == TAP_TRAP_FALLBACK)
+    {
+      return 0;
+    }
+
+    /* Carry set makes kernal give up search */
+    ram_p[KERNAL_STATUS] = trap_status(result);
+    if(result == TAP_TRAP_OK)
+    {
+      g_cpu.SR &= ~FLAG_CARRY;
+    }
+    else
+    {
+      g_cpu.SR |= FLAG_CARRY;
+    }
+    g_cpu.PC = bus_translate_emu_to_host_addr(TRAP_TAPE_HEADER_RETURN);
+    return 1;
+
+  case TRAP_TAPE_DATA:
+    start = ram_p[KERNAL_START_ADDRESS] | (ram_p[KERNAL_START_ADDRESS + 1] << 8);
+    end = ram_p[KERNAL_END_ADDRESS] | (ram_p[KERNAL_END_ADDRESS + 1] << 8);
+
+    /*
+     * Tape save and the real time header read (after a fallback) pass
+     * here too, only a data read following a trapped header is taken.
+     */
+    if(!trap_match(TRAP_TAPE_DATA_JSR) || end < start ||
+       g_cpu.XR != TRAP_TAPE_READ_IRQ || !g_tape_header_trapped)
+    {
+      return 0;
+    }
+
+    g_tape_header_trapped = 0;
+    result = tap_trap_data(ram_p + start, end - start, ram_p[KERNAL_VERIFY]);
+    if(result == TAP_TRAP_FALLBACK)
+    {
+      return 0;
+    }
+
+    /* Irq vector was never replaced, so it must not be restored */
+    ram_p[KERNAL_IRQ_TEMP] = 0;
+    ram_p[KERNAL_STATUS] |= trap_status(result);
+    g_cpu.SR &= ~FLAG_CARRY;
+    g_cpu.PC = bus_translate_emu_to_host_addr(TRAP_TAPE_DATA_RETURN);
+    return 1;
+  }
+
+  return 0;
+}
+
+static uint8_t kernal_at(uint16_t addr)
+{
+  return g_cpu.PC == g_memory.krom_p + addr;
+}
+
+/* Returns from trapped subroutine, carry set means error in A */
+static void trap_return(uint8_t error)
+{
+  uint8_t cc;
+
+  RTS(&cc);
+  g_cpu.PC++;
+
+  if(error)
+  {
+    g_cpu.AC = error;
+    g_cpu.SR |= FLAG_CARRY;
+  }
+  else
+  {
+    g_cpu.SR &= ~FLAG_CARRY;
+  }
+}
+
+/* Kernal routine runs first and then returns to ret, as if called from there */
+static void trap_call(uint16_t routine, uint16_t ret)
+{
+  ret--;
+  bus_write_byte(g_cpu.SP + OFFSET_STACK, ret >> 8);
+  g_cpu.SP--;
+  bus_write_byte(g_cpu.SP + OFFSET_STACK, ret & 0xFF);
+  g_cpu.SP--;
+
+  g_cpu.PC = bus_translate_emu_to_host_addr(routine);
+}
+
+static uint8_t disk_trap_error(dsk_result_t result)
+{
+  return result == DSK_NO_DISK ? KERNAL_ERROR_NO_DEVICE : KERNAL_ERROR_NOT_FOUND;
+}
+
+static void disk_load()
+{
+  uint8_t *ram_p = g_memory.ram_p;
+  uint16_t name = ram_p[KERNAL_NAME] | (ram_p[KERNAL_NAME + 1] << 8);
+  uint8_t length = ram_p[KERNAL_NAME_LENGTH];
+  uint8_t verify = g_cpu.AC;
+  uint16_t address;
+  uint8_t low = 0;
+  uint8_t high = 0;
+  dsk_result_t result;
+
+  ram_p[KERNAL_VERIFY] = verify;
+  ram_p[KERNAL_STATUS] = 0;
+
+  if(length == 0 || name + length > 0x10000)
+  {
+    trap_return(KERNAL_ERROR_NO_NAME);
+    return;
+  }
+
+  result = dsk_open(DSK_CHANNEL_LOAD, ram_p + name, length);
+  if(result == DSK_OK)
+  {
+    /* File starts with its load address */
+    if(dsk_read(DSK_CHANNEL_LOAD, &low) != DSK_OK ||
+       dsk_read(DSK_CHANNEL_LOAD, &high) == DSK_ERROR)
+    {
+      result = DSK_NOT_FOUND;
+    }
+  }
+  if(result != DSK_OK)
+  {
+    /* Kernal prints search message before error, as on real drive */
+    dsk_close(DSK_CHANNEL_LOAD);
+    trap_call(KERNAL_MSG_SEARCHING, KERNAL_ERROR_BASE + (disk_trap_error(result) - 1) * 3);
+    return;
+  }
+
+  if(ram_p[KERNAL_SECONDARY] == 0)
+  {
+    address = ram_p[KERNAL_LOAD_ADDRESS] | (ram_p[KERNAL_LOAD_ADDRESS + 1] << 8);
+  }
+  else
+  {
+    address = low | (high << 8);
+  }
+  ram_p[KERNAL_LOAD_ADDRESS] = address & 0xFF;
+  ram_p[KERNAL_LOAD_ADDRESS + 1] = address >> 8;
+
+  do
+  {
+    result = dsk_read(DSK_CHANNEL_LOAD, &low);
+    if(result == DSK_ERROR)
+    {
+      break;
+    }
+
+    if(!verify)
+    {
+      ram_p[address] = low;
+    }
+    else if(ram_p[address] != low)
+    {
+      ram_p[KERNAL_STATUS] |= KERNAL_STATUS_ERROR;
+    }
+    address++;
+  }
+  while(result == DSK_OK && address != 0);
+
+  dsk_close(DSK_CHANNEL_LOAD);
+
+  ram_p[KERNAL_STATUS] |= KERNAL_STATUS_EOI;
+  ram_p[KERNAL_END_ADDRESS] = address & 0xFF;
+  ram_p[KERNAL_END_ADDRESS + 1] = address >> 8;
+
+  /* Data is already in place, kernal only prints its messages and returns */
+  trap_call(KERNAL_MSG_LOADING, KERNAL_LOAD_END);
+  trap_call(KERNAL_MSG_SEARCHING, KERNAL_MSG_LOADING);
+}
+
+static void disk_save()
+{
+  uint8_t *ram_p = g_memory.ram_p;
+  uint16_t name = ram_p[KERNAL_NAME] | (ram_p[KERNAL_NAME + 1] << 8);
+  uint8_t length = ram_p[KERNAL_NAME_LENGTH];
+  uint16_t address = ram_p[KERNAL_START_ADDRESS] | (ram_p[KERNAL_START_ADDRESS + 1] << 8);
+  uint16_t end = ram_p[KERNAL_END_ADDRESS] | (ram_p[KERNAL_END_ADDRESS + 1] << 8);
+  dsk_result_t result;
+
+  ram_p[KERNAL_STATUS] = 0;
+
+  if(length == 0 || name + length > 0x10000)
+  {
+    trap_return(KERNAL_ERROR_NO_NAME);
+    return;
+  }
+
+  /* Errors like file exists are only seen on command channel, as on drive */
+  result = dsk_open(DSK_CHANNEL_SAVE, ram_p + name, length);
+  if(result == DSK_NO_DISK)
+  {
+    trap_return(KERNAL_ERROR_NO_DEVICE);
+    return;
+  }
+
+  if(result == DSK_OK)
+  {
+    (void)dsk_write(DSK_CHANNEL_SAVE, address & 0xFF);
+    (void)dsk_write(DSK_CHANNEL_SAVE, address >> 8);
+    while(address != end && dsk_write(DSK_CHANNEL_SAVE, ram_p[address]) == DSK_OK)
+    {
+      address++;
+    }
+    dsk_close(DSK_CHANNEL_SAVE);
+  }
+
+  trap_return(0);
+}
+
+static uint8_t disk_trap()
+{
+  uint8_t *ram_p = g_memory.ram_p;
+  uint16_t addr = (uint32_t)g_cpu.PC & 0xFFFF;
+  uint8_t byte;
+
+  switch(addr)
+  {
+  case TRAP_DISK_LOAD:
+  case TRAP_DISK_SAVE:
+    if(!kernal_at(addr) || ram_p[KERNAL_DEVICE] != DSK_DEVICE)
+    {
+      return 0;
+    }
+    if(addr == TRAP_DISK_LOAD)
+    {
+      disk_load();
+    }
+    else
+    {
+      disk_save();
+    }
+    return 1;
+
+  case TRAP_SERIAL_TALK:
+  case TRAP_SERIAL_LISTEN:
+    if(!kernal_at(addr))
+    {
+      return 0;
+    }
+    if(g_cpu.AC != DSK_DEVICE)
+    {
+      /* Another device, kernal takes care of it */
+      dsk_bus_release();
+      return 0;
+    }
+    if(addr == TRAP_SERIAL_TALK)
+    {
+      dsk_bus_talk();
+    }
+    else
+    {
+      dsk_bus_listen();
+    }
+    trap_return(0);
+    return 1;
+
+  case TRAP_SERIAL_SECOND:
+  case TRAP_SERIAL_TKSA:
+  case TRAP_SERIAL_CIOUT:
+  case TRAP_SERIAL_UNTLK:
+  case TRAP_SERIAL_UNLSN:
+  case TRAP_SERIAL_ACPTR:
+    if(!kernal_at(addr) || !dsk_bus_addressed())
+    {
+      return 0;
+    }
+    break;
+
+  default:
+    return 0;
+  }
+
+  switch(addr)
+  {
+  case TRAP_SERIAL_SECOND:
+    dsk_bus_second(g_cpu.AC);
+    break;
+  case TRAP_SERIAL_TKSA:
+    dsk_bus_tksa(g_cpu.AC);
+    break;
+  case TRAP_SERIAL_CIOUT:
+    dsk_bus_ciout(g_cpu.AC);
+    break;
+  case TRAP_SERIAL_UNTLK:
+    dsk_bus_untalk();
+    break;
+  case TRAP_SERIAL_UNLSN:
+    dsk_bus_unlisten();
+    break;
+  case TRAP_SERIAL_ACPTR:
+    switch(dsk_bus_acptr(&byte))
+    {
+    case DSK_OK:
+      break;
+    case DSK_END:
+      ram_p[KERNAL_STATUS] |= KERNAL_STATUS_EOI;
+      break;
+    default:
+      byte = '\r';
+      ram_p[KERNAL_STATUS] |= KERNAL_STATUS_EOI | KERNAL_STATUS_READ_TIMEOUT;
+      break;
+    }
+    g_cpu.AC = byte;
+    break;
+  }
+
+  trap_return(0);
+  return 1;
+}
+
 uint32_t cpu_step()
 {
   uint8_t cc;
   uint8_t op_code;
 
+  if(g_tape_trap && tape_trap())
+  {
+    return TRAP_CYCLES;
+  }
+
+  if(g_disk_trap && disk_trap())
+  {
+    return TRAP_CYCLES;
+  }
+
   if(!g_nmi_triggered &&
      g_memory.io_p[REG_CIA2_INTERRUPT_CONTROL_REG] & MASK_CIA_INTERRUPT_CONTROL_REG_MULTI)
   {
@@ -1850,6 +2275,7 @@ void cpu_init()
 void cpu_reset()
 {
   reset(RST_VECTOR);  
+  g_tape_header_trapped = 0;
 }
 
 void cpu_clear_nmi()
@@ -1861,3 +2287,14 @@ uint8_t cpu_get_nmi()
 {
   return g_nmi_triggered;
 }
+
+void cpu_set_tape_trap(uint8_t active)
+{
+  g_tape_trap = active;
+}
+
+void cpu_set_disk_trap(uint8_t active)
+{
+  g_disk_trap = active;
+  dsk_bus_release();
+}
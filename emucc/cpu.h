@@ -46,5 +46,7 @@ void cpu_init();
 void cpu_reset();
 void cpu_clear_nmi();
 uint8_t cpu_get_nmi();
+void cpu_set_tape_trap(uint8_t active);
+void cpu_set_disk_trap(uint8_t active);
 
 #endif
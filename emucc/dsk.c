@@ -0,0 +1,1184 @@
+/*
+ * memwa2 disk (virtual drive) component
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+/**
+ * Virtual disk drive on device 8, used when the 1541 emulator is off.
+ * The kernal load, save and serial bus routines are trapped (see cpu.c)
+ * and served here straight from the d64 image held by the disk drive
+ * emulator, which the host gives access to sector by sector. A load is
+ * then a copy along the sector chain, no drive cpu and no bus protocol.
+ *
+ * Channels work as on the drive: 0 loads, 1 saves, 15 is the command
+ * and status channel and the others open files by name with ",type,mode".
+ * "$" gives the directory as a basic listing. Only one file can be
+ * written and one directory read at a time.
+ */
+
+#include "dsk.h"
+#include "if.h"
+#include <string.h>
+
+#define SECTOR_SIZE         0x100
+#define SECTORS_MAX         768 /* Stops looping chains */
+#define CHANNELS            16
+#define CHANNEL_COMMAND     15
+#define NAME_SIZE           16
+#define COMMAND_SIZE        41 /* Same as drive command buffer */
+#define LINE_SIZE           40
+#define STATUS_SIZE         40
+
+#define DIR_TRACK           18
+#define DIR_SECTOR          1
+#define DIR_INTERLEAVE      3
+#define FILE_INTERLEAVE     10
+#define BAM_SECTOR          0
+#define BAM_TRACKS          35
+#define BAM_ENTRIES         0x04
+#define BAM_NAME            0x90
+#define BAM_ID              0xA2
+#define BAM_DOS_TYPE        0xA5
+
+#define ENTRIES_PER_SECTOR  8
+#define ENTRY_SIZE          0x20
+#define ENTRY_TYPE          0x02
+#define ENTRY_TRACK         0x03
+#define ENTRY_SECTOR        0x04
+#define ENTRY_NAME          0x05
+#define ENTRY_BLOCKS        0x1E
+#define NAME_PAD            0xA0
+
+#define TYPE_MASK           0x07
+#define TYPE_LOCKED         0x40
+#define TYPE_CLOSED         0x80
+#define TYPE_SEQ            0x01
+#define TYPE_PRG            0x02
+#define TYPE_USR            0x03
+#define TYPE_REL            0x04
+#define TYPE_ANY            0xFF
+
+#define SECONDARY_OPEN      0xF0
+#define SECONDARY_CLOSE     0xE0
+
+#define LISTING_ADDRESS     0x0401
+#define LISTING_LINK        0x01 /* Any non zero link, basic relinks */
+
+typedef enum
+{
+  CHANNEL_CLOSED,
+  CHANNEL_READ,
+  CHANNEL_WRITE,
+  CHANNEL_LISTING
+} channel_type_t;
+
+typedef enum
+{
+  LISTING_HEADER,
+  LISTING_ENTRIES,
+  LISTING_FOOTER,
+  LISTING_END,
+  LISTING_DONE
+} listing_phase_t;
+
+typedef enum
+{
+  BUS_IDLE,
+  BUS_LISTEN,
+  BUS_TALK
+} bus_state_t;
+
+typedef struct
+{
+  uint8_t track;
+  uint8_t sector;
+  uint8_t index; /* Next entry in sector */
+  uint16_t sectors; /* Visited */
+} dir_t;
+
+typedef struct
+{
+  uint8_t name_a[NAME_SIZE];
+  uint8_t length;
+  uint8_t type;
+  uint8_t write;
+  uint8_t replace;
+} spec_t;
+
+typedef struct
+{
+  channel_type_t type;
+  uint8_t *data_p; /* Current sector */
+  uint16_t pos;
+  uint16_t last;
+  uint16_t sectors;
+} channel_t;
+
+typedef struct
+{
+  uint8_t channel;
+  listing_phase_t phase;
+  dir_t dir;
+  spec_t pattern;
+  uint8_t line_a[LINE_SIZE];
+  uint8_t pos;
+  uint8_t length;
+} listing_t;
+
+typedef struct
+{
+  uint8_t channel;
+  uint8_t failed;
+  uint8_t buffer_a[SECTOR_SIZE];
+  uint16_t pos;
+  uint8_t track;
+  uint8_t sector;
+  uint8_t first_track;
+  uint8_t first_sector;
+  uint16_t blocks;
+  uint8_t type;
+  uint8_t name_a[NAME_SIZE];
+  uint8_t entry_track;
+  uint8_t entry_sector;
+  uint8_t entry_index;
+  uint8_t entry_new; /* Directory needs a new sector, linked from entry t/s */
+  uint8_t new_sector;
+} write_t;
+
+typedef struct
+{
+  bus_state_t state;
+  uint8_t channel;
+  uint8_t open; /* Bytes are a name or a command */
+  uint8_t name_a[COMMAND_SIZE];
+  uint8_t length;
+} bus_t;
+
+typedef struct
+{
+  uint8_t text_a[STATUS_SIZE];
+  uint8_t pos;
+  uint8_t length;
+} status_t;
+
+extern if_host_t g_if_host; /* Main interface */
+
+static channel_t g_channel_a[CHANNELS];
+static listing_t g_listing;
+static write_t g_write;
+static bus_t g_bus;
+static status_t g_status;
+static uint8_t g_bam_a[SECTOR_SIZE]; /* Copy while changing the disk */
+static uint8_t g_sector_a[SECTOR_SIZE];
+
+static uint8_t *sector_get(uint8_t track, uint8_t sector)
+{
+  return g_if_host.if_host_disk.disk_read_sector_fp(track, sector);
+}
+
+static uint8_t sector_put(uint8_t track, uint8_t sector, uint8_t *data_p)
+{
+  return g_if_host.if_host_disk.disk_write_sector_fp(track, sector, data_p);
+}
+
+static uint8_t track_sectors(uint8_t track)
+{
+  if(track < 18)
+  {
+    return 21;
+  }
+  if(track < 25)
+  {
+    return 19;
+  }
+  if(track < 31)
+  {
+    return 18;
+  }
+  return 17;
+}
+
+static uint8_t put_number(uint8_t *dst_p, uint8_t number)
+{
+  dst_p[0] = '0' + number / 10 % 10;
+  dst_p[1] = '0' + number % 10;
+  return 2;
+}
+
+static void status_set(uint8_t code, char *text_p, uint8_t track, uint8_t sector)
+{
+  uint8_t i = 0;
+
+  i += put_number(g_status.text_a + i, code);
+  g_status.text_a[i++] = ',';
+  while(*text_p != '\0')
+  {
+    g_status.text_a[i++] = *text_p++;
+  }
+  g_status.text_a[i++] = ',';
+  i += put_number(g_status.text_a + i, track);
+  g_status.text_a[i++] = ',';
+  i += put_number(g_status.text_a + i, sector);
+  g_status.text_a[i++] = '\r';
+
+  g_status.length = i;
+  g_status.pos = 0;
+}
+
+static uint8_t *bam_entry(uint8_t track)
+{
+  return &g_bam_a[BAM_ENTRIES + (track - 1) * 4];
+}
+
+static uint8_t bam_free(uint8_t track, uint8_t sector)
+{
+  return bam_entry(track)[1 + sector / 8] & (1 << (sector % 8));
+}
+
+static void bam_set(uint8_t track, uint8_t sector, uint8_t free)
+{
+  uint8_t *entry_p = bam_entry(track);
+
+  if(track == 0 || track > BAM_TRACKS || sector >= track_sectors(track))
+  {
+    return;
+  }
+
+  if(free && !bam_free(track, sector))
+  {
+    entry_p[1 + sector / 8] |= 1 << (sector % 8);
+    entry_p[0]++;
+  }
+  else if(!free && bam_free(track, sector))
+  {
+    entry_p[1 + sector / 8] &= ~(1 << (sector % 8));
+    entry_p[0]--;
+  }
+}
+
+static uint8_t bam_alloc_on(uint8_t track, uint8_t start, uint8_t *sector_p)
+{
+  uint8_t sectors = track_sectors(track);
+  uint8_t sector;
+  uint8_t i;
+
+  for(i = 0; i < sectors; i++)
+  {
+    sector = (start + i) % sectors;
+    if(bam_free(track, sector))
+    {
+      bam_set(track, sector, 0);
+      *sector_p = sector;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Same track with interleave first, then nearest to directory */
+static uint8_t bam_alloc(uint8_t *track_p, uint8_t *sector_p)
+{
+  uint8_t distance;
+  uint8_t track;
+
+  if(*track_p != 0 && *track_p != DIR_TRACK &&
+     bam_alloc_on(*track_p, *sector_p + FILE_INTERLEAVE, sector_p))
+  {
+    return 1;
+  }
+
+  for(distance = 1; distance < DIR_TRACK; distance++)
+  {
+    track = DIR_TRACK - distance;
+    if(bam_alloc_on(track, 0, sector_p))
+    {
+      *track_p = track;
+      return 1;
+    }
+
+    track = DIR_TRACK + distance;
+    if(track <= BAM_TRACKS && bam_alloc_on(track, 0, sector_p))
+    {
+      *track_p = track;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static uint16_t bam_blocks_free()
+{
+  uint8_t *bam_p = sector_get(DIR_TRACK, BAM_SECTOR);
+  uint16_t blocks = 0;
+  uint8_t track;
+
+  for(track = 1; bam_p != NULL && track <= BAM_TRACKS; track++)
+  {
+    if(track != DIR_TRACK)
+    {
+      blocks += bam_p[BAM_ENTRIES + (track - 1) * 4];
+    }
+  }
+
+  return blocks;
+}
+
+static void dir_start(dir_t *dir_p)
+{
+  dir_p->track = DIR_TRACK;
+  dir_p->sector = DIR_SECTOR;
+  dir_p->index = 0;
+  dir_p->sectors = 0;
+}
+
+/* Entry index - 1 in the current dir t/s is the one returned */
+static uint8_t *dir_next(dir_t *dir_p)
+{
+  uint8_t *sector_p;
+
+  while(dir_p->track != 0)
+  {
+    sector_p = sector_get(dir_p->track, dir_p->sector);
+    if(sector_p == NULL || dir_p->sectors >= SECTORS_MAX)
+    {
+      dir_p->track = 0;
+      break;
+    }
+
+    if(dir_p->index < ENTRIES_PER_SECTOR)
+    {
+      return sector_p + dir_p->index++ * ENTRY_SIZE;
+    }
+
+    if(sector_p[0] == 0)
+    {
+      break;
+    }
+    dir_p->track = sector_p[0];
+    dir_p->sector = sector_p[1];
+    dir_p->index = 0;
+    dir_p->sectors++;
+  }
+
+  return NULL;
+}
+
+static uint8_t name_match(uint8_t *name_p, spec_t *spec_p)
+{
+  uint8_t i;
+
+  for(i = 0; i < NAME_SIZE; i++)
+  {
+    if(i == spec_p->length)
+    {
+      return name_p[i] == NAME_PAD;
+    }
+    if(spec_p->name_a[i] == '*')
+    {
+      return 1;
+    }
+    if(name_p[i] == NAME_PAD ||
+       (spec_p->name_a[i] != '?' && spec_p->name_a[i] != name_p[i]))
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static uint8_t *file_find(spec_t *spec_p, dir_t *dir_p, uint8_t closed)
+{
+  uint8_t *entry_p;
+
+  dir_start(dir_p);
+  while((entry_p = dir_next(dir_p)) != NULL)
+  {
+    if(entry_p[ENTRY_TYPE] == 0 ||
+       (closed && !(entry_p[ENTRY_TYPE] & TYPE_CLOSED)) ||
+       (spec_p->type != TYPE_ANY && (entry_p[ENTRY_TYPE] & TYPE_MASK) != spec_p->type))
+    {
+      continue;
+    }
+
+    if(name_match(entry_p + ENTRY_NAME, spec_p))
+    {
+      return entry_p;
+    }
+  }
+
+  return NULL;
+}
+
+/* "[@][0]:name[,type][,mode]" */
+static uint8_t spec_parse(spec_t *spec_p, uint8_t *name_p, uint8_t length)
+{
+  uint8_t i;
+
+  memset(spec_p, 0, sizeof(spec_t));
+  spec_p->type = TYPE_ANY;
+
+  if(length > 0 && name_p[0] == '@')
+  {
+    spec_p->replace = 1;
+    name_p++;
+    length--;
+  }
+
+  for(i = 0; i < length && name_p[i] != ','; i++)
+  {
+    if(name_p[i] == ':')
+    {
+      name_p += i + 1;
+      length -= i + 1;
+      break;
+    }
+  }
+
+  for(i = 0; i < length && name_p[i] != ','; i++)
+  {
+    if(i == NAME_SIZE)
+    {
+      return 0;
+    }
+    spec_p->name_a[i] = name_p[i];
+  }
+  spec_p->length = i;
+
+  while(i < length)
+  {
+    i++; /* Skip ',' */
+    if(i == length)
+    {
+      return 0;
+    }
+
+    switch(name_p[i])
+    {
+    case 'P':
+      spec_p->type = TYPE_PRG;
+      break;
+    case 'S':
+      spec_p->type = TYPE_SEQ;
+      break;
+    case 'U':
+      spec_p->type = TYPE_USR;
+      break;
+    case 'L':
+      spec_p->type = TYPE_REL;
+      break;
+    case 'W':
+      spec_p->write = 1;
+      break;
+    case 'R':
+      break;
+    default:
+      return 0;
+    }
+
+    while(i < length && name_p[i] != ',')
+    {
+      i++;
+    }
+  }
+
+  return 1;
+}
+
+static uint8_t scratch(spec_t *spec_p)
+{
+  dir_t dir;
+  uint8_t *entry_p;
+  uint8_t *sector_p;
+  uint8_t track;
+  uint8_t sector;
+  uint16_t sectors;
+  uint8_t files = 0;
+
+  while((entry_p = file_find(spec_p, &dir, 0)) != NULL &&
+        !(entry_p[ENTRY_TYPE] & TYPE_LOCKED))
+  {
+    track = entry_p[ENTRY_TRACK];
+    sector = entry_p[ENTRY_SECTOR];
+    for(sectors = 0; track != 0 && sectors < SECTORS_MAX; sectors++)
+    {
+      sector_p = sector_get(track, sector);
+      if(sector_p == NULL)
+      {
+        break;
+      }
+      bam_set(track, sector, 1);
+      track = sector_p[0];
+      sector = sector_p[1];
+    }
+
+    memcpy(g_sector_a, sector_get(dir.track, dir.sector), SECTOR_SIZE);
+    g_sector_a[(dir.index - 1) * ENTRY_SIZE + ENTRY_TYPE] = 0;
+    if(!sector_put(dir.track, dir.sector, g_sector_a))
+    {
+      break;
+    }
+    files++;
+  }
+
+  if(files > 0)
+  {
+    sector_put(DIR_TRACK, BAM_SECTOR, g_bam_a);
+  }
+
+  return files;
+}
+
+static uint8_t listing_number(uint8_t *dst_p, uint16_t number)
+{
+  dst_p[0] = LISTING_LINK;
+  dst_p[1] = LISTING_LINK;
+  dst_p[2] = number & 0xFF;
+  dst_p[3] = number >> 8;
+  return 4;
+}
+
+static uint8_t listing_line()
+{
+  uint8_t *line_p = g_listing.line_a;
+  uint8_t *bam_p;
+  uint8_t *entry_p;
+  uint8_t i = 0;
+  uint8_t j;
+  uint16_t blocks;
+
+  static const char *type_a[8] = {"DEL", "SEQ", "PRG", "USR", "REL", "???", "???", "???"};
+
+  switch(g_listing.phase)
+  {
+  case LISTING_HEADER:
+    bam_p = sector_get(DIR_TRACK, BAM_SECTOR);
+    if(bam_p == NULL)
+    {
+      return 0;
+    }
+    line_p[i++] = LISTING_ADDRESS & 0xFF;
+    line_p[i++] = LISTING_ADDRESS >> 8;
+    i += listing_number(line_p + i, 0);
+    line_p[i++] = 0x12; /* Reverse on */
+    line_p[i++] = '"';
+    memcpy(line_p + i, bam_p + BAM_NAME, NAME_SIZE);
+    i += NAME_SIZE;
+    line_p[i++] = '"';
+    line_p[i++] = ' ';
+    line_p[i++] = bam_p[BAM_ID];
+    line_p[i++] = bam_p[BAM_ID + 1];
+    line_p[i++] = ' ';
+    line_p[i++] = bam_p[BAM_DOS_TYPE];
+    line_p[i++] = bam_p[BAM_DOS_TYPE + 1];
+    dir_start(&g_listing.dir);
+    g_listing.phase = LISTING_ENTRIES;
+    break;
+
+  case LISTING_ENTRIES:
+    do
+    {
+      entry_p = dir_next(&g_listing.dir);
+    }
+    while(entry_p != NULL &&
+          (entry_p[ENTRY_TYPE] == 0 ||
+           (g_listing.pattern.length > 0 && !name_match(entry_p + ENTRY_NAME, &g_listing.pattern))));
+
+    if(entry_p == NULL)
+    {
+      g_listing.phase = LISTING_FOOTER;
+      return listing_line();
+    }
+
+    blocks = entry_p[ENTRY_BLOCKS] | entry_p[ENTRY_BLOCKS + 1] << 8;
+    i += listing_number(line_p + i, blocks);
+    for(j = blocks < 10 ? 3 : blocks < 100 ? 2 : 1; j > 0; j--)
+    {
+      line_p[i++] = ' ';
+    }
+    line_p[i++] = '"';
+    for(j = 0; j < NAME_SIZE && entry_p[ENTRY_NAME + j] != NAME_PAD; j++)
+    {
+      line_p[i++] = entry_p[ENTRY_NAME + j];
+    }
+    line_p[i++] = '"';
+    for(; j < NAME_SIZE; j++)
+    {
+      line_p[i++] = ' ';
+    }
+    line_p[i++] = (entry_p[ENTRY_TYPE] & TYPE_CLOSED) ? ' ' : '*';
+    memcpy(line_p + i, type_a[entry_p[ENTRY_TYPE] & TYPE_MASK], 3);
+    i += 3;
+    line_p[i++] = (entry_p[ENTRY_TYPE] & TYPE_LOCKED) ? '<' : ' ';
+    break;
+
+  case LISTING_FOOTER:
+    i += listing_number(line_p + i, bam_blocks_free());
+    memcpy(line_p + i, "BLOCKS FREE.", 12);
+    i += 12;
+    g_listing.phase = LISTING_END;
+    break;
+
+  case LISTING_END:
+    line_p[i++] = 0x00; /* End of program */
+    line_p[i++] = 0x00;
+    g_listing.phase = LISTING_DONE;
+    break;
+
+  case LISTING_DONE:
+    return 0;
+  }
+
+  if(g_listing.phase != LISTING_DONE)
+  {
+    line_p[i++] = 0x00; /* End of line */
+  }
+
+  g_listing.pos = 0;
+  g_listing.length = i;
+
+  return 1;
+}
+
+static dsk_result_t open_listing(uint8_t channel, uint8_t *name_p, uint8_t length)
+{
+  if(g_channel_a[g_listing.channel].type == CHANNEL_LISTING)
+  {
+    status_set(70, "NO CHANNEL", 0, 0);
+    return DSK_ERROR;
+  }
+
+  /* "$[0][:pattern]" */
+  if(!spec_parse(&g_listing.pattern, name_p, length))
+  {
+    status_set(30, "SYNTAX ERROR", 0, 0);
+    return DSK_ERROR;
+  }
+  if(g_listing.pattern.length == 1 && g_listing.pattern.name_a[0] == '0')
+  {
+    g_listing.pattern.length = 0;
+  }
+
+  g_listing.channel = channel;
+  g_listing.phase = LISTING_HEADER;
+  g_listing.pos = 0;
+  g_listing.length = 0;
+  g_channel_a[channel].type = CHANNEL_LISTING;
+
+  return DSK_OK;
+}
+
+static void channel_sector(channel_t *channel_p, uint8_t *sector_p)
+{
+  channel_p->data_p = sector_p;
+  channel_p->pos = 2;
+  channel_p->last = sector_p[0] == 0 ? sector_p[1] : SECTOR_SIZE - 1;
+}
+
+static dsk_result_t open_read(uint8_t channel, spec_t *spec_p)
+{
+  dir_t dir;
+  uint8_t *entry_p = file_find(spec_p, &dir, 1);
+  uint8_t *sector_p;
+
+  if(entry_p == NULL)
+  {
+    status_set(62, "FILE NOT FOUND", 0, 0);
+    return DSK_NOT_FOUND;
+  }
+
+  sector_p = sector_get(entry_p[ENTRY_TRACK], entry_p[ENTRY_SECTOR]);
+  if(sector_p == NULL)
+  {
+    status_set(66, "ILLEGAL TRACK OR SECTOR", entry_p[ENTRY_TRACK], entry_p[ENTRY_SECTOR]);
+    return DSK_ERROR;
+  }
+
+  channel_sector(&g_channel_a[channel], sector_p);
+  g_channel_a[channel].sectors = 0;
+  g_channel_a[channel].type = CHANNEL_READ;
+
+  return DSK_OK;
+}
+
+static dsk_result_t open_write(uint8_t channel, spec_t *spec_p)
+{
+  dir_t dir;
+  uint8_t *entry_p;
+  uint8_t *bam_p = sector_get(DIR_TRACK, BAM_SECTOR);
+  uint8_t i;
+
+  if(g_channel_a[g_write.channel].type == CHANNEL_WRITE)
+  {
+    status_set(70, "NO CHANNEL", 0, 0);
+    return DSK_ERROR;
+  }
+
+  for(i = 0; i < spec_p->length; i++)
+  {
+    if(spec_p->name_a[i] == '*' || spec_p->name_a[i] == '?')
+    {
+      status_set(33, "SYNTAX ERROR", 0, 0);
+      return DSK_ERROR;
+    }
+  }
+
+  memcpy(g_bam_a, bam_p, SECTOR_SIZE);
+
+  if(file_find(spec_p, &dir, 0) != NULL)
+  {
+    if(!spec_p->replace)
+    {
+      status_set(63, "FILE EXISTS", 0, 0);
+      return DSK_ERROR;
+    }
+    (void)scratch(spec_p);
+  }
+
+  memset(&g_write, 0, sizeof(write_t));
+
+  /* Free entry, or a new directory sector after the last one */
+  dir_start(&dir);
+  do
+  {
+    entry_p = dir_next(&dir);
+  }
+  while(entry_p != NULL && entry_p[ENTRY_TYPE] != 0);
+
+  if(entry_p != NULL)
+  {
+    g_write.entry_track = dir.track;
+    g_write.entry_sector = dir.sector;
+    g_write.entry_index = dir.index - 1;
+  }
+  else if(dir.track != 0 && bam_alloc_on(DIR_TRACK, dir.sector + DIR_INTERLEAVE, &g_write.new_sector))
+  {
+    g_write.entry_track = dir.track;
+    g_write.entry_sector = dir.sector;
+    g_write.entry_new = 1;
+  }
+  else
+  {
+    status_set(72, "DISK FULL", 0, 0);
+    return DSK_ERROR;
+  }
+
+  if(!bam_alloc(&g_write.track, &g_write.sector))
+  {
+    status_set(72, "DISK FULL", 0, 0);
+    return DSK_ERROR;
+  }
+
+  g_write.channel = channel;
+  g_write.first_track = g_write.track;
+  g_write.first_sector = g_write.sector;
+  g_write.blocks = 1;
+  g_write.pos = 2;
+  g_write.type = spec_p->type == TYPE_ANY ? TYPE_PRG : spec_p->type;
+  memset(g_write.name_a, NAME_PAD, NAME_SIZE);
+  memcpy(g_write.name_a, spec_p->name_a, spec_p->length);
+  g_channel_a[channel].type = CHANNEL_WRITE;
+
+  return DSK_OK;
+}
+
+static void close_write()
+{
+  uint8_t *entry_p;
+
+  g_write.buffer_a[0] = 0;
+  g_write.buffer_a[1] = g_write.pos - 1;
+  if(g_write.failed ||
+     !sector_put(g_write.track, g_write.sector, g_write.buffer_a))
+  {
+    /* Blocks are still free in the bam on disk */
+    return;
+  }
+
+  if(g_write.entry_new)
+  {
+    /* Link last directory sector to the new one */
+    memcpy(g_sector_a, sector_get(g_write.entry_track, g_write.entry_sector), SECTOR_SIZE);
+    g_sector_a[0] = DIR_TRACK;
+    g_sector_a[1] = g_write.new_sector;
+    sector_put(g_write.entry_track, g_write.entry_sector, g_sector_a);
+
+    memset(g_sector_a, 0, SECTOR_SIZE);
+    g_sector_a[1] = 0xFF;
+    g_write.entry_track = DIR_TRACK;
+    g_write.entry_sector = g_write.new_sector;
+    g_write.entry_index = 0;
+  }
+  else
+  {
+    memcpy(g_sector_a, sector_get(g_write.entry_track, g_write.entry_sector), SECTOR_SIZE);
+  }
+
+  entry_p = g_sector_a + g_write.entry_index * ENTRY_SIZE;
+  entry_p[ENTRY_TYPE] = g_write.type | TYPE_CLOSED;
+  entry_p[ENTRY_TRACK] = g_write.first_track;
+  entry_p[ENTRY_SECTOR] = g_write.first_sector;
+  memcpy(entry_p + ENTRY_NAME, g_write.name_a, NAME_SIZE);
+  memset(entry_p + ENTRY_NAME + NAME_SIZE, 0, ENTRY_BLOCKS - ENTRY_NAME - NAME_SIZE);
+  entry_p[ENTRY_BLOCKS] = g_write.blocks & 0xFF;
+  entry_p[ENTRY_BLOCKS + 1] = g_write.blocks >> 8;
+
+  if(sector_put(g_write.entry_track, g_write.entry_sector, g_sector_a))
+  {
+    sector_put(DIR_TRACK, BAM_SECTOR, g_bam_a);
+  }
+}
+
+static dsk_result_t write_file(uint8_t byte)
+{
+  uint8_t track = g_write.track;
+  uint8_t sector = g_write.sector;
+
+  if(g_write.failed)
+  {
+    return DSK_ERROR;
+  }
+
+  if(g_write.pos == SECTOR_SIZE)
+  {
+    if(!bam_alloc(&track, &sector))
+    {
+      status_set(72, "DISK FULL", 0, 0);
+      g_write.failed = 1;
+      return DSK_ERROR;
+    }
+
+    g_write.buffer_a[0] = track;
+    g_write.buffer_a[1] = sector;
+    if(!sector_put(g_write.track, g_write.sector, g_write.buffer_a))
+    {
+      status_set(25, "WRITE ERROR", g_write.track, g_write.sector);
+      g_write.failed = 1;
+      return DSK_ERROR;
+    }
+
+    g_write.track = track;
+    g_write.sector = sector;
+    g_write.blocks++;
+    g_write.pos = 2;
+  }
+
+  g_write.buffer_a[g_write.pos++] = byte;
+
+  return DSK_OK;
+}
+
+static dsk_result_t read_file(channel_t *channel_p, uint8_t *byte_p)
+{
+  uint8_t *sector_p;
+
+  if(channel_p->pos > channel_p->last)
+  {
+    if(channel_p->data_p[0] == 0)
+    {
+      return DSK_ERROR;
+    }
+
+    sector_p = sector_get(channel_p->data_p[0], channel_p->data_p[1]);
+    if(sector_p == NULL || ++channel_p->sectors >= SECTORS_MAX)
+    {
+      status_set(66, "ILLEGAL TRACK OR SECTOR", channel_p->data_p[0], channel_p->data_p[1]);
+      channel_p->type = CHANNEL_CLOSED;
+      return DSK_ERROR;
+    }
+    channel_sector(channel_p, sector_p);
+  }
+
+  *byte_p = channel_p->data_p[channel_p->pos++];
+
+  return channel_p->pos > channel_p->last && channel_p->data_p[0] == 0 ? DSK_END : DSK_OK;
+}
+
+static dsk_result_t read_listing(uint8_t *byte_p)
+{
+  if(g_listing.pos == g_listing.length && !listing_line())
+  {
+    return DSK_ERROR;
+  }
+
+  *byte_p = g_listing.line_a[g_listing.pos++];
+
+  return g_listing.pos == g_listing.length && g_listing.phase == LISTING_DONE ? DSK_END : DSK_OK;
+}
+
+static dsk_result_t read_status(uint8_t *byte_p)
+{
+  *byte_p = g_status.text_a[g_status.pos++];
+
+  if(g_status.pos == g_status.length)
+  {
+    status_set(0, " OK", 0, 0);
+    return DSK_END;
+  }
+
+  return DSK_OK;
+}
+
+static void command(uint8_t *command_p, uint8_t length)
+{
+  spec_t spec;
+  uint8_t files;
+
+  if(length > 0 && command_p[length - 1] == '\r')
+  {
+    length--;
+  }
+  if(length == 0)
+  {
+    return;
+  }
+
+  status_set(0, " OK", 0, 0);
+
+  switch(command_p[0])
+  {
+  case 'I': /* Initialize */
+  case 'V': /* Validate, bam is always valid here */
+    break;
+  case 'U':
+    if(length > 1 && (command_p[1] == 'I' || command_p[1] == 'J' || command_p[1] == ':'))
+    {
+      status_set(73, "CBM DOS V2.6 1541", 0, 0);
+    }
+    else
+    {
+      status_set(31, "SYNTAX ERROR", 0, 0);
+    }
+    break;
+  case 'S': /* Scratch */
+    if(sector_get(DIR_TRACK, BAM_SECTOR) == NULL)
+    {
+      status_set(74, "DRIVE NOT READY", 0, 0);
+    }
+    else if(!spec_parse(&spec, command_p + 1, length - 1) || spec.length == 0)
+    {
+      status_set(34, "SYNTAX ERROR", 0, 0);
+    }
+    else
+    {
+      memcpy(g_bam_a, sector_get(DIR_TRACK, BAM_SECTOR), SECTOR_SIZE);
+      spec.type = TYPE_ANY;
+      files = scratch(&spec);
+      status_set(1, "FILES SCRATCHED", files, 0);
+    }
+    break;
+  default:
+    status_set(31, "SYNTAX ERROR", 0, 0);
+    break;
+  }
+}
+
+void dsk_init()
+{
+  memset(g_channel_a, 0, sizeof(g_channel_a));
+  memset(&g_bus, 0, sizeof(bus_t));
+  status_set(73, "CBM DOS V2.6 1541", 0, 0);
+}
+
+dsk_result_t dsk_open(uint8_t channel, uint8_t *name_p, uint8_t length)
+{
+  spec_t spec;
+
+  channel &= CHANNEL_COMMAND;
+
+  if(channel == CHANNEL_COMMAND)
+  {
+    command(name_p, length);
+    return DSK_OK;
+  }
+
+  dsk_close(channel);
+
+  if(sector_get(DIR_TRACK, BAM_SECTOR) == NULL)
+  {
+    status_set(74, "DRIVE NOT READY", 0, 0);
+    return DSK_NO_DISK;
+  }
+
+  status_set(0, " OK", 0, 0);
+
+  if(length > 0 && name_p[0] == '$')
+  {
+    return open_listing(channel, name_p + 1, length - 1);
+  }
+
+  if(!spec_parse(&spec, name_p, length) || spec.length == 0)
+  {
+    status_set(34, "SYNTAX ERROR", 0, 0);
+    return DSK_ERROR;
+  }
+
+  /* Secondary address decides for load and save */
+  if(channel == DSK_CHANNEL_LOAD)
+  {
+    spec.write = 0;
+  }
+  else if(channel == DSK_CHANNEL_SAVE)
+  {
+    spec.write = 1;
+  }
+
+  return spec.write ? open_write(channel, &spec) : open_read(channel, &spec);
+}
+
+dsk_result_t dsk_read(uint8_t channel, uint8_t *byte_p)
+{
+  channel &= CHANNEL_COMMAND;
+
+  if(channel == CHANNEL_COMMAND)
+  {
+    return read_status(byte_p);
+  }
+
+  switch(g_channel_a[channel].type)
+  {
+  case CHANNEL_READ:
+    return read_file(&g_channel_a[channel], byte_p);
+  case CHANNEL_LISTING:
+    return read_listing(byte_p);
+  default:
+    return DSK_ERROR;
+  }
+}
+
+dsk_result_t dsk_write(uint8_t channel, uint8_t byte)
+{
+  channel &= CHANNEL_COMMAND;
+
+  if(g_channel_a[channel].type != CHANNEL_WRITE)
+  {
+    return DSK_ERROR;
+  }
+
+  return write_file(byte);
+}
+
+void dsk_close(uint8_t channel)
+{
+  uint8_t i;
+
+  channel &= CHANNEL_COMMAND;
+
+  /* Closing the command channel closes all */
+  if(channel == CHANNEL_COMMAND)
+  {
+    for(i = 0; i < CHANNEL_COMMAND; i++)
+    {
+      dsk_close(i);
+    }
+    return;
+  }
+
+  if(g_channel_a[channel].type == CHANNEL_WRITE)
+  {
+    close_write();
+  }
+
+  g_channel_a[channel].type = CHANNEL_CLOSED;
+}
+
+void dsk_bus_listen()
+{
+  g_bus.state = BUS_LISTEN;
+  g_bus.open = 0;
+}
+
+void dsk_bus_talk()
+{
+  g_bus.state = BUS_TALK;
+  g_bus.open = 0;
+}
+
+void dsk_bus_release()
+{
+  g_bus.state = BUS_IDLE;
+  g_bus.open = 0;
+}
+
+uint8_t dsk_bus_addressed()
+{
+  return g_bus.state != BUS_IDLE;
+}
+
+void dsk_bus_second(uint8_t secondary)
+{
+  g_bus.channel = secondary & CHANNEL_COMMAND;
+  g_bus.length = 0;
+
+  switch(secondary & 0xF0)
+  {
+  case SECONDARY_OPEN:
+    g_bus.open = 1;
+    break;
+  case SECONDARY_CLOSE:
+    g_bus.open = 0;
+    dsk_close(g_bus.channel);
+    break;
+  default:
+    /* Data to command channel is a command */
+    g_bus.open = g_bus.channel == CHANNEL_COMMAND;
+    break;
+  }
+}
+
+void dsk_bus_tksa(uint8_t secondary)
+{
+  g_bus.channel = secondary & CHANNEL_COMMAND;
+}
+
+void dsk_bus_ciout(uint8_t byte)
+{
+  if(!g_bus.open)
+  {
+    (void)dsk_write(g_bus.channel, byte);
+  }
+  else if(g_bus.length < COMMAND_SIZE)
+  {
+    g_bus.name_a[g_bus.length++] = byte;
+  }
+}
+
+dsk_result_t dsk_bus_acptr(uint8_t *byte_p)
+{
+  return dsk_read(g_bus.channel, byte_p);
+}
+
+void dsk_bus_unlisten()
+{
+  if(g_bus.open)
+  {
+    (void)dsk_open(g_bus.channel, g_bus.name_a, g_bus.length);
+  }
+
+  dsk_bus_release();
+}
+
+void dsk_bus_untalk()
+{
+  dsk_bus_release();
+}
@@ -0,0 +1,58 @@
+/*
+ * memwa2 disk (virtual drive) component
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+#ifndef _DSK_H
+#define _DSK_H
+
+#include "emuccif.h"
+
+#define DSK_DEVICE                              8
+#define DSK_CHANNEL_LOAD                        0
+#define DSK_CHANNEL_SAVE                        1
+
+typedef enum
+{
+  DSK_OK,
+  DSK_END, /* Byte is the last one */
+  DSK_NOT_FOUND,
+  DSK_NO_DISK,
+  DSK_ERROR /* See status on command channel */
+} dsk_result_t;
+
+void dsk_init();
+dsk_result_t dsk_open(uint8_t channel, uint8_t *name_p, uint8_t length);
+dsk_result_t dsk_read(uint8_t channel, uint8_t *byte_p);
+dsk_result_t dsk_write(uint8_t channel, uint8_t byte);
+void dsk_close(uint8_t channel);
+void dsk_bus_listen();
+void dsk_bus_talk();
+void dsk_bus_release();
+uint8_t dsk_bus_addressed();
+void dsk_bus_second(uint8_t secondary);
+void dsk_bus_tksa(uint8_t secondary);
+void dsk_bus_ciout(uint8_t byte);
+dsk_result_t dsk_bus_acptr(uint8_t *byte_p);
+void dsk_bus_unlisten();
+void dsk_bus_untalk();
+
+#endif
@@ -36,7 +36,12 @@
 #include "cia.h"
 #include "cpu.h"
 #include "tap.h"
+#include "dsk.h"
 #include "sid.h"
+#include "scale.h"
+#include <string.h>
+
+#define TEXT_SLICE_CYCLES   (312 * 63) /* One PAL frame between screen checks */
 
 void if_emu_cc_ue_joyst(if_joyst_port_t if_joyst_port, if_joyst_action_t if_joyst_action, if_joyst_action_state_t if_action_state);
 void if_emu_cc_ue_keybd(uint8_t *keybd_keys_p, uint8_t max_keys, if_key_state_t key_shift, if_key_state_t key_ctrl);
@@ -44,17 +49,33 @@ void if_emu_cc_ue_keybd_map_set(if_keybd_map_t *if_keybd_map_p);
 void if_emu_cc_display_layer_set(uint8_t *layer_p);
 void if_emu_cc_display_limit_frame_rate(uint8_t active);
 void if_emu_cc_display_lock_frame_rate(uint8_t active);
+void if_emu_cc_display_scaler_set(uint8_t scale, uint8_t borders);
+void if_emu_cc_display_render(uint8_t active);
+void if_emu_cc_display_interlace(uint8_t active);
+void if_emu_cc_display_viewport_set(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+void if_emu_cc_display_reg_log(uint8_t active);
+void if_emu_cc_display_reg_log_line(uint16_t line, if_reg_log_line_t *log_line_p);
+void if_emu_cc_display_text_get(char *text_p);
 void if_emu_cc_mem_set(uint8_t *mem_p, if_mem_cc_type_t mem_type);
 void if_emu_cc_op_init();
 void if_emu_cc_op_run(int32_t cycles);
 void if_emu_cc_op_reset();
+uint32_t if_emu_cc_op_cycles();
+uint8_t if_emu_cc_op_run_until_text(char *text_p, uint32_t cycles_max);
 void if_emu_cc_tape_drive_load(uint32_t *fd_p);
 void if_emu_cc_tape_drive_play();
 void if_emu_cc_tape_drive_stop();
-void if_emu_cc_time_tenth_second();
+void if_emu_cc_tape_drive_poll();
+void if_emu_cc_tape_drive_fast_load(uint8_t active);
+void if_emu_cc_tape_drive_wind(int32_t blocks);
+uint32_t if_emu_cc_tape_drive_counter();
+void if_emu_cc_tape_drive_record(uint32_t *fd_p);
+void if_emu_cc_disk_drive_virtual(uint8_t active);
 void if_emu_cc_ports_write_serial(uint8_t data);
 
 static int32_t g_cycle_queue;
+static uint32_t g_cycle_cnt;
+static char g_text_a[IF_EMU_CC_TEXT_SIZE];
 
 if_emu_cc_t g_if_cc_emu =
 {
@@ -66,7 +87,14 @@ if_emu_cc_t g_if_cc_emu =
   {
     if_emu_cc_display_layer_set,
     if_emu_cc_display_limit_frame_rate,
-    if_emu_cc_display_lock_frame_rate
+    if_emu_cc_display_lock_frame_rate,
+    if_emu_cc_display_scaler_set,
+    if_emu_cc_display_render,
+    if_emu_cc_display_interlace,
+    if_emu_cc_display_viewport_set,
+    if_emu_cc_display_reg_log,
+    if_emu_cc_display_reg_log_line,
+    if_emu_cc_display_text_get
   },
   {
     if_emu_cc_mem_set
@@ -74,15 +102,22 @@ if_emu_cc_t g_if_cc_emu =
   {
     if_emu_cc_op_init,
     if_emu_cc_op_run,
-    if_emu_cc_op_reset
+    if_emu_cc_op_reset,
+    if_emu_cc_op_cycles,
+    if_emu_cc_op_run_until_text
   },
   {
     if_emu_cc_tape_drive_load,
     if_emu_cc_tape_drive_play,
-    if_emu_cc_tape_drive_stop
+    if_emu_cc_tape_drive_stop,
+    if_emu_cc_tape_drive_poll,
+    if_emu_cc_tape_drive_fast_load,
+    if_emu_cc_tape_drive_wind,
+    if_emu_cc_tape_drive_counter,
+    if_emu_cc_tape_drive_record
   },
   {
-    if_emu_cc_time_tenth_second
+    if_emu_cc_disk_drive_virtual
   },
   {
     if_emu_cc_ports_write_serial
@@ -147,6 +182,9 @@ void if_emu_cc_mem_set(uint8_t *mem_p, if_mem_cc_type_t mem_type)
     case IF_MEM_CC_TYPE_SPRITE3:
       vic_set_memory(mem_p, VIC_MEM_SPRITE_MAP);
       break;
+    case IF_MEM_CC_TYPE_TAPE:
+      tap_set_memory(mem_p);
+      break;
   }
 }
 
@@ -158,6 +196,7 @@ void if_emu_cc_op_init()
   joy_init();
   cia_init();
   tap_init();
+  dsk_init();
   sid_init();
   cpu_init();
 }
@@ -186,6 +225,7 @@ void if_emu_cc_op_run(int32_t cycles)
     tap_step(cc);
 
     g_cycle_queue -= cc;
+    g_cycle_cnt += cc;
   }
 }
 
@@ -194,6 +234,11 @@ void if_emu_cc_op_reset()
   cpu_reset();
 }
 
+uint32_t if_emu_cc_op_cycles()
+{
+  return g_cycle_cnt;
+}
+
 void if_emu_cc_tape_drive_load(uint32_t *fd_p)
 {
   tap_insert_tape(fd_p);
@@ -209,9 +254,34 @@ void if_emu_cc_tape_drive_stop()
   tap_stop();
 }
 
-void if_emu_cc_time_tenth_second()
+void if_emu_cc_tape_drive_poll()
+{
+  tap_poll();
+}
+
+void if_emu_cc_tape_drive_fast_load(uint8_t active)
 {
-  cia_tenth_second();
+  cpu_set_tape_trap(active);
+}
+
+void if_emu_cc_tape_drive_wind(int32_t blocks)
+{
+  tap_wind(blocks);
+}
+
+uint32_t if_emu_cc_tape_drive_counter()
+{
+  return tap_get_counter();
+}
+
+void if_emu_cc_tape_drive_record(uint32_t *fd_p)
+{
+  tap_record(fd_p);
+}
+
+void if_emu_cc_disk_drive_virtual(uint8_t active)
+{
+  cpu_set_disk_trap(active);
 }
 
 void if_emu_cc_ports_write_serial(uint8_t data)
@@ -242,3 +312,81 @@ void if_emu_cc_display_lock_frame_rate(uint8_t active)
         vic_unlock_frame_rate();
     }
 }
+
+void if_emu_cc_display_scaler_set(uint8_t scale, uint8_t borders)
+{
+  scale_set(scale, borders);
+}
+
+void if_emu_cc_display_render(uint8_t active)
+{
+  vic_set_render(active);
+}
+
+void if_emu_cc_display_interlace(uint8_t active)
+{
+  vic_set_interlace(active);
+}
+
+void if_emu_cc_display_viewport_set(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+  vic_set_viewport(x, y, width, height);
+}
+
+void if_emu_cc_display_reg_log(uint8_t active)
+{
+  vic_log_set_active(active);
+}
+
+void if_emu_cc_display_reg_log_line(uint16_t line, if_reg_log_line_t *log_line_p)
+{
+  vic_log_snapshot_t *snapshot_p = vic_log_get_snapshot();
+  vic_log_entry_t *entries_p;
+  uint32_t cnt;
+  uint32_t i;
+
+  memcpy(log_line_p->regs_a, snapshot_p->regs_a, IF_EMU_CC_REG_LOG_REGS);
+  log_line_p->bank = snapshot_p->bank;
+  log_line_p->complete = !vic_log_get_overflow();
+
+  cnt = vic_log_get_line(line, &entries_p);
+  if(cnt > IF_EMU_CC_REG_LOG_LINE_MAX)
+  {
+    cnt = IF_EMU_CC_REG_LOG_LINE_MAX;
+    log_line_p->complete = 0;
+  }
+
+  for(i = 0; i < cnt; i++)
+  {
+    log_line_p->writes_a[i].cycle = entries_p[i].cycle % VIC_LOG_CYCLES_LINE;
+    log_line_p->writes_a[i].addr = entries_p[i].addr;
+    log_line_p->writes_a[i].value = entries_p[i].value;
+  }
+  log_line_p->cnt = cnt;
+}
+
+void if_emu_cc_display_text_get(char *text_p)
+{
+  vic_get_text(text_p);
+}
+
+uint8_t if_emu_cc_op_run_until_text(char *text_p, uint32_t cycles_max)
+{
+  uint32_t start = g_cycle_cnt;
+
+  while(1)
+  {
+    vic_get_text(g_text_a);
+    if(strstr(g_text_a, text_p) != NULL)
+    {
+      return 1;
+    }
+
+    if(g_cycle_cnt - start >= cycles_max)
+    {
+      return 0;
+    }
+
+    if_emu_cc_op_run(TEXT_SLICE_CYCLES);
+  }
+}
@@ -37,6 +37,19 @@ joy_action_state_t g_joy_action_state_aa[2][5] =
   {0, 0, 0, 0, 0}
 };
 
+/* Port lines pulled low by joystick A and B, kept in sync with action status */
+uint8_t g_joy_port_mask_a[2];
+
+/* Port line for each action, same for both joysticks */
+static const uint8_t g_joy_action_line_a[5] =
+{
+  (uint8_t)~JOY_A_UP_PORT_VAL,
+  (uint8_t)~JOY_A_DOWN_PORT_VAL,
+  (uint8_t)~JOY_A_RIGHT_PORT_VAL,
+  (uint8_t)~JOY_A_LEFT_PORT_VAL,
+  (uint8_t)~JOY_A_FIRE_PORT_VAL
+};
+
 /* First is joystick A and B, second is direction. Contains source for an action */
 static joy_action_source_t g_joy_action_source_aa[2][5] =
 {
@@ -44,6 +57,22 @@ static joy_action_source_t g_joy_action_source_aa[2][5] =
   {0, 0, 0, 0, 0}
 };
 
+static void update_port_mask(uint8_t joy_port)
+{
+  uint8_t mask = 0;
+  uint8_t k;
+
+  for(k = 0; k < 5; k++)
+  {
+    if(g_joy_action_state_aa[joy_port][k] == JOY_ACTION_STATE_PRESSED)
+    {
+      mask |= g_joy_action_line_a[k];
+    }
+  }
+
+  g_joy_port_mask_a[joy_port] = mask;
+}
+
 void joy_set(joy_port_t joy_port,
              joy_action_t joy_action,
              joy_action_state_t joy_action_state,
@@ -71,6 +100,7 @@ void joy_set(joy_port_t joy_port,
       break;
   }
 
+  update_port_mask(joy_port);
 }
 
 void joy_clear(joy_action_source_t joy_action_source)
@@ -87,11 +117,13 @@ void joy_clear(joy_action_source_t joy_action_source)
         g_joy_action_state_aa[i][k] = JOY_ACTION_STATE_RELEASED;
       }
     }
+    update_port_mask(i);
   }
 }
 
 uint8_t joy_init()
 {
   memset(g_joy_action_state_aa, 0x00, sizeof(g_joy_action_state_aa));
+  memset(g_joy_port_mask_a, 0x00, sizeof(g_joy_port_mask_a));
   return 0;
 }
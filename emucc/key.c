@@ -62,21 +62,31 @@ typedef struct
   uint8_t row;
 } key_coor_t;
 
-/* Contains matrix of pushed keys */
-uint8_t g_matrix_active_aa[8][8];
+/*
+ * Pushed keys are held as masks from both directions, so that cia can
+ * evaluate either port with a few or operations.
+ */
+uint8_t g_key_row_mask_a[8]; /* Index is port B line, bits are port A lines */
+uint8_t g_key_col_mask_a[8]; /* Index is port A line, bits are port B lines */
 
 static key_map_t g_key_map_a[256]; /* No scan code is larger than this it seems */
 
+static void set_key(uint8_t x, uint8_t y)
+{
+  g_key_row_mask_a[x] |= 1 << y;
+  g_key_col_mask_a[y] |= 1 << x;
+}
+
 void key_pressed(uint8_t key, uint8_t shift, uint8_t ctrl)
 {
   if(shift == KEY_PRESS)
   {
-    g_matrix_active_aa[0x7][0x1] = KEY_PRESS;
+    set_key(0x7, 0x1);
   }
 
   if(ctrl == KEY_PRESS)
   {
-    g_matrix_active_aa[0x2][0x7] = KEY_PRESS;
+    set_key(0x2, 0x7);
   }
 
   if(g_key_map_a[key].active)
@@ -84,7 +94,7 @@ void key_pressed(uint8_t key, uint8_t shift, uint8_t ctrl)
     if(g_key_map_a[key].matrix_x < 8 && g_key_map_a[key].matrix_y < 8)
     {
       /* Normal key */
-      g_matrix_active_aa[g_key_map_a[key].matrix_x][g_key_map_a[key].matrix_y] = KEY_PRESS;
+      set_key(g_key_map_a[key].matrix_x, g_key_map_a[key].matrix_y);
     }
     else
     {
@@ -137,7 +147,8 @@ void key_pressed(uint8_t key, uint8_t shift, uint8_t ctrl)
 
 void key_clear_keys()
 {
-  memset(g_matrix_active_aa, 0, sizeof(g_matrix_active_aa));
+  memset(g_key_row_mask_a, 0, sizeof(g_key_row_mask_a));
+  memset(g_key_col_mask_a, 0, sizeof(g_key_col_mask_a));
 }
 
 void key_map_insert(uint8_t scan_code, uint8_t matrix_x, uint8_t matrix_y)
@@ -152,7 +163,7 @@ uint8_t key_init()
   uint8_t i;
   uint8_t k;
 
-  memset(g_matrix_active_aa, 0x00, sizeof(g_matrix_active_aa));
+  key_clear_keys();
 
   for(i = 0; i < 2; i++)
   {
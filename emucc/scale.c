@@ -0,0 +1,190 @@
+/*
+ * memwa2 output scaler component
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+/**
+ * Expands the native (1x) line rendered by vic into the host layer.
+ * Vic always renders one line of FORGROUND_WIDTH pixels, borders included,
+ * and hands it over here when the line is done. Depending on settings the
+ * line is cropped to the display window and scaled 1x, 2x or 3x using
+ * nearest neighbour in both directions.
+ *
+ * Scaled pixels are packed into 32 bit words before written, since the
+ * host layer normally lives in external memory where byte writes are
+ * expensive. This requires the layer to be 4 byte aligned.
+ *
+ * Whole row copies (vertical scaling and lines kept from the previous
+ * frame) are handed to the host when it can do them in the background,
+ * so that emulation of the next line continues meanwhile.
+ */
+
+#include "scale.h"
+#include "if.h"
+#include <string.h>
+
+#define WINDOW_WIDTH    320
+#define WINDOW_HEIGHT   200
+
+static uint8_t g_scale = SCALE_MIN;
+static uint8_t g_borders = 1;
+static uint32_t g_width = FORGROUND_WIDTH; /* Width of the native line that will be scaled */
+static uint32_t g_stride = FORGROUND_WIDTH; /* Width of a line in host layer */
+
+extern if_host_t g_if_host; /* Main interface */
+
+static void copy_rows(uint8_t *dst_p, uint8_t *src_p, uint32_t length)
+{
+  if(g_if_host.if_host_disp.disp_copy_fp != NULL)
+  {
+    g_if_host.if_host_disp.disp_copy_fp(dst_p, src_p, length);
+  }
+  else
+  {
+    memcpy(dst_p, src_p, length);
+  }
+}
+
+static void scale_row_1x(uint32_t *dst_p, uint8_t *src_p)
+{
+  memcpy(dst_p, src_p, g_width);
+}
+
+static void scale_row_2x(uint32_t *dst_p, uint8_t *src_p)
+{
+  uint32_t i;
+
+  /* Two source pixels fills one word */
+  for(i = 0; i < g_width; i += 2)
+  {
+    *dst_p++ = (src_p[i] * 0x00000101) | (src_p[i + 1] * 0x01010000);
+  }
+}
+
+static void scale_row_3x(uint32_t *dst_p, uint8_t *src_p)
+{
+  uint32_t i;
+
+  /* Four source pixels fills three words */
+  for(i = 0; i < g_width; i += 4)
+  {
+    *dst_p++ = (src_p[i] * 0x00010101) | (src_p[i + 1] << 24);
+    *dst_p++ = (src_p[i + 1] * 0x00000101) | (src_p[i + 2] * 0x01010000);
+    *dst_p++ = src_p[i + 2] | (src_p[i + 3] * 0x01010100);
+  }
+}
+
+void scale_set(uint8_t scale, uint8_t borders)
+{
+  if(scale < SCALE_MIN)
+  {
+    scale = SCALE_MIN;
+  }
+  else if(scale > SCALE_MAX)
+  {
+    scale = SCALE_MAX;
+  }
+
+  g_scale = scale;
+  g_borders = borders;
+  g_width = borders ? FORGROUND_WIDTH : WINDOW_WIDTH;
+  g_stride = g_width * scale;
+}
+
+uint8_t scale_get_borders()
+{
+  return g_borders;
+}
+
+/* Translate raster line to row in host layer, returns 0 for lines outside */
+static uint8_t get_row(int32_t window_line, uint32_t *row_p)
+{
+  if(g_borders)
+  {
+    if(window_line < -UPPER_BORDER || window_line >= WINDOW_HEIGHT + LOWER_BORDER)
+    {
+      return 0;
+    }
+    *row_p = window_line + UPPER_BORDER;
+  }
+  else
+  {
+    if(window_line < 0 || window_line >= WINDOW_HEIGHT)
+    {
+      return 0;
+    }
+    *row_p = window_line;
+  }
+
+  return 1;
+}
+
+void scale_line(uint8_t *layer_p, uint8_t *line_p, int32_t window_line)
+{
+  uint32_t *dst_p;
+  uint32_t row;
+  uint32_t i;
+
+  if(!get_row(window_line, &row))
+  {
+    return;
+  }
+
+  if(!g_borders)
+  {
+    line_p += LEFT_BORDER;
+  }
+
+  dst_p = (uint32_t *)(layer_p + row * g_scale * g_stride);
+
+  switch(g_scale)
+  {
+    case 1:
+      scale_row_1x(dst_p, line_p);
+      break;
+    case 2:
+      scale_row_2x(dst_p, line_p);
+      break;
+    case 3:
+      scale_row_3x(dst_p, line_p);
+      break;
+  }
+
+  /* Vertical scaling is just copies of the first scaled row */
+  for(i = 1; i < g_scale; i++)
+  {
+    copy_rows((uint8_t *)dst_p + i * g_stride, (uint8_t *)dst_p, g_stride);
+  }
+}
+
+void scale_copy_line(uint8_t *layer_p, uint8_t *from_layer_p, int32_t window_line)
+{
+  uint32_t offset;
+  uint32_t row;
+
+  if(!get_row(window_line, &row))
+  {
+    return;
+  }
+
+  offset = row * g_scale * g_stride;
+  copy_rows(layer_p + offset, from_layer_p + offset, g_scale * g_stride);
+}
@@ -0,0 +1,37 @@
+/*
+ * memwa2 output scaler component
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+#ifndef _SCALE_H
+#define _SCALE_H
+
+#include "emuccif.h"
+
+#define SCALE_MIN    1
+#define SCALE_MAX    3
+
+void scale_set(uint8_t scale, uint8_t borders);
+uint8_t scale_get_borders();
+void scale_line(uint8_t *layer_p, uint8_t *line_p, int32_t window_line);
+void scale_copy_line(uint8_t *layer_p, uint8_t *from_layer_p, int32_t window_line);
+
+#endif
@@ -21,8 +21,23 @@
  */
 
 
+
 /**
  * Contains functions to handle tapes (datasette).
+ *
+ * Tap data is decoded into a ring of pulse lengths (in cycles) ahead of
+ * time by tap_poll, which the host calls outside of emulation. Playing a
+ * tape is then only a matter of counting down the current pulse and
+ * raising the cia flag when it ends, no file access and no per cycle work.
+ *
+ * The same idle time is used to index the whole tape once it is inserted,
+ * a point every few pulses and a mark at each leader and after silence.
+ * This gives a counter and makes it possible to wind to any block at once.
+ *
+ * Recording works the other way around. Edges on the write line are
+ * measured in emulated cycles and encoded as tap version 1 into the same
+ * ring (a tape can not be played and recorded at once), tap_poll writes
+ * it to the file in large chunks.
  */
 
 #include "tap.h"
@@ -31,19 +46,83 @@
 #include "cia.h"
 #include "bus.h"
 #include <string.h>
-#include <stdlib.h>
 
-#define BUFFER_SIZE     128
-#define LONG_PULSE      0x1000
+#define HEADER_SIZE       0x14
+#define LONG_PULSE        0x1000
+#define STAGE_SIZE        0x200 /* File data read at a time */
+#define PREFETCH_CHUNKS   8 /* Max file reads per poll */
+#define PULSES_MAX        (IF_MEMORY_CC_TAPE_SIZE / sizeof(uint32_t))
+
+#define INDEX_POINTS_MAX  512
+#define INDEX_BLOCKS_MAX  128
+#define INDEX_INTERVAL    0x400 /* Pulses between points, doubled when full */
+#define INDEX_CHUNKS      4 /* Max file reads per poll */
+#define LEADER_PULSES     0x400 /* Short pulses in a row that start a block */
+#define SILENCE_PULSE     (0x100 * 8) /* Longer than any data pulse */
+#define SILENCE_CYCLES    (TAPE_CYCLES_PER_SECOND / 2)
+#define WIND_CYCLES       (TAPE_CYCLES_PER_SECOND * 10) /* Wind step without blocks */
+#define REWIND_SLACK      (TAPE_CYCLES_PER_SECOND * 2) /* Rewind goes to previous block within this */
+
+#define RECORD_SIZE       IF_MEMORY_CC_TAPE_SIZE
+#define RECORD_WRITE_SIZE 0x1000 /* Bytes written to file at a time */
+#define RECORD_PULSE_MAX  4 /* Bytes needed by longest pulse */
+
+/* Kernal encoding thresholds in cycles, between short, medium and long pulse */
+#define PULSE_SHORT_MAX   (0x36 * 8)
+#define PULSE_MEDIUM_MAX  (0x4A * 8)
+#define PULSE_LONG_MAX    (0x64 * 8)
+
+#define SYNC_FIRST        0x89 /* Countdown before first copy of a block */
+#define SYNC_REPEAT       0x09 /* Countdown before repeated copy */
+#define SYNC_LENGTH       9
+
+typedef enum
+{
+  PULSE_SHORT,
+  PULSE_MEDIUM,
+  PULSE_LONG,
+  PULSE_INVALID,
+  PULSE_END
+} pulse_t;
+
+typedef struct
+{
+  uint32_t offset; /* File offset of pulse */
+  uint32_t cycle; /* Tape time before pulse */
+} mark_t;
+
+typedef struct
+{
+  mark_t point_a[INDEX_POINTS_MAX];
+  uint32_t points;
+  uint32_t interval;
+  mark_t block_a[INDEX_BLOCKS_MAX];
+  uint32_t blocks;
+  uint8_t stage_a[STAGE_SIZE];
+  uint32_t stage_len;
+  uint32_t read; /* Next file offset to read */
+  uint32_t cycle;
+  uint32_t pulses;
+  mark_t run; /* Start of current short pulse run */
+  uint32_t short_run;
+  uint32_t silence; /* Cycles of silence so far */
+  uint8_t done;
+} tape_index_t;
 
 typedef struct
 {
   uint32_t *file_p; /* File descriptor */
-  uint8_t *buffer_p; /* Buffer containing a porion of file data */
-  uint16_t offset; /* File offset */
-  uint32_t fsize; /* File size as derived from header */
-  uint32_t cycles_passed; /* Cycle counter */
-  uint32_t cycles_bit_limit; /* Cycles until interrupt */
+  uint32_t end; /* File offset where pulse data ends */
+  uint32_t remain; /* Bytes of pulse data not yet read from file */
+  uint32_t cycle; /* Tape time of next pulse to play */
+  uint8_t seeked; /* File position was moved by index */
+  uint8_t stage_a[STAGE_SIZE]; /* File data not yet decoded */
+  uint32_t stage_len;
+  uint32_t pulse_head; /* Next pulse to decode into, free running */
+  uint32_t pulse_tail; /* Next pulse to play, free running */
+  int32_t cycles_left; /* Cycles until current pulse ends */
+  uint8_t pulse_active; /* First pulse has been started */
+  uint8_t loaded;
   uint8_t play;
   uint8_t version; /* Tap version (0x0, 0x1) */
   uint8_t motor;
@@ -52,7 +131,490 @@ typedef struct
 extern if_host_t g_if_host; /* Main interface */
 extern cpu_on_chip_port_t g_cpu_on_chip_port; /* Cpu on chip port (tap owns one bit) */
 
+typedef struct
+{
+  uint32_t *file_p; /* File descriptor, given by host */
+  uint32_t head; /* Next byte to encode into, free running */
+  uint32_t tail; /* Next byte to write to file, free running */
+  uint32_t size; /* Pulse bytes written to file */
+  uint32_t cycles; /* Since last rising edge */
+  uint32_t lost; /* Pulses dropped since ring was full */
+  uint8_t edge_seen;
+  uint8_t level;
+} recorder_t;
+
 static tape_t g_tape;
+static tape_index_t g_index;
+static recorder_t g_record;
+static uint32_t *g_pulse_p; /* Ring of decoded pulse lengths, given by host */
+static uint32_t g_trap_pos; /* Next pulse to read by trap decoder */
+static uint32_t g_trap_cycle; /* Tape time at trap decoder */
+static uint8_t g_trap_commit; /* Trap decoder may free pulses it has read */
+
+static uint8_t tape_ended()
+{
+  return g_tape.remain == 0 &&
+         g_tape.stage_len == 0 &&
+         g_tape.pulse_tail == g_tape.pulse_head;
+}
+
+/* Returns bytes used by pulse, or zero if it does not fit in length */
+static uint32_t decode_pulse(uint8_t *data_p, uint32_t length, uint32_t *pulse_p)
+{
+  if(data_p[0] != 0x0)
+  {
+    *pulse_p = data_p[0] * 8;
+    return 1;
+  }
+
+  /* Special case! */
+  if(g_tape.version == 0x1)
+  {
+    /* Next three bytes are the pulse length in cycles */
+    if(length < 4)
+    {
+      return 0;
+    }
+    *pulse_p = data_p[1];
+    *pulse_p += data_p[2] << 8;
+    *pulse_p += data_p[3] << 16;
+    return 4;
+  }
+
+  /* For this case the pulselength should be over 255*8 cycles */
+  *pulse_p = LONG_PULSE;
+  return 1;
+}
+
+static uint32_t decode_stage()
+{
+  uint32_t pos = 0;
+  uint32_t used;
+  uint32_t pulse;
+
+  while(pos < g_tape.stage_len &&
+        (used = decode_pulse(g_tape.stage_a + pos, g_tape.stage_len - pos, &pulse)) != 0)
+  {
+    g_pulse_p[g_tape.pulse_head++ % PULSES_MAX] = pulse;
+    pos += used;
+  }
+
+  return pos;
+}
+
+static void prefetch()
+{
+  uint32_t chunks = PREFETCH_CHUNKS;
+  uint32_t length;
+  uint32_t used;
+
+  /* Every byte in stage can become one pulse, so only read when that fits */
+  while(g_tape.loaded && g_tape.remain > 0 && chunks-- > 0 &&
+        PULSES_MAX - (g_tape.pulse_head - g_tape.pulse_tail) >= STAGE_SIZE)
+  {
+    if(g_tape.seeked)
+    {
+      g_if_host.if_host_filesys.filesys_seek_fp(g_tape.file_p, g_tape.end - g_tape.remain);
+      g_tape.seeked = 0;
+    }
+
+    length = STAGE_SIZE - g_tape.stage_len;
+    if(length > g_tape.remain)
+    {
+      length = g_tape.remain;
+    }
+
+    if(g_if_host.if_host_filesys.filesys_read_fp(g_tape.file_p,
+                                                 g_tape.stage_a + g_tape.stage_len,
+                                                 length) != length)
+    {
+      g_if_host.if_host_printer.print_fp("(CC) Error reading tap file!", PRINT_TYPE_ERROR);
+      g_tape.remain = 0;
+      g_tape.stage_len = 0;
+      break;
+    }
+    g_tape.remain -= length;
+    g_tape.stage_len += length;
+
+    used = decode_stage();
+    memmove(g_tape.stage_a, g_tape.stage_a + used, g_tape.stage_len - used);
+    g_tape.stage_len -= used;
+
+    /* A long pulse cut by end of file is dropped */
+    if(g_tape.remain == 0)
+    {
+      g_tape.stage_len = 0;
+    }
+  }
+}
+
+static void index_block(mark_t *mark_p)
+{
+  /* Silence is often followed by a leader starting at the same pulse */
+  if(g_index.blocks == INDEX_BLOCKS_MAX ||
+     (g_index.blocks > 0 && g_index.block_a[g_index.blocks - 1].offset == mark_p->offset))
+  {
+    return;
+  }
+
+  g_index.block_a[g_index.blocks++] = *mark_p;
+}
+
+static void index_pulse(uint32_t offset, uint32_t pulse)
+{
+  mark_t mark = {offset, g_index.cycle};
+  uint32_t i;
+
+  if(g_index.pulses % g_index.interval == 0)
+  {
+    if(g_index.points == INDEX_POINTS_MAX)
+    {
+      for(i = 0; i < INDEX_POINTS_MAX / 2; i++)
+      {
+        g_index.point_a[i] = g_index.point_a[i * 2];
+      }
+      g_index.points = INDEX_POINTS_MAX / 2;
+      g_index.interval *= 2;
+    }
+
+    if(g_index.pulses % g_index.interval == 0)
+    {
+      g_index.point_a[g_index.points++] = mark;
+    }
+  }
+
+  if(pulse >= SILENCE_PULSE)
+  {
+    g_index.silence += pulse;
+    g_index.short_run = 0;
+  }
+  else
+  {
+    if(g_index.silence >= SILENCE_CYCLES)
+    {
+      index_block(&mark);
+    }
+    g_index.silence = 0;
+
+    if(pulse < PULSE_SHORT_MAX)
+    {
+      if(g_index.short_run++ == 0)
+      {
+        g_index.run = mark;
+      }
+      if(g_index.short_run == LEADER_PULSES)
+      {
+        index_block(&g_index.run);
+      }
+    }
+    else
+    {
+      g_index.short_run = 0;
+    }
+  }
+
+  g_index.cycle += pulse;
+  g_index.pulses++;
+}
+
+static void index_build()
+{
+  uint32_t chunks = INDEX_CHUNKS;
+  uint32_t length;
+  uint32_t base;
+  uint32_t pos;
+  uint32_t used;
+  uint32_t pulse;
+
+  while(g_tape.loaded && !g_index.done && chunks-- > 0)
+  {
+    length = STAGE_SIZE - g_index.stage_len;
+    if(length > g_tape.end - g_index.read)
+    {
+      length = g_tape.end - g_index.read;
+    }
+
+    /* Playback has its own file position, it seeks back before next read */
+    g_tape.seeked = 1;
+    g_if_host.if_host_filesys.filesys_seek_fp(g_tape.file_p, g_index.read);
+    if(length == 0 ||
+       g_if_host.if_host_filesys.filesys_read_fp(g_tape.file_p,
+                                                 g_index.stage_a + g_index.stage_len,
+                                                 length) != length)
+    {
+      g_index.done = 1;
+      break;
+    }
+    g_index.read += length;
+    g_index.stage_len += length;
+
+    base = g_index.read - g_index.stage_len;
+    pos = 0;
+    while(pos < g_index.stage_len &&
+          (used = decode_pulse(g_index.stage_a + pos, g_index.stage_len - pos, &pulse)) != 0)
+    {
+      index_pulse(base + pos, pulse);
+      pos += used;
+    }
+
+    memmove(g_index.stage_a, g_index.stage_a + pos, g_index.stage_len - pos);
+    g_index.stage_len -= pos;
+  }
+}
+
+static void tape_seek(mark_t *mark_p)
+{
+  g_tape.remain = g_tape.end - mark_p->offset;
+  g_tape.cycle = mark_p->cycle;
+  g_tape.seeked = 1;
+  g_tape.stage_len = 0;
+  g_tape.pulse_head = 0;
+  g_tape.pulse_tail = 0;
+  g_tape.cycles_left = 0;
+  g_tape.pulse_active = 0;
+
+  prefetch();
+}
+
+/* Last mark at or before cycle, or -1 */
+static int32_t mark_find(mark_t *mark_p, uint32_t marks, uint32_t cycle)
+{
+  int32_t i;
+
+  for(i = marks - 1; i >= 0 && mark_p[i].cycle > cycle; i--)
+  {
+    ;
+  }
+
+  return i;
+}
+
+static void tape_rewind()
+{
+  uint8_t header_a[HEADER_SIZE];
+  mark_t start = {HEADER_SIZE, 0};
+
+  g_tape.loaded = 0;
+  g_tape.remain = 0;
+  g_tape.stage_len = 0;
+  g_tape.pulse_head = 0;
+  g_tape.pulse_tail = 0;
+  g_tape.cycles_left = 0;
+  g_tape.pulse_active = 0;
+  g_tape.cycle = 0;
+
+  memset(&g_index, 0, sizeof(tape_index_t));
+  g_index.interval = INDEX_INTERVAL;
+  g_index.read = HEADER_SIZE;
+
+  if(g_tape.file_p == NULL || g_pulse_p == NULL)
+  {
+    return;
+  }
+
+  g_if_host.if_host_filesys.filesys_seek_fp(g_tape.file_p, 0);
+  if(g_if_host.if_host_filesys.filesys_read_fp(g_tape.file_p, header_a, HEADER_SIZE) != HEADER_SIZE)
+  {
+    g_if_host.if_host_printer.print_fp("(CC) Error reading tap file!", PRINT_TYPE_ERROR);
+    return;
+  }
+
+  g_tape.version = header_a[0x0C];
+
+  g_tape.end = header_a[0x10];
+  g_tape.end += header_a[0x11] << 8;
+  g_tape.end += header_a[0x12] << 16;
+  g_tape.end += header_a[0x13] << 24;
+  g_tape.end += HEADER_SIZE;
+
+  g_tape.loaded = 1;
+  tape_seek(&start);
+}
+
+static pulse_t trap_pulse()
+{
+  uint32_t pulse;
+
+  if(g_trap_pos == g_tape.pulse_head)
+  {
+    /* Without commit the ring only holds what fits ahead of the tail */
+    if(g_trap_commit)
+    {
+      g_tape.pulse_tail = g_trap_pos;
+    }
+    prefetch();
+    if(g_trap_pos == g_tape.pulse_head)
+    {
+      return PULSE_END;
+    }
+  }
+
+  pulse = g_pulse_p[g_trap_pos++ % PULSES_MAX];
+  g_trap_cycle += pulse;
+
+  if(pulse < PULSE_SHORT_MAX)
+  {
+    return PULSE_SHORT;
+  }
+  else if(pulse < PULSE_MEDIUM_MAX)
+  {
+    return PULSE_MEDIUM;
+  }
+  else if(pulse < PULSE_LONG_MAX)
+  {
+    return PULSE_LONG;
+  }
+
+  return PULSE_INVALID;
+}
+
+/*
+ * Reads one kernal encoded byte. Byte marker is long + medium, then
+ * eight data bits lsb first and an odd parity bit, each bit being
+ * short + medium (0) or medium + short (1). Returns -1 on bad data
+ * and -2 when tape has ended.
+ */
+static int32_t trap_byte()
+{
+  pulse_t first;
+  pulse_t second;
+  uint8_t byte = 0;
+  uint8_t parity = 1;
+  uint8_t bit;
+  uint32_t i;
+
+  do
+  {
+    first = trap_pulse();
+    if(first == PULSE_END)
+    {
+      return -2;
+    }
+  }
+  while(first != PULSE_LONG);
+
+  second = trap_pulse();
+  if(second != PULSE_MEDIUM)
+  {
+    return second == PULSE_END ? -2 : -1;
+  }
+
+  for(i = 0; i < 9; i++)
+  {
+    first = trap_pulse();
+    second = trap_pulse();
+
+    if(first == PULSE_SHORT && second == PULSE_MEDIUM)
+    {
+      bit = 0;
+    }
+    else if(first == PULSE_MEDIUM && second == PULSE_SHORT)
+    {
+      bit = 1;
+    }
+    else
+    {
+      return (first == PULSE_END || second == PULSE_END) ? -2 : -1;
+    }
+
+    if(i < 8)
+    {
+      byte |= bit << i;
+    }
+    parity ^= bit;
+  }
+
+  return parity ? -1 : byte;
+}
+
+static int32_t trap_sync(uint8_t sync)
+{
+  int32_t byte;
+  uint32_t i;
+
+  while(1)
+  {
+    byte = trap_byte();
+    if(byte == -2)
+    {
+      return -2;
+    }
+    if(byte != sync)
+    {
+      continue;
+    }
+
+    for(i = 1; i < SYNC_LENGTH; i++)
+    {
+      byte = trap_byte();
+      if(byte != sync - i)
+      {
+        break;
+      }
+    }
+
+    if(i == SYNC_LENGTH)
+    {
+      return sync;
+    }
+    if(byte == -2)
+    {
+      return -2;
+    }
+  }
+}
+
+/*
+ * Every kernal block is recorded twice, the repeated copy is only used
+ * when the first one is broken and otherwise skipped by next search.
+ */
+static tap_trap_t trap_block(uint8_t *dst_p, uint32_t length, uint8_t verify)
+{
+  uint8_t sync = SYNC_FIRST;
+  uint8_t checksum;
+  uint8_t mismatch;
+  int32_t byte;
+  uint32_t i;
+
+  while(1)
+  {
+    if(trap_sync(sync) < 0)
+    {
+      return TAP_TRAP_END;
+    }
+
+    checksum = 0;
+    mismatch = 0;
+    for(i = 0; i < length; i++)
+    {
+      byte = trap_byte();
+      if(byte < 0)
+      {
+        break;
+      }
+      if(verify)
+      {
+        mismatch |= dst_p[i] != byte;
+      }
+      else
+      {
+        dst_p[i] = byte;
+      }
+      checksum ^= byte;
+    }
+
+    if(i == length && trap_byte() == checksum)
+    {
+      return mismatch ? TAP_TRAP_ERROR : TAP_TRAP_OK;
+    }
+
+    if(sync == SYNC_REPEAT)
+    {
+      return TAP_TRAP_ERROR;
+    }
+    sync = SYNC_REPEAT;
+  }
+}
 
 void tap_set_motor(uint8_t status)
 {
@@ -60,165 +622,310 @@ void tap_set_motor(uint8_t status)
   g_if_host.if_host_ee.ee_tape_motor_fp(!g_tape.motor); /* motor on = false */
 }
 
+void tap_set_memory(uint8_t *mem_p)
+{
+  g_pulse_p = (uint32_t *)mem_p;
+}
+
 void tap_insert_tape(uint32_t *fd_p)
 {
-    g_tape.file_p = fd_p;
+  /* Ring is busy with recording */
+  if(fd_p != NULL && g_record.file_p != NULL)
+  {
+    g_if_host.if_host_printer.print_fp("(CC) Tape is recording!", PRINT_TYPE_ERROR);
+    return;
+  }
+
+  g_tape.file_p = fd_p;
+  tape_rewind();
+}
+
+static void record_put(uint8_t byte)
+{
+  ((uint8_t *)g_pulse_p)[g_record.head++ % RECORD_SIZE] = byte;
+}
+
+static void record_pulse(uint32_t pulse)
+{
+  if(RECORD_SIZE - (g_record.head - g_record.tail) < RECORD_PULSE_MAX)
+  {
+    g_record.lost++;
+    return;
+  }
+
+  if(pulse / 8 > 0 && pulse / 8 <= 0xFF)
+  {
+    record_put(pulse / 8);
+  }
+  else
+  {
+    record_put(0x0);
+    record_put(pulse & 0xFF);
+    record_put((pulse >> 8) & 0xFF);
+    record_put((pulse >> 16) & 0xFF);
+  }
+}
+
+static void record_write(uint32_t min_len)
+{
+  uint32_t length;
+  uint32_t pos;
+
+  while(g_record.head - g_record.tail >= min_len && g_record.head != g_record.tail)
+  {
+    /* Ring is written up to its end, the rest on next turn */
+    pos = g_record.tail % RECORD_SIZE;
+    length = g_record.head - g_record.tail;
+    if(length > RECORD_WRITE_SIZE)
+    {
+      length = RECORD_WRITE_SIZE;
+    }
+    if(length > RECORD_SIZE - pos)
+    {
+      length = RECORD_SIZE - pos;
+    }
+
+    if(g_if_host.if_host_filesys.filesys_write_fp(g_record.file_p,
+                                                  (uint8_t *)g_pulse_p + pos,
+                                                  length) != length)
+    {
+      g_if_host.if_host_printer.print_fp("(CC) Error writing tap file!", PRINT_TYPE_ERROR);
+      g_record.tail = g_record.head;
+      return;
+    }
+    g_record.tail += length;
+    g_record.size += length;
+  }
+}
+
+static void record_header()
+{
+  uint8_t header_a[HEADER_SIZE] = "C64-TAPE-RAW";
+
+  header_a[0x0C] = 0x1;
+  header_a[0x10] = g_record.size & 0xFF;
+  header_a[0x11] = (g_record.size >> 8) & 0xFF;
+  header_a[0x12] = (g_record.size >> 16) & 0xFF;
+  header_a[0x13] = (g_record.size >> 24) & 0xFF;
+
+  g_if_host.if_host_filesys.filesys_seek_fp(g_record.file_p, 0);
+  if(g_if_host.if_host_filesys.filesys_write_fp(g_record.file_p, header_a, HEADER_SIZE) != HEADER_SIZE)
+  {
+    g_if_host.if_host_printer.print_fp("(CC) Error writing tap file!", PRINT_TYPE_ERROR);
+  }
 }
 
 void tap_init()
 {
   g_cpu_on_chip_port.addr_one |= MASK_DATASETTE_BUTTON_STATUS; /* Unpress play button */
-  g_tape.play = 0;
 
   memset(&g_tape, 0, sizeof(tape_t));
-  g_tape.buffer_p = (uint8_t *)calloc(1, BUFFER_SIZE);
+  memset(&g_record, 0, sizeof(recorder_t));
 }
 
-void tap_play()
+void tap_record(uint32_t *fd_p)
 {
-  uint32_t bytes_read = 0;
-  bytes_read = g_if_host.if_host_filesys.filesys_read_fp(g_tape.file_p, g_tape.buffer_p, BUFFER_SIZE);
-  if(bytes_read != BUFFER_SIZE)
+  if(g_record.file_p != NULL)
   {
-    g_if_host.if_host_printer.print_fp("(CC) No tape file loaded!", PRINT_TYPE_ERROR);
+    /* Last pulse is unfinished and dropped */
+    record_write(0);
+    record_header();
+    g_if_host.if_host_filesys.filesys_flush_fp(g_record.file_p);
+    if(g_record.lost > 0)
+    {
+      g_if_host.if_host_printer.print_fp("(CC) Tap recording lost pulses!", PRINT_TYPE_WARNING);
+    }
+
+    g_cpu_on_chip_port.addr_one |= MASK_DATASETTE_BUTTON_STATUS; /* Unpress record and play */
+    g_tape.play = 0;
+    g_if_host.if_host_ee.ee_tape_play_fp(g_tape.play);
+  }
+
+  memset(&g_record, 0, sizeof(recorder_t));
+  g_record.file_p = fd_p;
+
+  if(fd_p == NULL || g_pulse_p == NULL)
+  {
+    g_record.file_p = NULL;
     return;
   }
 
-  g_cpu_on_chip_port.addr_one &= ~MASK_DATASETTE_BUTTON_STATUS; /* Press play button */
+  /* Ring is shared with playback, so any inserted tape is ejected */
+  tap_insert_tape(NULL);
+  record_header();
+
+  g_record.level = g_cpu_on_chip_port.addr_one & MASK_DATASETTE_OUTPUT_SIGNAL_LEVEL;
+  g_cpu_on_chip_port.addr_one &= ~MASK_DATASETTE_BUTTON_STATUS; /* Press record and play */
   g_tape.play = 1;
   g_if_host.if_host_ee.ee_tape_play_fp(g_tape.play);
+}
 
-  g_tape.fsize = *(g_tape.buffer_p + 0x10);
-  g_tape.fsize += *(g_tape.buffer_p + 0x11) << 8;
-  g_tape.fsize += *(g_tape.buffer_p + 0x12) << 16;
-  g_tape.fsize += *(g_tape.buffer_p + 0x13) << 24;
+void tap_write_line(uint8_t level)
+{
+  level &= MASK_DATASETTE_OUTPUT_SIGNAL_LEVEL;
 
-  g_tape.version = *(g_tape.buffer_p + 0x0C);
+  if(g_record.file_p == NULL || g_tape.motor != 0 || level == g_record.level)
+  {
+    g_record.level = level;
+    return;
+  }
+  g_record.level = level;
 
-  g_tape.offset = 0x14; // skip header
+  /* A pulse is measured between rising edges */
+  if(level)
+  {
+    if(g_record.edge_seen)
+    {
+      record_pulse(g_record.cycles);
+    }
+    g_record.cycles = 0;
+    g_record.edge_seen = 1;
+  }
+}
+
+void tap_play()
+{
+  if(!g_tape.loaded)
+  {
+    g_if_host.if_host_printer.print_fp("(CC) No tape file loaded!", PRINT_TYPE_ERROR);
+    return;
+  }
 
-  g_tape.cycles_bit_limit = (*(g_tape.buffer_p + g_tape.offset) * 8); /* Read bit limit */
+  g_cpu_on_chip_port.addr_one &= ~MASK_DATASETTE_BUTTON_STATUS; /* Press play button */
+  g_tape.play = 1;
+  g_if_host.if_host_ee.ee_tape_play_fp(g_tape.play);
 }
 
 void tap_stop()
 {
-  memset(g_tape.buffer_p, 0, BUFFER_SIZE);
-  memset(&g_tape, 0, sizeof(tape_t));
-
+  /* Tape stays where it is, next play continues from here */
   g_cpu_on_chip_port.addr_one |= MASK_DATASETTE_BUTTON_STATUS; /* Unpress play button */
   g_tape.play = 0;
   g_if_host.if_host_ee.ee_tape_play_fp(g_tape.play);
 }
 
-static void load_buffer()
+void tap_poll()
+{
+  if(g_record.file_p != NULL)
+  {
+    record_write(RECORD_WRITE_SIZE);
+    return;
+  }
+
+  index_build();
+  prefetch();
+}
+
+void tap_wind(int32_t blocks)
 {
-  uint32_t bytes_read = 0;
-  if(g_tape.offset >= BUFFER_SIZE) /* Limit reached for buffer? */
+  mark_t start = {HEADER_SIZE, 0};
+  mark_t *mark_p = &start;
+  int32_t i;
+  uint32_t cycle;
+
+  if(!g_tape.loaded)
+  {
+    return;
+  }
+
+  if(g_index.blocks > 0)
   {
-    if(g_tape.fsize < BUFFER_SIZE)
+    i = mark_find(g_index.block_a, g_index.blocks, g_tape.cycle);
+    if(blocks < 0 && i >= 0 && g_tape.cycle - g_index.block_a[i].cycle > REWIND_SLACK)
+    {
+      i++; /* Rewinding one block means start of current block */
+    }
+    i += blocks;
+
+    if(i >= (int32_t)g_index.blocks)
+    {
+      return; /* Not indexed (yet) */
+    }
+    if(i >= 0)
     {
-      bytes_read = g_if_host.if_host_filesys.filesys_read_fp(g_tape.file_p, g_tape.buffer_p, g_tape.fsize);
-      if(bytes_read != g_tape.fsize)
+      mark_p = &g_index.block_a[i];
+    }
+  }
+  else if(g_index.points > 0)
+  {
+    /* No blocks found (yet), wind by time using points */
+    if(blocks < 0)
+    {
+      cycle = 0;
+      if(g_tape.cycle / WIND_CYCLES > (uint32_t)-blocks)
       {
-        g_if_host.if_host_printer.print_fp("(CC) Error reading tap file!", PRINT_TYPE_ERROR);
+        cycle = g_tape.cycle - (uint32_t)-blocks * WIND_CYCLES;
       }
     }
     else
     {
-      bytes_read = g_if_host.if_host_filesys.filesys_read_fp(g_tape.file_p, g_tape.buffer_p, BUFFER_SIZE);
-      if(bytes_read != BUFFER_SIZE)
+      if(g_tape.cycle >= g_index.cycle ||
+         (g_index.cycle - g_tape.cycle) / WIND_CYCLES < (uint32_t)blocks)
       {
-        g_if_host.if_host_printer.print_fp("(CC) Error reading tap file!", PRINT_TYPE_ERROR);
+        return; /* Not indexed (yet) */
       }
+      cycle = g_tape.cycle + blocks * WIND_CYCLES;
+    }
+    i = mark_find(g_index.point_a, g_index.points, cycle);
+    if(i >= 0)
+    {
+      mark_p = &g_index.point_a[i];
     }
-
-    g_tape.offset = 0;
   }
+
+  tape_seek(mark_p);
+}
+
+uint32_t tap_get_counter()
+{
+  return g_tape.cycle / TAPE_CYCLES_PER_SECOND;
 }
 
 void tap_step(uint8_t cc)
 {
-  if(g_tape.play == 1 && g_tape.motor == 0)  /* Tape and motor should be on if loading */
+  uint32_t pulse;
+
+  if(g_record.file_p != NULL)
   {
-    /* Check if exceeding limit */
-    if((g_tape.cycles_passed + cc) < g_tape.cycles_bit_limit)
+    if(g_tape.motor == 0)
     {
-      /* Nope, then just add cycles to counter and return */
-      g_tape.cycles_passed += cc;
-      return;
+      g_record.cycles += cc;
     }
+    return;
+  }
 
-    for(;cc != 0; cc--)
-    {
-      g_tape.cycles_passed += 1;
+  if(g_tape.play == 1 && g_tape.motor == 0)  /* Tape and motor should be on if loading */
+  {
+    g_tape.cycles_left -= cc;
 
-      if(g_tape.cycles_passed >= g_tape.cycles_bit_limit)
+    while(g_tape.cycles_left <= 0)
+    {
+      if(g_tape.pulse_tail == g_tape.pulse_head)
       {
-        /* Tell cia about this */
-        cia_request_irq_tape();
-
-        /* Is this end of file? */
-        if(g_tape.fsize == 0)
+        if(tape_ended())
         {
+          if(g_tape.pulse_active)
+          {
+            cia_request_irq_tape();
+          }
           tap_stop();
-          return;
         }
 
-        load_buffer();
-
-        g_tape.cycles_bit_limit = (*(g_tape.buffer_p + g_tape.offset) * 8); // read new bit limit
-        g_tape.fsize--;
-        g_tape.offset++;
-        g_tape.cycles_passed = 0;
+        /* Prefetch has not caught up, current pulse is stretched */
+        g_tape.cycles_left = 0;
+        return;
+      }
 
-        if(g_tape.cycles_bit_limit == 0x0)  /* Special case! */
-        {
-          if(g_tape.version == 0x1)
-          {
-            /* Is this end of file? */
-            if(g_tape.fsize == 0)
-            {
-              tap_stop();
-              return;
-            }
-
-            load_buffer();
-            /* Read 1 of three bytes that represents the new limit */
-            g_tape.cycles_bit_limit = *(g_tape.buffer_p + g_tape.offset);
-            g_tape.fsize--;
-            g_tape.offset++;
-
-            if(g_tape.fsize == 0)
-            {
-              tap_stop();
-              return;
-            }
-
-            load_buffer();
-            /* Read 1 of three bytes that represents the new limit */
-            g_tape.cycles_bit_limit += (*(g_tape.buffer_p + g_tape.offset)) << 8;
-            g_tape.fsize--;
-            g_tape.offset++;
-            
-            if(g_tape.fsize == 0)
-            {
-              tap_stop();
-              return;
-            }
-            
-            load_buffer();
-            /* Read 1 of three bytes that represents the new limit */
-            g_tape.cycles_bit_limit += (*(g_tape.buffer_p + g_tape.offset) << 16);
-            g_tape.fsize--;
-            g_tape.offset++;
-          }
-          else
-          {
-            /* For this case the pulselength should be over 255*8 cycles */
-            g_tape.cycles_bit_limit = LONG_PULSE;
-          }
-        }
+      /* Tell cia about this */
+      if(g_tape.pulse_active)
+      {
+        cia_request_irq_tape();
       }
+
+      pulse = g_pulse_p[g_tape.pulse_tail++ % PULSES_MAX];
+      g_tape.cycles_left += pulse;
+      g_tape.cycle += pulse;
+      g_tape.pulse_active = 1;
     }
   }
 }
@@ -227,3 +934,58 @@ uint8_t tap_get_play()
 {
   return g_tape.play;
 }
+
+tap_trap_t tap_trap_header(uint8_t *buffer_p)
+{
+  tap_trap_t result;
+
+  if(!g_tape.play || !g_tape.loaded)
+  {
+    return TAP_TRAP_FALLBACK;
+  }
+
+  /*
+   * Header is searched for without freeing any pulses, so if it is not
+   * found within the ring the tape is left untouched for real time loading.
+   */
+  g_trap_pos = g_tape.pulse_tail;
+  g_trap_cycle = g_tape.cycle;
+  g_trap_commit = 0;
+
+  result = trap_block(buffer_p, TAP_TRAP_HEADER_SIZE, 0);
+
+  if(result == TAP_TRAP_OK)
+  {
+    g_tape.pulse_tail = g_trap_pos;
+    g_tape.cycle = g_trap_cycle;
+    g_tape.cycles_left = 0;
+  }
+  else if(!(result == TAP_TRAP_END && g_tape.remain == 0))
+  {
+    result = TAP_TRAP_FALLBACK;
+  }
+
+  return result;
+}
+
+tap_trap_t tap_trap_data(uint8_t *dst_p, uint32_t length, uint8_t verify)
+{
+  tap_trap_t result;
+
+  if(!g_tape.play || !g_tape.loaded)
+  {
+    return TAP_TRAP_FALLBACK;
+  }
+
+  g_trap_pos = g_tape.pulse_tail;
+  g_trap_cycle = g_tape.cycle;
+  g_trap_commit = 1;
+
+  result = trap_block(dst_p, length, verify);
+
+  g_tape.pulse_tail = g_trap_pos;
+  g_tape.cycle = g_trap_cycle;
+  g_tape.cycles_left = 0;
+
+  return result;
+}
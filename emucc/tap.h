@@ -30,12 +30,31 @@
 #define MASK_DATASETTE_BUTTON_STATUS            0x10
 #define MASK_DATASETTE_MOTOR_CTRL               0x20
 
+#define TAP_TRAP_HEADER_SIZE                    192
+#define TAPE_CYCLES_PER_SECOND                  985248 /* Pal */
+
+typedef enum
+{
+  TAP_TRAP_OK,
+  TAP_TRAP_ERROR, /* Checksum or verify failed */
+  TAP_TRAP_END, /* Tape ended before block */
+  TAP_TRAP_FALLBACK /* Not found, let kernal read it in real time */
+} tap_trap_t;
+
 void tap_init();
 void tap_play();
 void tap_step(uint8_t cc);
 void tap_stop();
 void tap_insert_tape(uint32_t *fd_p);
 void tap_set_motor(uint8_t status);
+void tap_set_memory(uint8_t *mem_p);
+void tap_poll();
+void tap_wind(int32_t blocks);
+void tap_record(uint32_t *fd_p);
+void tap_write_line(uint8_t level);
+uint32_t tap_get_counter();
 uint8_t tap_get_play();
+tap_trap_t tap_trap_header(uint8_t *buffer_p);
+tap_trap_t tap_trap_data(uint8_t *dst_p, uint32_t length, uint8_t verify);
 
 #endif
@@ -29,10 +29,14 @@
  * real HW. Many bugs still exist though (which will be quite visible
  * on screen).
  *
- * The canvas is written to by writing to the variable g_layer_addr_p.
- * The canvas is the emulators "screen memory". The hardware should
+ * Pixels are written one native (1x) line at a time to g_line_a through
+ * g_vic.layer_addr_p. When a line is done the scaler (scale.c) expands it into
+ * the canvas. The canvas is the emulators "screen memory". The hardware should
  * map this memory directly to the screen. The emulator will call swap
- * function (disp_flip_fp) when a new frame is done.
+ * function (disp_flip_fp) when a new frame is done. The host queues the
+ * frame for presentation and hands back a free buffer right away, so
+ * rendering is never blocked by the display and never overwrites the
+ * buffer being scanned out.
  *
  * There are also 2 sprite layers (forground and background) and one map
  * layer. When rasterline is drawing the screen it will look at the sprite
@@ -52,6 +56,7 @@
 #include "cpu.h"
 #include "tap.h"
 #include "cia.h"
+#include "scale.h"
 
 #define NO_OF_FRAMES_STATS      50
 #define NO_OF_FRAMES_LOCK       2
@@ -61,12 +66,14 @@
 #define SPRITE_HEIGHT           21
 #define SPRITE_DOT_MATRIX_SIZE  63
 #define SPRITE_NO_POS           0xDEAD
+#define VIC_CACHE_LINE_SIZE     32
 
 #define CHAR_HORIZONTAL_LENGTH  8
 #define CHAR_VERTICAL_LENGTH    8
 
 #define UCYCLE_PER_PIXEL        (UCYCLES_LINE/PIXELS_MAX)
 #define UCYCLES_LINE            (63000)
+#define UCYCLES_PER_CYCLE       (UCYCLES_LINE/VIC_LOG_CYCLES_LINE)
 #define UCYCLES_BAD_LINE_WAIT   (UCYCLES_LINE/9)
 #define UCYCLE_BAD_SPRITE       (2000)
 #define UCYCLES_BAD_LINE        (43000)
@@ -91,10 +98,16 @@
 #define PIXEL_LOAD_VCBASE       (464)
 #define PIXEL_RIGHT_BLANK_START (480)
 #define PIXEL_SPRITE_X_START    (PIXEL_LEFT_BORD_START + 24)
+#define PIXEL_FORGROUND_START   (PIXEL_DISP_WIND_START - LEFT_BORDER)
+#define LINE_FORGROUND_START    (LINE_DISP_WIND_START - UPPER_BORDER)
 
 /* Switch case is more optimation friendly than calling function pointer */
 #define OUTPUT_PIXEL() \
-switch(g_graphic_mode) \
+if(!pixel_visible()) \
+{ \
+  output_pixel_NONE(); \
+} \
+else switch(g_vic.graphic_mode) \
 { \
   case GRAPHIC_MODE_STM: \
     output_pixel_STM(); \
@@ -125,7 +138,11 @@ switch(g_graphic_mode) \
 
 /* Switch case is more optimation friendly than calling function pointer */
 #define LOAD_DOT_MATRIX() \
-switch(g_graphic_mode) \
+if(g_vic.line_hidden || g_vic.view_cropped_x) \
+{ \
+  load_fg_mask(); /* Pixels not rendered still need it for collisions */ \
+} \
+if(!g_vic.line_hidden) switch(g_vic.graphic_mode) \
 { \
   case GRAPHIC_MODE_STM: \
   case GRAPHIC_MODE_MTM: \
@@ -217,6 +234,9 @@ static inline void load_dot_matrix_SBM_MBM();
 static inline void load_dot_matrix_ECM();
 static inline void load_dot_matrix_BORDER();
 static inline void load_dot_matrix_BAD();
+static inline void load_fg_mask();
+static inline uint8_t pixel_visible();
+static void update_line_hidden();
 static void graphic_mode();
 static void erase_sprite(uint32_t sprite, uint32_t at_x, uint32_t at_y);
 static void draw_sprite(uint32_t sprite, uint32_t at_x, uint32_t at_y);
@@ -235,16 +255,16 @@ static inline void output_pixel_SBM();
 static inline void output_pixel_MBM();
 static inline void output_pixel_BORDER_EXT();
 static inline void output_pixel_BORDER();
+static inline void output_line_done();
+static inline void output_line_BORDER();
 static inline void output_pixel_BAD();
+static inline void output_pixel_NONE();
 static uint8_t calc_fps(uint32_t time_now, uint32_t time_start);
 
 typedef struct
 {
-  uint32_t prio_changed;
-  uint32_t y_exp_changed;
-  uint32_t x_exp_changed;
-  uint32_t multi_color_mode_changed;
-  uint32_t color_changed;
+  uint32_t x;
+  uint32_t y;
   uint32_t enabled;
   uint32_t prio;
   uint32_t y_exp;
@@ -253,14 +273,16 @@ typedef struct
   uint32_t x_exp_factor;
   uint32_t x_prev_slayer_pos;
   uint32_t y_prev_slayer_pos;
-  uint32_t x;
-  uint32_t y;
+  uint32_t prio_changed;
+  uint32_t y_exp_changed;
+  uint32_t x_exp_changed;
+  uint32_t multi_color_mode_changed;
+  uint32_t color_changed;
   uint32_t multi_color_mode; /* True when in multi color mode */
   uint32_t color; /* This is the color of the sprite */
   uint32_t bitmap_multi_color_0; /* Is set when bitmap rendered */
   uint32_t bitmap_multi_color_1; /* Is set when bitmap rendered */
   uint32_t bitmap_color; /* Is set when bitmap rendered */
-  uint8_t bitmap_a[SPRITE_HEIGHT * SPRITE_WIDTH]; /* Is set when sprite is rendered */
   uint32_t checksum; /* Checksum for the dot matrix. Makes it possible to know if bitmap needs refresh */
 } sprite_t;
 
@@ -278,26 +300,97 @@ typedef enum
     VIC_STATE_VERTICAL_WAIT_BAD_LINE
 } vic_state_t;
 
+/*
+ * All state that is used for every pixel or every line. It is kept in
+ * one block so that it occupies a few cache lines instead of being spread
+ * over bss. Configuration that only changes on register writes or once
+ * a frame is kept as separate variables below.
+ */
+typedef struct
+{
+  uint8_t *layer_addr_p; /* Memory pointer used to draw pixels with (points into g_line_a) */
+  uint8_t *pixel_sprite_mapping_p; /* Tracking which pixel is drawn by witch sprite */
+  uint8_t *screen_ram_p; /* Pointer to video matrix memory area */
+  uint8_t *fg_color_p; /* Pointer to vic memory */
+  uint8_t *border_color_p; /* Pointer to vic memory */
+  uint8_t *bg_color_pp[4]; /* Pointer to vic memory */
+  uint8_t *ram_p; /* Pointer to start of ram */
+  uint8_t *crom_p; /* Pointer to start of character rom */
+  int32_t ucycles_in_queue; /* Micro cycles left in vic queue waiting to be used */
+  uint32_t screen_line_ucycle_cnt; /* Micro cycles counter for one whole screen line */
+  uint32_t screen_line_cnt; /* Line counter for the screen */
+  uint32_t window_line_cnt; /* Line counter for the display window */
+  uint32_t window_text_line_cnt; /* Counter for a text line, i.e. 8 horizontal lines */
+  uint32_t window_bit_cnt; /* Bit counter for the display window (3 bits) */
+  uint32_t window_video_cnt; /* AKA "VC" */
+  uint32_t window_video_base_cnt; /* AKA "VCBASE" */
+  uint32_t window_text_line_char_cnt; /* Char cnt for display window, resets when line ends */
+  uint32_t wait_bad_line_cnt; /* Assistant counter for bad lines */
+  uint32_t dot_matrix; /* 8 bit bitmap to draw */
+  uint32_t dot_matrix_color; /* The color when in bitmap mode */
+  uint32_t raster_line_irq;
+  uint32_t char_gen_offset;
+  uint32_t bitmap_gen_offset;
+  uint32_t bank;
+  uint32_t view_ucycle_start; /* Line micro cycle where viewport starts */
+  uint32_t view_ucycle_len; /* Width of viewport in micro cycles */
+  vic_state_t vic_state;
+  uint8_t graphic_mode;
+  uint8_t x_scroll;
+  uint8_t y_scroll;
+  uint8_t window_row_cnt; /* AKA "RC" */
+  uint8_t ECM; /* Graphic mode */
+  uint8_t BMM; /* Graphic mode */
+  uint8_t MCM; /* Graphic mode */
+  uint8_t DEN; /* Screen enabled */
+  uint8_t CSEL; /* CSEL value (border expand/shrink) */
+  uint8_t RSEL; /* RSEL value (border expand/shrink) */
+  uint8_t RSEL_active; /* When RSEL is 0 the display is 24 lines instead of 25 */
+  uint8_t CSEL_active; /* When CSEL is 0 the display is 38 columns instead of 40 */
+  uint8_t raster_irq_en;
+  uint8_t sg_irq_set; /* Set if sprite graphic collision latch locked */
+  uint8_t ss_irq_set; /* Set if sprite sprite collision latch locked */
+  uint8_t sprite_present_on_current_line;
+  uint8_t display_frame; /* Hold every second frame (graphics fg and bg) to gain performance */
+  uint8_t render_off; /* Headless, only timing, interrupts and collisions are emulated */
+  uint8_t fg_mask; /* Foreground graphic pixels of current char, only used for pixels not rendered */
+  uint8_t line_hidden; /* Current line is outside viewport, skipped by interlace or render is off */
+  uint8_t line_skipped; /* Current line belongs to the field not rendered this frame */
+  uint8_t field; /* Raster line parity rendered this frame when interlaced */
+  uint8_t view_cropped_x; /* Viewport does not cover the whole line */
+  uint8_t char_pointers_a[41]; /* Char pointers are loaded when bad line occurs */
+} vic_t;
+
+/*
+ * Writes to vic registers, color ram and bank ($DD00) during one frame,
+ * together with the register state when the frame started. This makes
+ * it possible to replay any line of the frame afterwards, e.g. to render
+ * it later or to find the exact position of raster splits.
+ */
+typedef struct
+{
+  vic_log_snapshot_t snapshot;
+  vic_log_entry_t entries_a[VIC_LOG_ENTRIES_MAX]; /* Sorted on cycle */
+  uint32_t cnt;
+  uint8_t overflow; /* Set if entries did not fit, log is not complete */
+} vic_log_t;
+
 extern memory_t g_memory; /* Memory interface */
 extern if_host_t g_if_host; /* Main interface */
 
-static uint8_t *g_layer_addr_p; /* Memory pointer used to draw pixels with */
+static vic_t g_vic __attribute__((aligned(VIC_CACHE_LINE_SIZE))) =
+{
+  .view_ucycle_start = PIXEL_FORGROUND_START * UCYCLE_PER_PIXEL,
+  .view_ucycle_len = FORGROUND_WIDTH * UCYCLE_PER_PIXEL
+};
+static uint8_t g_line_a[PIXELS_MAX]; /* Native (1x) line, scaled into layer when done */
 static uint8_t *g_layer_addr_start_p; /* Start addr for graphic memory */
+static uint8_t *g_prev_layer_addr_start_p; /* Last completed frame, source for lines not rendered when interlaced */
 static uint8_t *g_sprite_layer_addr_aap[VIC_MEM_MAX]; /* Memory to keep track of sprites */
 static uint8_t *g_sprite_layer_addr_start_aap[VIC_MEM_MAX]; /* Memory to keep track of sprites */
 
-static uint8_t *g_pixel_sprite_mapping_p; /* Tracking which pixel is drawn by witch sprite */
 static uint8_t *g_pixel_sprite_mapping_start_p; /* Tracking which pixel is drawn by witch sprite */
 static uint8_t *g_sprite_pointer_ap[8]; /* Contains pointers to sprite bitmaps */
-static uint8_t *g_crom_p; /* Pointer to start of character rom */
-static uint8_t *g_ram_p; /* Pointer to start of ram */
-static uint8_t *g_border_color_p; /* Pointer to vic memory */
-static uint8_t *g_screen_ram_p; /* Pointer to video matrix memory area */
-static uint8_t *g_fg_color_p; /* Pointer to vic memory */
-static uint8_t *g_bg_color_pp[4]; /* Pointer to vic memory */
-static uint8_t g_x_scroll;
-static uint8_t g_y_scroll;
-static uint8_t g_window_row_cnt; /* AKA "RC" */
 static uint8_t g_sprite_presence_a[LINE_MAX + SPRITE_HEIGHT*2]; /* Tracking sprites for line */
 
 /*
@@ -310,52 +403,26 @@ static uint8_t g_sprite_presence_a[LINE_MAX + SPRITE_HEIGHT*2]; /* Tracking spri
 static uint8_t g_sprite_redraw_queue_a[LINE_MAX];
 static uint8_t g_full_frame_rate;
 static uint8_t g_lock_frame_rate;
-static uint8_t g_display_frame; /* Hold every second frame (graphics fg and bg) to gain performance */
-static uint8_t g_char_pointers_a[41]; /* Char pointers are loaded when bad line occurs */
+static uint8_t g_interlace; /* Render even and odd lines every other frame */
+static vic_log_t g_log_a[2]; /* Frame being logged and last complete frame */
+static uint8_t g_log_current;
+static uint8_t g_log_active;
 
-static uint32_t g_sprite_present_on_current_line;
 static uint32_t g_fps_saved_time;
 static uint32_t g_fps_stats_time;
 static uint32_t g_frames_until_stats;
 static uint32_t g_frames_until_lock;
-static uint32_t g_raster_line_irq;
 static uint32_t g_sprite_multi_color_0;
 static uint32_t g_sprite_multi_color_1;
-static uint32_t g_raster_irq_en;
 static uint32_t g_mem_pointer;
-static uint32_t g_char_gen_offset;
-static uint32_t g_bitmap_gen_offset;
 static uint32_t g_screen_ram_offset;
-static uint32_t g_bank;
-static uint32_t g_dot_matrix; /* 8 bit bitmap to draw */
-static uint32_t g_dot_matrix_color; /* The color when in bitmap mode */
-static uint32_t g_graphic_mode;
-static uint32_t g_sg_irq_set; /* Set if sprite graphic collision latch locked */
-static uint32_t g_ss_irq_set; /* Set if sprite sprite collision latch locked */
 static uint32_t g_sg_irq_en;
 static uint32_t g_ss_irq_en;
-static uint32_t g_screen_line_ucycle_cnt; /* Micro cycles counter for one whole screen line */
-static uint32_t g_screen_line_cnt; /* Line counter for the screen */
-static uint32_t g_window_line_cnt; /* Line counter for the display window */
-static uint32_t g_window_text_line_cnt; /* Counter for a text line, i.e. 8 horizontal lines */
-static uint32_t g_window_bit_cnt; /* Bit counter for the display window (3 bits) */
-static uint32_t g_window_video_cnt; /* AKA "VC" */
-static uint32_t g_window_video_base_cnt; /* AKA "VCBASE" */
-static uint32_t g_window_text_line_char_cnt; /* Char cnt for display window, resets when line ends */
-static uint32_t g_wait_bad_line_cnt; /* Assistant counter for bad lines */
-static uint32_t g_ECM; /* Graphic mode */
-static uint32_t g_BMM; /* Graphic mode */
-static uint32_t g_MCM; /* Graphic mode */
-static uint32_t g_DEN; /* Screen enabled */
-static uint32_t g_CSEL; /* CSEL value (border expand/shrink) */
-static uint32_t g_RSEL; /* RSEL value (border expand/shrink) */
-static uint32_t g_RSEL_active; /* When RSEL is 0 the display is 24 lines instead of 25 */
-static uint32_t g_CSEL_active; /* When CSEL is 0 the display is 38 columns instead of 40 */
-
-static int32_t g_ucycles_in_queue; /* Micro cycles left in vic queue waiting to be used */
+static uint32_t g_view_line_start = LINE_FORGROUND_START; /* First raster line in viewport */
+static uint32_t g_view_line_end = LINE_FORGROUND_START + FORGROUND_HEIGHT; /* First raster line after viewport */
 
 static sprite_t g_sprites_a[8];
-static vic_state_t g_vic_state;
+static uint8_t g_sprite_bitmap_aa[8][SPRITE_HEIGHT * SPRITE_WIDTH]; /* Is set when sprite is rendered */
 
 static void event_write_xsprite0(uint16_t addr, uint8_t value)
 {
@@ -596,17 +663,17 @@ static void event_write_xmsb(uint16_t addr, uint8_t value)
 
 static void event_write_cr1(uint16_t addr, uint8_t value)
 {
-  g_ECM = value & MASK_CR_1_ECM;
-  g_BMM = value & MASK_CR_1_BMM;
-  g_DEN = value & MASK_CR_1_DEN;
-  g_RSEL = value & MASK_CR_1_RSEL;
-  g_y_scroll = value & MASK_CR_1_YSCROLL;
+  g_vic.ECM = value & MASK_CR_1_ECM;
+  g_vic.BMM = value & MASK_CR_1_BMM;
+  g_vic.DEN = value & MASK_CR_1_DEN;
+  g_vic.RSEL = value & MASK_CR_1_RSEL;
+  g_vic.y_scroll = value & MASK_CR_1_YSCROLL;
 
   graphic_mode();
 
   /* Bit 7 in this reg is owned by raster (will not be written) */
-  g_raster_line_irq &= 0x00FF;
-  g_raster_line_irq |= (value & 0x80) << 1;
+  g_vic.raster_line_irq &= 0x00FF;
+  g_vic.raster_line_irq |= (value & 0x80) << 1;
   g_memory.io_p[addr] &= ~0x7F;
   g_memory.io_p[addr] |= value & 0x7F;
 }
@@ -614,8 +681,8 @@ static void event_write_cr1(uint16_t addr, uint8_t value)
 static void event_write_raster(uint16_t addr, uint8_t value)
 {
   /* Writing to this reg will set the raster line for irq */
-  g_raster_line_irq &= 0xFF00;
-  g_raster_line_irq |= (value & 0xFF);
+  g_vic.raster_line_irq &= 0xFF00;
+  g_vic.raster_line_irq |= (value & 0xFF);
 
   /*
    * Do not update memory, memory should always contain the
@@ -655,9 +722,9 @@ static void event_write_sprite_enabled(uint16_t addr, uint8_t value)
 
 static void event_write_cr2(uint16_t addr, uint8_t value)
 {
-  g_MCM = value & MASK_CR_2_MCM;
-  g_CSEL = value & MASK_CR_2_CSEL;
-  g_x_scroll = value & MASK_CR_2_XSCROLL;
+  g_vic.MCM = value & MASK_CR_2_MCM;
+  g_vic.CSEL = value & MASK_CR_2_CSEL;
+  g_vic.x_scroll = value & MASK_CR_2_XSCROLL;
   graphic_mode();
   g_memory.io_p[addr] = value;
 }
@@ -685,10 +752,10 @@ static void event_write_mem_pointers(uint16_t addr, uint8_t value)
   g_mem_pointer = value;
 
   /* CB13, CB12, CB11 */
-  g_char_gen_offset = (value & 0x0E) << 10;
+  g_vic.char_gen_offset = (value & 0x0E) << 10;
 
   /* CB13 only, used in bitmap modes */
-  g_bitmap_gen_offset = (value & 0x08) << 10;
+  g_vic.bitmap_gen_offset = (value & 0x08) << 10;
 
   /* VM13, VM12, VM11, VM10 */
   g_screen_ram_offset = ((value & 0xF0) << 6);
@@ -701,11 +768,11 @@ static void event_write_irq_enable(uint16_t addr, uint8_t value)
   /* Raster interrupt enabled */
   if(value & MASK_INTRRUPT_ENABLE_ERST)
   {
-    g_raster_irq_en = 1;
+    g_vic.raster_irq_en = 1;
   }
   else
   {
-    g_raster_irq_en = 0;
+    g_vic.raster_irq_en = 0;
   }
 
   /* Collition sprite background */
@@ -933,7 +1000,7 @@ static uint8_t event_read_color_ram(uint16_t addr)
    */
   uint8_t reg = g_memory.io_p[addr];
   reg &= 0x0F;
-  reg |= g_dot_matrix & 0xF0;
+  reg |= g_vic.dot_matrix & 0xF0;
   return reg;
 }
 
@@ -1031,7 +1098,7 @@ static uint8_t event_read_ss_coll(uint16_t addr)
 {
   uint8_t reg = g_memory.io_p[addr];
   g_memory.io_p[addr] = 0x00; /* Is cleared when read */
-  g_ss_irq_set = 0;
+  g_vic.ss_irq_set = 0;
   return reg;
 }
 
@@ -1039,7 +1106,7 @@ static uint8_t event_read_sg_coll(uint16_t addr)
 {
   uint8_t reg = g_memory.io_p[addr];
   g_memory.io_p[addr] = 0x00; /* Is cleared when read */
-  g_sg_irq_set = 0;
+  g_vic.sg_irq_set = 0;
   return reg;
 }
 
@@ -1052,14 +1119,14 @@ static inline void load_dot_matrix_STM_MTM()
 {
   /* First calculate offset */
   uint32_t char_offset =
-      (g_char_pointers_a[g_window_text_line_char_cnt] << 3) + /* AKA D0-D7 */
-      g_window_row_cnt; /* AKA RC0-RC2 */
+      (g_vic.char_pointers_a[g_vic.window_text_line_char_cnt] << 3) + /* AKA D0-D7 */
+      g_vic.window_row_cnt; /* AKA RC0-RC2 */
 
   /* Vic will always see char rom at 0x1000 - 0x1FFF for bank 0 and 2 */
-  if((g_char_gen_offset == 0x1000 || g_char_gen_offset == 0x1800) && /* AKA CB11-CB13 */
-    (g_bank == 0 || g_bank == 2))
+  if((g_vic.char_gen_offset == 0x1000 || g_vic.char_gen_offset == 0x1800) && /* AKA CB11-CB13 */
+    (g_vic.bank == 0 || g_vic.bank == 2))
   {
-    g_dot_matrix = *(g_crom_p + (g_char_gen_offset & 0x0800) + char_offset); /* AKA g-access */
+    g_vic.dot_matrix = *(g_vic.crom_p + (g_vic.char_gen_offset & 0x0800) + char_offset); /* AKA g-access */
   }
   else
   {
@@ -1069,35 +1136,35 @@ static inline void load_dot_matrix_STM_MTM()
      * with the vic bank address offset (1) and the character generator offset (2).
      * The offset to dot matrix will be represented as BANK | CB11-CB13 | D0-D7 | RC0-RC2.
      */
-    uint32_t ram_offset = (g_bank << 14) | g_char_gen_offset | char_offset;
-    g_dot_matrix = *(g_ram_p + ram_offset);
+    uint32_t ram_offset = (g_vic.bank << 14) | g_vic.char_gen_offset | char_offset;
+    g_vic.dot_matrix = *(g_vic.ram_p + ram_offset);
   }
 }
 
 static inline void load_dot_matrix_SBM_MBM()
 {
   /* AKA g-access */
-  uint32_t bitmap_offset = (g_bank << 14) +
-      g_bitmap_gen_offset + /* AKA CB13 */
-      (g_window_video_cnt << 3) + /* AKA VC0-VC9 */
-      g_window_row_cnt; /* AKA RC0-RC2 */
+  uint32_t bitmap_offset = (g_vic.bank << 14) +
+      g_vic.bitmap_gen_offset + /* AKA CB13 */
+      (g_vic.window_video_cnt << 3) + /* AKA VC0-VC9 */
+      g_vic.window_row_cnt; /* AKA RC0-RC2 */
 
-  g_dot_matrix = *(g_ram_p + bitmap_offset);
-  g_dot_matrix_color = g_screen_ram_p[g_window_video_cnt]; /* AKA VC0-VC9 */
+  g_vic.dot_matrix = *(g_vic.ram_p + bitmap_offset);
+  g_vic.dot_matrix_color = g_vic.screen_ram_p[g_vic.window_video_cnt]; /* AKA VC0-VC9 */
 }
 
 static inline void load_dot_matrix_ECM()
 {
   /* First calculate offset */
   uint32_t char_offset =
-      ((g_char_pointers_a[g_window_text_line_char_cnt] & 0x3F) << 3) + /* AKA D0-D7 */
-      (g_window_row_cnt); /* AKA RC0-RC2 */
+      ((g_vic.char_pointers_a[g_vic.window_text_line_char_cnt] & 0x3F) << 3) + /* AKA D0-D7 */
+      (g_vic.window_row_cnt); /* AKA RC0-RC2 */
 
   /* Vic will always see char rom at 0x1000 - 0x1FFF for bank 0 and 2 */
-  if((g_char_gen_offset == 0x1000 || g_char_gen_offset == 0x1800) && /* AKA CB11-CB13 */
-    (g_bank == 0 || g_bank == 2))
+  if((g_vic.char_gen_offset == 0x1000 || g_vic.char_gen_offset == 0x1800) && /* AKA CB11-CB13 */
+    (g_vic.bank == 0 || g_vic.bank == 2))
   {
-    g_dot_matrix = *(g_crom_p + (g_char_gen_offset & 0x0800) + char_offset); /* AKA g-access */
+    g_vic.dot_matrix = *(g_vic.crom_p + (g_vic.char_gen_offset & 0x0800) + char_offset); /* AKA g-access */
   }
   else
   {
@@ -1107,58 +1174,112 @@ static inline void load_dot_matrix_ECM()
      * with the vic bank address offset (1) and the character generator offset (2).
      * The offset to dot matrix will be represented as BANK | CB11-CB13 | D0-D7 | RC0-RC2.
      */
-    uint32_t ram_offset = (g_bank << 14) | g_char_gen_offset | char_offset;
-    g_dot_matrix = *(g_ram_p + ram_offset);
+    uint32_t ram_offset = (g_vic.bank << 14) | g_vic.char_gen_offset | char_offset;
+    g_vic.dot_matrix = *(g_vic.ram_p + ram_offset);
   }
 }
 
 static inline void load_dot_matrix_BORDER()
 {
-  g_dot_matrix = 0x00;
+  g_vic.dot_matrix = 0x00;
 }
 
 static inline void load_dot_matrix_BAD()
 {
-  g_dot_matrix = 0x00; 
+  g_vic.dot_matrix = 0x00; 
+}
+
+/*
+ * Used instead of loading dot matrix when render is off. Only sprite
+ * to graphic collisions needs the graphic data, so it is only fetched
+ * when sprites are present on the line and then reduced to a mask of
+ * pixels that are foreground (one bit per pixel).
+ */
+static inline void load_fg_mask()
+{
+  uint8_t mc_mask;
+
+  g_vic.fg_mask = 0x00;
+
+  if(!g_vic.sprite_present_on_current_line)
+  {
+    return;
+  }
+
+  switch(g_vic.graphic_mode)
+  {
+    case GRAPHIC_MODE_STM:
+      load_dot_matrix_STM_MTM();
+      g_vic.fg_mask = g_vic.dot_matrix;
+      break;
+    case GRAPHIC_MODE_MTM:
+      load_dot_matrix_STM_MTM();
+      if(g_vic.fg_color_p[g_vic.window_video_cnt] & MASK_MC_FLAG)
+      {
+        /* Bit pair 10 and 11 are foreground */
+        mc_mask = g_vic.dot_matrix & 0xAA;
+        g_vic.fg_mask = mc_mask | (mc_mask >> 1);
+      }
+      else
+      {
+        g_vic.fg_mask = g_vic.dot_matrix;
+      }
+      break;
+    case GRAPHIC_MODE_SBM:
+      load_dot_matrix_SBM_MBM();
+      g_vic.fg_mask = g_vic.dot_matrix;
+      break;
+    case GRAPHIC_MODE_MBM:
+      load_dot_matrix_SBM_MBM();
+      mc_mask = g_vic.dot_matrix & 0xAA;
+      g_vic.fg_mask = mc_mask | (mc_mask >> 1);
+      break;
+    case GRAPHIC_MODE_ECM:
+      load_dot_matrix_ECM();
+      g_vic.fg_mask = g_vic.dot_matrix;
+      break;
+    default:
+      ;
+  }
 }
 
 static void graphic_mode()
 {
-  if(g_DEN == 0 || g_RSEL_active || g_CSEL_active)
+  if(g_vic.DEN == 0 || g_vic.RSEL_active || g_vic.CSEL_active)
   {
-    g_graphic_mode = GRAPHIC_MODE_BORDER_EXT;
+    g_vic.graphic_mode = GRAPHIC_MODE_BORDER_EXT;
   }
-  else if((g_BMM | g_ECM | g_MCM) == 0)
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == 0)
   {
-    g_graphic_mode = GRAPHIC_MODE_STM;
+    g_vic.graphic_mode = GRAPHIC_MODE_STM;
   }
-  else if((g_BMM | g_ECM | g_MCM) == MASK_CR_2_MCM)
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == MASK_CR_2_MCM)
   {
-    g_graphic_mode = GRAPHIC_MODE_MTM;
+    g_vic.graphic_mode = GRAPHIC_MODE_MTM;
   }
-  else if((g_BMM | g_ECM | g_MCM) == (MASK_CR_1_BMM))
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == (MASK_CR_1_BMM))
   {
-    g_graphic_mode = GRAPHIC_MODE_SBM;
+    g_vic.graphic_mode = GRAPHIC_MODE_SBM;
   }
-  else if((g_BMM | g_ECM | g_MCM) == (MASK_CR_2_MCM | MASK_CR_1_BMM))
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == (MASK_CR_2_MCM | MASK_CR_1_BMM))
   {
-    g_graphic_mode = GRAPHIC_MODE_MBM;
+    g_vic.graphic_mode = GRAPHIC_MODE_MBM;
   }
-  else if((g_BMM | g_ECM | g_MCM) == MASK_CR_1_ECM)
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == MASK_CR_1_ECM)
   {
-    g_graphic_mode = GRAPHIC_MODE_ECM;
+    g_vic.graphic_mode = GRAPHIC_MODE_ECM;
   }
-  else if((g_BMM | g_ECM | g_MCM) == (MASK_CR_1_ECM | MASK_CR_2_MCM))
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == (MASK_CR_1_ECM | MASK_CR_2_MCM))
   {
-    g_graphic_mode = GRAPHIC_MODE_ITM;
+    g_vic.graphic_mode = GRAPHIC_MODE_ITM;
   }
-  else if((g_BMM | g_ECM | g_MCM) == (MASK_CR_1_ECM | MASK_CR_1_BMM))
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == (MASK_CR_1_ECM | MASK_CR_1_BMM))
   {
-    g_graphic_mode = GRAPHIC_MODE_IBM_1;
+    g_vic.graphic_mode = GRAPHIC_MODE_IBM_1;
   }
-  else if((g_BMM | g_ECM | g_MCM) == (MASK_CR_1_ECM | MASK_CR_1_BMM | MASK_CR_2_MCM))
+  else if((g_vic.BMM | g_vic.ECM | g_vic.MCM) == (MASK_CR_1_ECM | MASK_CR_1_BMM | MASK_CR_2_MCM))
   {
-    g_graphic_mode = GRAPHIC_MODE_IBM_2;
+    g_vic.graphic_mode = GRAPHIC_MODE_IBM_2;
   }
 }
 
@@ -1228,15 +1349,15 @@ static void erase_sprite(uint32_t sprite, uint32_t at_x, uint32_t at_y)
               y_sum /=2;              
             }
 
-            //if(g_sprites_a[cnt].bitmap_a[y_sum * SPRITE_WIDTH + x_sum] == SPRITE_NONE) while(1){;}
+            //if(g_sprite_bitmap_aa[cnt][y_sum * SPRITE_WIDTH + x_sum] == SPRITE_NONE) while(1){;}
             /* Now just render the sprite that was found "underneath" */
             if(!g_sprites_a[cnt].prio) /* 0 prio means rendering in front of fg pixels */
             {
-              fg_sprite_p[x] = g_sprites_a[cnt].bitmap_a[y_sum * SPRITE_WIDTH + x_sum];
+              fg_sprite_p[x] = g_sprite_bitmap_aa[cnt][y_sum * SPRITE_WIDTH + x_sum];
             }
             else
             {
-              bg_sprite_p[x] = g_sprites_a[cnt].bitmap_a[y_sum * SPRITE_WIDTH + x_sum];
+              bg_sprite_p[x] = g_sprite_bitmap_aa[cnt][y_sum * SPRITE_WIDTH + x_sum];
             }
 
             break;
@@ -1338,7 +1459,7 @@ static void draw_sprite(uint32_t sprite, uint32_t at_x, uint32_t at_y)
    * This will copy the dot matrix of whole sprite onto the sprite layer.
    * The offset to dot matrix will be represented as BANK | MP7-MP0 | MC5-MC0
    */
-  pixel_p = g_sprites_a[sprite].bitmap_a;
+  pixel_p = g_sprite_bitmap_aa[sprite];
 
   for(y = 0; y < SPRITE_HEIGHT * y_exp_factor; y++)
   {
@@ -1428,11 +1549,11 @@ static void draw_sprite(uint32_t sprite, uint32_t at_x, uint32_t at_y)
     //g_memory.io_p[REG_INTRRUPT] |= MASK_INTRRUPT_IMMC;
 
     /* Will be ignored if locked (when ss coll reg is not read) */
-    if(g_ss_irq_en && !g_ss_irq_set)
+    if(g_ss_irq_en && !g_vic.ss_irq_set)
     {
       /* Set ss collision latch */
       g_memory.io_p[REG_INTRRUPT] |= MASK_INTRRUPT_IRQ | MASK_INTRRUPT_IMMC; /* Set IRQ line low*/
-      g_ss_irq_set = 1;
+      g_vic.ss_irq_set = 1;
     }
   }
 }
@@ -1487,8 +1608,8 @@ static void render_sprite(uint32_t sprite, uint32_t checksum, uint8_t *base_p)
           }
 
           dot_matrix <<= 2;
-          g_sprites_a[sprite].bitmap_a[y * SPRITE_WIDTH + x * 8 + i * 2] = color;
-          g_sprites_a[sprite].bitmap_a[y * SPRITE_WIDTH + x * 8 + i * 2 + 1] = color;
+          g_sprite_bitmap_aa[sprite][y * SPRITE_WIDTH + x * 8 + i * 2] = color;
+          g_sprite_bitmap_aa[sprite][y * SPRITE_WIDTH + x * 8 + i * 2 + 1] = color;
         }
       }
       else /* hi-res mode */
@@ -1507,7 +1628,7 @@ static void render_sprite(uint32_t sprite, uint32_t checksum, uint8_t *base_p)
           }
 
           dot_matrix <<= 1;
-          g_sprites_a[sprite].bitmap_a[y * SPRITE_WIDTH + x * 8 + i] = color;
+          g_sprite_bitmap_aa[sprite][y * SPRITE_WIDTH + x * 8 + i] = color;
         }
       }
     }
@@ -1522,10 +1643,10 @@ static void handle_sprite_redraw_queue()
    * Are there any sprites that needs to be redrawn due to movement?
    * Calling this function needs to be done at very specific locations.
    */
-  if(g_sprite_redraw_queue_a[g_screen_line_cnt])
+  if(g_sprite_redraw_queue_a[g_vic.screen_line_cnt])
   {
     uint8_t i;
-    uint8_t tmp = g_sprite_redraw_queue_a[g_screen_line_cnt];
+    uint8_t tmp = g_sprite_redraw_queue_a[g_vic.screen_line_cnt];
     for(i = 0; tmp != 0; i++)
     {
       if(tmp & 0x01)
@@ -1541,7 +1662,7 @@ static void handle_sprite_redraw_queue()
     }
 
     /* Remove redraw marker */
-    g_sprite_redraw_queue_a[g_screen_line_cnt] = 0;
+    g_sprite_redraw_queue_a[g_vic.screen_line_cnt] = 0;
   }
 }
 
@@ -1560,7 +1681,7 @@ static void refresh_sprites()
       continue;
     }
 
-    if((g_sprite_presence_a[g_screen_line_cnt] & (1 << i)) == 0x00)
+    if((g_sprite_presence_a[g_vic.screen_line_cnt] & (1 << i)) == 0x00)
     {
       continue;
     }
@@ -1572,13 +1693,13 @@ static void refresh_sprites()
 
     /* Vic will always see char rom at 0x1000 - 0x1FFF for bank 0 and 2 */
     if((sprite_offset >= 0x1000 && sprite_offset < 0x2000) &&
-      (g_bank == 0 || g_bank == 2))
+      (g_vic.bank == 0 || g_vic.bank == 2))
     {
-      base_p = g_crom_p + sprite_offset;
+      base_p = g_vic.crom_p + sprite_offset;
     }
     else
     {
-      base_p = g_ram_p + (g_bank << 14) + sprite_offset;
+      base_p = g_vic.ram_p + (g_vic.bank << 14) + sprite_offset;
     }
 
     /* First gnerate the checksum for bitmaps */
@@ -1656,7 +1777,7 @@ static void new_sprite_line()
   uint8_t *base_p;
 
   base_p = g_memory.ram_p +
-      (g_bank << 14) +
+      (g_vic.bank << 14) +
       g_screen_ram_offset +
       (0x7F << 3);
 
@@ -1673,29 +1794,53 @@ static void new_sprite_line()
 static void new_line()
 {
   g_memory.io_p[REG_CR_1] &= ~MASK_CR_1_RST8;
-  g_memory.io_p[REG_CR_1] |= (g_screen_line_cnt >> 1) & MASK_CR_1_RST8;
-  g_memory.io_p[REG_RASTER] = g_screen_line_cnt & 0xFF;
+  g_memory.io_p[REG_CR_1] |= (g_vic.screen_line_cnt >> 1) & MASK_CR_1_RST8;
+  g_memory.io_p[REG_RASTER] = g_vic.screen_line_cnt & 0xFF;
 
-  if(g_screen_line_cnt == g_raster_line_irq)
+  if(g_vic.screen_line_cnt == g_vic.raster_line_irq)
   {
     /*
      * Set raster match latch.
      */
     g_memory.io_p[REG_INTRRUPT] |= MASK_INTRRUPT_IRST;
 
-    if(g_raster_irq_en)
+    if(g_vic.raster_irq_en)
     {
       g_memory.io_p[REG_INTRRUPT] |= MASK_INTRRUPT_IRQ; /* Set IRQ line low*/
     }
   }
+
+  update_line_hidden();
+}
+
+static void update_line_hidden()
+{
+  g_vic.line_hidden = g_vic.render_off ||
+                      g_vic.screen_line_cnt < g_view_line_start ||
+                      g_vic.screen_line_cnt >= g_view_line_end;
+
+  /* Without a previous frame there is nothing to keep, render all lines */
+  g_vic.line_skipped = !g_vic.line_hidden &&
+                       g_interlace &&
+                       g_prev_layer_addr_start_p != NULL &&
+                       (g_vic.screen_line_cnt & 0x1) != g_vic.field;
+
+  g_vic.line_hidden |= g_vic.line_skipped;
+}
+
+static inline uint8_t pixel_visible()
+{
+  /* Unsigned compare also catches pixels left of viewport */
+  return !g_vic.line_hidden &&
+         (g_vic.screen_line_ucycle_cnt - g_vic.view_ucycle_start) < g_vic.view_ucycle_len;
 }
 
 static void new_text_line()
 {
   uint32_t vmli;
 
-  g_screen_ram_p = g_memory.ram_p +
-    (g_bank << 14) +
+  g_vic.screen_ram_p = g_memory.ram_p +
+    (g_vic.bank << 14) +
     g_screen_ram_offset;   /* AKA VM13-VM10 */
 
   /* Bad line in progress, fetch all character pointers for the text line */
@@ -1705,20 +1850,64 @@ static void new_text_line()
      * AKA c-access.
      * Char pointer will be represented as BANK | VM13-VM10 | VC9-VC0
      */
-    g_char_pointers_a[vmli] = g_screen_ram_p[g_window_video_cnt + vmli];
+    g_vic.char_pointers_a[vmli] = g_vic.screen_ram_p[g_vic.window_video_cnt + vmli];
   }
 }
 
+static void log_write(uint16_t addr, uint8_t value)
+{
+  vic_log_t *log_p = &g_log_a[g_log_current];
+  vic_log_entry_t *entry_p;
+
+  if(log_p->cnt == VIC_LOG_ENTRIES_MAX)
+  {
+    log_p->overflow = 1;
+    return;
+  }
+
+  /*
+   * Vic is stepped after cpu, so this is the position when the
+   * instruction doing the write started.
+   */
+  entry_p = &log_p->entries_a[log_p->cnt++];
+  entry_p->cycle = g_vic.screen_line_cnt * VIC_LOG_CYCLES_LINE +
+                   g_vic.screen_line_ucycle_cnt / UCYCLES_PER_CYCLE;
+  entry_p->addr = addr;
+  entry_p->value = value;
+}
+
+static void log_new_frame()
+{
+  vic_log_t *log_p;
+
+  g_log_current = !g_log_current;
+  log_p = &g_log_a[g_log_current];
+
+  log_p->cnt = 0;
+  log_p->overflow = 0;
+  memcpy(log_p->snapshot.regs_a, g_memory.io_p + 0xD000, VIC_LOG_REGS);
+  memcpy(log_p->snapshot.color_ram_a, g_memory.io_p + OFFSET_COLOR_RAM, VIC_LOG_COLOR_RAM_SIZE);
+  log_p->snapshot.bank = g_memory.io_p[0xDD00];
+}
+
 static void new_frame()
 {
   uint32_t fps_time;
 
-  if(g_display_frame) /* Only flip buffer if it was actually used */
+  if(g_log_active)
+  {
+    log_new_frame();
+  }
+
+  if(g_vic.display_frame && !g_vic.render_off) /* Only flip buffer if it was actually used */
   {
     /* Flip the buffer and get a new one */
+    g_prev_layer_addr_start_p = g_layer_addr_start_p;
     g_if_host.if_host_disp.disp_flip_fp(&g_layer_addr_start_p);
   }
 
+  g_vic.field = !g_vic.field;
+
   if(g_lock_frame_rate)
   {
     if(g_frames_until_lock == 0)
@@ -1754,11 +1943,11 @@ void sg_coll_detected(uint8_t sprite_bf)
   // g_memory.io_p[REG_INTRRUPT] |= MASK_INTRRUPT_IMBC;
 
   /* Will be ignored if locked (when sg coll reg is not read) */
-  if(g_sg_irq_en && !g_sg_irq_set)
+  if(g_sg_irq_en && !g_vic.sg_irq_set)
   {
     /* Set sg collision latch */
     g_memory.io_p[REG_INTRRUPT] |= MASK_INTRRUPT_IRQ | MASK_INTRRUPT_IMBC; /* Set IRQ line low*/
-    g_sg_irq_set = 1;
+    g_vic.sg_irq_set = 1;
   }
 }
 
@@ -1769,21 +1958,21 @@ static inline void output_pixel_STM()
   uint8_t sprite_bg_pixel1 = SPRITE_NONE;
   uint8_t graphic_fg_pixel = 0;
   
-  if((g_dot_matrix >> (7 - g_window_bit_cnt)) & 0x1)
+  if((g_vic.dot_matrix >> (7 - g_vic.window_bit_cnt)) & 0x1)
   {
-    pixel1 = g_fg_color_p[g_window_video_cnt] & 0x0F;
+    pixel1 = g_vic.fg_color_p[g_vic.window_video_cnt] & 0x0F;
     graphic_fg_pixel = 1;
   }
   else
   {
-    pixel1 = *g_bg_color_pp[0] & MASK_COLOR_BG_B0C;
+    pixel1 = *g_vic.bg_color_pp[0] & MASK_COLOR_BG_B0C;
   }
 
   /* Check if any sprite exist on this row */
-  if(g_sprite_present_on_current_line)
+  if(g_vic.sprite_present_on_current_line)
   {
     /* Check if any sprite is on this exact location */
-    if(*g_pixel_sprite_mapping_p)
+    if(*g_vic.pixel_sprite_mapping_p)
     {
       /* Check if fg sprite exist */
       sprite_fg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
@@ -1805,7 +1994,7 @@ static inline void output_pixel_STM()
       /* Check any collisions with fg graphics */
       if(graphic_fg_pixel)
       {
-        sg_coll_detected(*g_pixel_sprite_mapping_p);
+        sg_coll_detected(*g_vic.pixel_sprite_mapping_p);
       }
     }
     else
@@ -1816,16 +2005,13 @@ static inline void output_pixel_STM()
   }
 
   /* Plot pixel on screen */
-  *g_layer_addr_p++ = pixel1;
-#ifdef SCREEN_X2
-  *g_layer_addr_p++ = pixel1;
-#endif
+  *g_vic.layer_addr_p++ = pixel1;
 
   /* Step forward */
-  g_pixel_sprite_mapping_p++;
-  g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-  g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-  g_window_bit_cnt++;
+  g_vic.pixel_sprite_mapping_p++;
+  g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+  g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+  g_vic.window_bit_cnt++;
 }
 
 static inline void output_pixel_ECM()
@@ -1835,9 +2021,9 @@ static inline void output_pixel_ECM()
   uint8_t sprite_bg_pixel1 = SPRITE_NONE;
   uint8_t graphic_fg_pixel = 0;
 
-  if((g_dot_matrix >> (7 - g_window_bit_cnt)) & 0x1)
+  if((g_vic.dot_matrix >> (7 - g_vic.window_bit_cnt)) & 0x1)
   {
-    pixel1 = g_fg_color_p[g_window_video_cnt] & 0x0F;
+    pixel1 = g_vic.fg_color_p[g_vic.window_video_cnt] & 0x0F;
     graphic_fg_pixel = 1;
   }
   else /* Backgound color determined by VM13, VM12 bits of mem pointer */
@@ -1845,25 +2031,25 @@ static inline void output_pixel_ECM()
     switch(g_mem_pointer & 0xC0)
     {
     case 0x00:
-      pixel1 = *g_bg_color_pp[0] & MASK_COLOR_BG_B0C;
+      pixel1 = *g_vic.bg_color_pp[0] & MASK_COLOR_BG_B0C;
       break;
     case 0x40:
-      pixel1 = *g_bg_color_pp[1] & MASK_COLOR_BG_B1C;
+      pixel1 = *g_vic.bg_color_pp[1] & MASK_COLOR_BG_B1C;
       break;
     case 0x80:
-      pixel1 = *g_bg_color_pp[2] & MASK_COLOR_BG_B2C;
+      pixel1 = *g_vic.bg_color_pp[2] & MASK_COLOR_BG_B2C;
       break;
     case 0xC0:
-      pixel1 = *g_bg_color_pp[3] & MASK_COLOR_BG_B3C;
+      pixel1 = *g_vic.bg_color_pp[3] & MASK_COLOR_BG_B3C;
       break;
     default:
       ;
     }
   }
 
-  if(g_sprite_present_on_current_line)
+  if(g_vic.sprite_present_on_current_line)
   {
-    if(*g_pixel_sprite_mapping_p)
+    if(*g_vic.pixel_sprite_mapping_p)
     {
       sprite_fg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
       sprite_bg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
@@ -1879,7 +2065,7 @@ static inline void output_pixel_ECM()
 
       if(graphic_fg_pixel)
       {
-        sg_coll_detected(*g_pixel_sprite_mapping_p);
+        sg_coll_detected(*g_vic.pixel_sprite_mapping_p);
       }
     }
     else
@@ -1889,15 +2075,12 @@ static inline void output_pixel_ECM()
     }
   }
 
-  *g_layer_addr_p++ = pixel1;
-#ifdef SCREEN_X2
-  *g_layer_addr_p++ = pixel1;
-#endif
+  *g_vic.layer_addr_p++ = pixel1;
 
-  g_pixel_sprite_mapping_p++;
-  g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-  g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-  g_window_bit_cnt++;
+  g_vic.pixel_sprite_mapping_p++;
+  g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+  g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+  g_vic.window_bit_cnt++;
 }
 
 static inline void output_pixel_MTM()
@@ -1907,38 +2090,38 @@ static inline void output_pixel_MTM()
   uint8_t sprite_bg_pixel1 = SPRITE_NONE;
   uint8_t graphic_fg_pixel = 0;
 
-  if(g_fg_color_p[g_window_video_cnt] & MASK_MC_FLAG)
+  if(g_vic.fg_color_p[g_vic.window_video_cnt] & MASK_MC_FLAG)
   {
-    uint8_t window_bit_cnt = g_window_bit_cnt;
+    uint8_t window_bit_cnt = g_vic.window_bit_cnt;
 
     if(window_bit_cnt & 0x01)
     {
       window_bit_cnt--;
     }
 
-    switch((g_dot_matrix >> (6 - window_bit_cnt)) & 0x3)
+    switch((g_vic.dot_matrix >> (6 - window_bit_cnt)) & 0x3)
     {
     case 0x00:
-        pixel1 = *g_bg_color_pp[0] & MASK_COLOR_BG_B0C;
+        pixel1 = *g_vic.bg_color_pp[0] & MASK_COLOR_BG_B0C;
       break;
     case 0x01:
-        pixel1 = *g_bg_color_pp[1] & MASK_COLOR_BG_B1C;
+        pixel1 = *g_vic.bg_color_pp[1] & MASK_COLOR_BG_B1C;
       break;
     case 0x02:
-        pixel1 = *g_bg_color_pp[2] & MASK_COLOR_BG_B2C;
+        pixel1 = *g_vic.bg_color_pp[2] & MASK_COLOR_BG_B2C;
         graphic_fg_pixel = 1;
       break;
     case 0x03:
-        pixel1 = g_fg_color_p[g_window_video_cnt] & MASK_COLOR_MTM;
+        pixel1 = g_vic.fg_color_p[g_vic.window_video_cnt] & MASK_COLOR_MTM;
         graphic_fg_pixel = 1;
       break;
     default:
       pixel1 = 0;
     }
 
-    if(g_sprite_present_on_current_line)
+    if(g_vic.sprite_present_on_current_line)
     {
-      if(*g_pixel_sprite_mapping_p)
+      if(*g_vic.pixel_sprite_mapping_p)
       {
         sprite_fg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
         sprite_bg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
@@ -1954,7 +2137,7 @@ static inline void output_pixel_MTM()
 
         if(graphic_fg_pixel)
         {
-          sg_coll_detected(*g_pixel_sprite_mapping_p);
+          sg_coll_detected(*g_vic.pixel_sprite_mapping_p);
         }
       }
       else
@@ -1964,31 +2147,28 @@ static inline void output_pixel_MTM()
       }
     }
 
-    *g_layer_addr_p++ = pixel1;
-#ifdef SCREEN_X2
-    *g_layer_addr_p++ = pixel1;
-#endif
+    *g_vic.layer_addr_p++ = pixel1;
 
-    g_pixel_sprite_mapping_p++;
-    g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-    g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-    g_window_bit_cnt++;
+    g_vic.pixel_sprite_mapping_p++;
+    g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+    g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+    g_vic.window_bit_cnt++;
   }
   else
   {
-    if((g_dot_matrix >> (7 - g_window_bit_cnt)) & 0x1)
+    if((g_vic.dot_matrix >> (7 - g_vic.window_bit_cnt)) & 0x1)
     {
-      pixel1 = g_fg_color_p[g_window_video_cnt] & MASK_COLOR_MTM;
+      pixel1 = g_vic.fg_color_p[g_vic.window_video_cnt] & MASK_COLOR_MTM;
       graphic_fg_pixel = 1;
     }
     else
     {
-      pixel1 = *g_bg_color_pp[0] & MASK_COLOR_BG_B0C;
+      pixel1 = *g_vic.bg_color_pp[0] & MASK_COLOR_BG_B0C;
     }
 
-    if(g_sprite_present_on_current_line)
+    if(g_vic.sprite_present_on_current_line)
     {
-      if(*g_pixel_sprite_mapping_p)
+      if(*g_vic.pixel_sprite_mapping_p)
       {
         sprite_fg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
         sprite_bg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
@@ -2004,7 +2184,7 @@ static inline void output_pixel_MTM()
 
         if(graphic_fg_pixel)
         {
-          sg_coll_detected(*g_pixel_sprite_mapping_p);
+          sg_coll_detected(*g_vic.pixel_sprite_mapping_p);
         }
       }
       else
@@ -2014,15 +2194,12 @@ static inline void output_pixel_MTM()
       }
     }
 
-    *g_layer_addr_p++ = pixel1;
-#ifdef SCREEN_X2
-    *g_layer_addr_p++ = pixel1;
-#endif
+    *g_vic.layer_addr_p++ = pixel1;
 
-    g_pixel_sprite_mapping_p++;
-    g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-    g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-    g_window_bit_cnt++;
+    g_vic.pixel_sprite_mapping_p++;
+    g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+    g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+    g_vic.window_bit_cnt++;
   }
 }
 
@@ -2033,19 +2210,19 @@ static inline void output_pixel_SBM()
   uint8_t sprite_bg_pixel1 = SPRITE_NONE;
   uint8_t graphic_fg_pixel = 0;
   
-  if((g_dot_matrix >> (7 - g_window_bit_cnt)) & 0x1)
+  if((g_vic.dot_matrix >> (7 - g_vic.window_bit_cnt)) & 0x1)
   {
-    pixel1 = g_dot_matrix_color >> 4;
+    pixel1 = g_vic.dot_matrix_color >> 4;
     graphic_fg_pixel = 1;
   }
   else
   {
-    pixel1 = g_dot_matrix_color & 0x0F;
+    pixel1 = g_vic.dot_matrix_color & 0x0F;
   }
 
-  if(g_sprite_present_on_current_line)
+  if(g_vic.sprite_present_on_current_line)
   {
-    if(*g_pixel_sprite_mapping_p)
+    if(*g_vic.pixel_sprite_mapping_p)
     {
       sprite_fg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
       sprite_bg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
@@ -2061,7 +2238,7 @@ static inline void output_pixel_SBM()
 
       if(graphic_fg_pixel)
       {
-        sg_coll_detected(*g_pixel_sprite_mapping_p);
+        sg_coll_detected(*g_vic.pixel_sprite_mapping_p);
       }
     }
     else
@@ -2071,15 +2248,12 @@ static inline void output_pixel_SBM()
     }
   }
 
-  *g_layer_addr_p++ = pixel1;
-#ifdef SCREEN_X2
-  *g_layer_addr_p++ = pixel1;
-#endif
+  *g_vic.layer_addr_p++ = pixel1;
 
-  g_pixel_sprite_mapping_p++;
-  g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-  g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-  g_window_bit_cnt++;
+  g_vic.pixel_sprite_mapping_p++;
+  g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+  g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+  g_vic.window_bit_cnt++;
 }
 
 static inline void output_pixel_MBM()
@@ -2088,36 +2262,36 @@ static inline void output_pixel_MBM()
   uint8_t sprite_fg_pixel1 = SPRITE_NONE;
   uint8_t sprite_bg_pixel1 = SPRITE_NONE;
   uint8_t graphic_fg_pixel = 0;
-  uint8_t window_bit_cnt = g_window_bit_cnt;
+  uint8_t window_bit_cnt = g_vic.window_bit_cnt;
 
   if(window_bit_cnt & 0x01)
   {
     window_bit_cnt--;
   }
 
-  switch((g_dot_matrix >> (6 - window_bit_cnt)) & 0x3)
+  switch((g_vic.dot_matrix >> (6 - window_bit_cnt)) & 0x3)
   {
   case 0x00:
-      pixel1 = *g_bg_color_pp[0] & MASK_COLOR_BG_B0C;
+      pixel1 = *g_vic.bg_color_pp[0] & MASK_COLOR_BG_B0C;
     break;
   case 0x01:
-      pixel1 = g_dot_matrix_color >> 4;
+      pixel1 = g_vic.dot_matrix_color >> 4;
     break;
   case 0x02:
-      pixel1 = g_dot_matrix_color & 0x0F;
+      pixel1 = g_vic.dot_matrix_color & 0x0F;
       graphic_fg_pixel = 1;
     break;
   case 0x03:
-      pixel1 = g_fg_color_p[g_window_video_cnt] & 0x0F;
+      pixel1 = g_vic.fg_color_p[g_vic.window_video_cnt] & 0x0F;
       graphic_fg_pixel = 1;
     break;
   default:
     pixel1 = 0;
   }
 
-  if(g_sprite_present_on_current_line)
+  if(g_vic.sprite_present_on_current_line)
   {
-    if(*g_pixel_sprite_mapping_p)
+    if(*g_vic.pixel_sprite_mapping_p)
     {
       sprite_fg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
       sprite_bg_pixel1 = *g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
@@ -2133,7 +2307,7 @@ static inline void output_pixel_MBM()
 
       if(graphic_fg_pixel)
       {
-        sg_coll_detected(*g_pixel_sprite_mapping_p);
+        sg_coll_detected(*g_vic.pixel_sprite_mapping_p);
       }
     }
     else
@@ -2143,50 +2317,88 @@ static inline void output_pixel_MBM()
     }
   }
 
-  *g_layer_addr_p++ = pixel1;
-#ifdef SCREEN_X2
-  *g_layer_addr_p++ = pixel1;
-#endif
+  *g_vic.layer_addr_p++ = pixel1;
 
-  g_pixel_sprite_mapping_p++;
-  g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-  g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-  g_window_bit_cnt++;
+  g_vic.pixel_sprite_mapping_p++;
+  g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+  g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+  g_vic.window_bit_cnt++;
 }
 
 static inline void output_pixel_BORDER_EXT()
 {
-  uint8_t color = *g_border_color_p & MASK_COLOR_BORDER_EC;
+  uint8_t color = *g_vic.border_color_p & MASK_COLOR_BORDER_EC;
 
   /*
    * Dont forget about the sprites, otherwise they will be
    * off in position if extended borders are used.
    */
-  if(g_sprite_present_on_current_line)
+  if(g_vic.sprite_present_on_current_line)
   {
     g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
     g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
   }
 
-  *g_layer_addr_p++ = color;
-#ifdef SCREEN_X2
-  *g_layer_addr_p++ = color;
-#endif
+  *g_vic.layer_addr_p++ = color;
 
-  g_pixel_sprite_mapping_p++;
-  g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-  g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-  g_window_bit_cnt++;
+  g_vic.pixel_sprite_mapping_p++;
+  g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+  g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+  g_vic.window_bit_cnt++;
 }
 
 static inline void output_pixel_BORDER()
 {
-  uint8_t color = *g_border_color_p & MASK_COLOR_BORDER_EC;
+  uint8_t color = *g_vic.border_color_p & MASK_COLOR_BORDER_EC;
+
+  *g_vic.layer_addr_p++ = color;
+}
+
+static inline void output_line_done()
+{
+  /* Line is complete, let scaler put it in layer */
+  if(!g_vic.line_hidden)
+  {
+    scale_line(g_layer_addr_start_p, g_line_a, (int32_t)g_vic.screen_line_cnt - LINE_DISP_WIND_START);
+  }
+  else if(g_vic.line_skipped && g_prev_layer_addr_start_p != g_layer_addr_start_p)
+  {
+    /* Other field, line from previous frame is still valid */
+    scale_copy_line(g_layer_addr_start_p, g_prev_layer_addr_start_p, (int32_t)g_vic.screen_line_cnt - LINE_DISP_WIND_START);
+  }
+  g_vic.layer_addr_p = g_line_a;
+}
+
+static inline void output_line_BORDER()
+{
+  if(!g_vic.line_hidden)
+  {
+    memset(g_line_a, *g_vic.border_color_p & MASK_COLOR_BORDER_EC, FORGROUND_WIDTH);
+  }
+  output_line_done();
+}
+
+static inline void output_pixel_NONE()
+{
+  /* Nothing is plotted, only check for collisions with fg graphics */
+  if(g_vic.sprite_present_on_current_line &&
+     *g_vic.pixel_sprite_mapping_p &&
+     ((g_vic.fg_mask >> (7 - g_vic.window_bit_cnt)) & 0x1))
+  {
+    sg_coll_detected(*g_vic.pixel_sprite_mapping_p);
+  }
+
+  if(g_vic.sprite_present_on_current_line)
+  {
+    g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
+    g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
+  }
 
-  *g_layer_addr_p++ = color;
-#ifdef SCREEN_X2
-  *g_layer_addr_p++ = color;
-#endif
+  g_vic.layer_addr_p++; /* Keep position for pixels that are rendered */
+  g_vic.pixel_sprite_mapping_p++;
+  g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+  g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+  g_vic.window_bit_cnt++;
 }
 
 static inline void output_pixel_BAD()
@@ -2194,21 +2406,18 @@ static inline void output_pixel_BAD()
   uint8_t color;
   color = 0;
 
-  if(g_sprite_present_on_current_line)
+  if(g_vic.sprite_present_on_current_line)
   {
     g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND]++;
     g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND]++;
   }
 
-  *g_layer_addr_p++ = color;
-#ifdef SCREEN_X2
-  *g_layer_addr_p++ = color;
-#endif
+  *g_vic.layer_addr_p++ = color;
 
-  g_pixel_sprite_mapping_p++;
-  g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-  g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
-  g_window_bit_cnt++;
+  g_vic.pixel_sprite_mapping_p++;
+  g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+  g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
+  g_vic.window_bit_cnt++;
 }
 
 static uint8_t calc_fps(uint32_t time_now, uint32_t time_start)
@@ -2221,25 +2430,25 @@ void vic_init()
   uint32_t i;
 
   /* Populate pointers */
-  g_crom_p = g_memory.crom_p + OFFSET_CROM;
-  g_ram_p = g_memory.ram_p + OFFSET_RAM;
-  g_border_color_p = g_memory.io_p + REG_COLOR_BORDER;
-  g_fg_color_p = g_memory.io_p + OFFSET_COLOR_RAM;
-  g_bg_color_pp[0] = g_memory.io_p + REG_COLOR_BG_0;
-  g_bg_color_pp[1] = g_memory.io_p + REG_COLOR_BG_1;
-  g_bg_color_pp[2] = g_memory.io_p + REG_COLOR_BG_2;
-  g_bg_color_pp[3] = g_memory.io_p + REG_COLOR_BG_3;
+  g_vic.crom_p = g_memory.crom_p + OFFSET_CROM;
+  g_vic.ram_p = g_memory.ram_p + OFFSET_RAM;
+  g_vic.border_color_p = g_memory.io_p + REG_COLOR_BORDER;
+  g_vic.fg_color_p = g_memory.io_p + OFFSET_COLOR_RAM;
+  g_vic.bg_color_pp[0] = g_memory.io_p + REG_COLOR_BG_0;
+  g_vic.bg_color_pp[1] = g_memory.io_p + REG_COLOR_BG_1;
+  g_vic.bg_color_pp[2] = g_memory.io_p + REG_COLOR_BG_2;
+  g_vic.bg_color_pp[3] = g_memory.io_p + REG_COLOR_BG_3;
 
   /* Set initial variables */
-  g_vic_state = VIC_STATE_VERTICAL_BLANKING;
-  g_screen_line_cnt = 0;
-  g_screen_line_ucycle_cnt = 0;
-  g_ucycles_in_queue = 0;
-  g_graphic_mode = GRAPHIC_MODE_STM;
+  g_vic.vic_state = VIC_STATE_VERTICAL_BLANKING;
+  g_vic.screen_line_cnt = 0;
+  g_vic.screen_line_ucycle_cnt = 0;
+  g_vic.ucycles_in_queue = 0;
+  g_vic.graphic_mode = GRAPHIC_MODE_STM;
   g_frames_until_stats = NO_OF_FRAMES_STATS;
   g_frames_until_lock = NO_OF_FRAMES_LOCK;
-  g_x_scroll = 0;
-  g_y_scroll = 3;
+  g_vic.x_scroll = 0;
+  g_vic.y_scroll = 3;
 
   /* Clear sprite memory */
   for(i = 0; i < LINE_MAX * PIXELS_MAX; i++)
@@ -2346,13 +2555,14 @@ void vic_init()
 
 void vic_set_bank(uint8_t value) /* Called by CIA2 that is subscribing for 0xDD00 */
 {
-  g_bank = (~value) & 0x3;
+  g_vic.bank = (~value) & 0x3;
 }
 
 void vic_set_layer(uint8_t *layer_addr_p)
 {
-  g_layer_addr_p = layer_addr_p;
+  g_vic.layer_addr_p = g_line_a;
   g_layer_addr_start_p = layer_addr_p;
+  g_prev_layer_addr_start_p = NULL; /* Content of new layer is unknown */
 }
 
 void vic_set_memory(uint8_t *mem_addr_p, vic_mem_sprite_t vic_mem_sprite)
@@ -2365,7 +2575,7 @@ void vic_set_memory(uint8_t *mem_addr_p, vic_mem_sprite_t vic_mem_sprite)
       g_sprite_layer_addr_start_aap[vic_mem_sprite] = mem_addr_p;
       break;
     case VIC_MEM_SPRITE_MAP:
-      g_pixel_sprite_mapping_p = (uint8_t *)mem_addr_p;
+      g_vic.pixel_sprite_mapping_p = (uint8_t *)mem_addr_p;
       g_pixel_sprite_mapping_start_p = (uint8_t *)mem_addr_p;
       break;
     default:
@@ -2405,33 +2615,33 @@ void vic_set_memory(uint8_t *mem_addr_p, vic_mem_sprite_t vic_mem_sprite)
 void vic_step(uint32_t cc)
 {
   uint32_t go_again = 0;
-  g_ucycles_in_queue += cc * UCYCLE_PER_PIXEL * 8;
+  g_vic.ucycles_in_queue += cc * UCYCLE_PER_PIXEL * 8;
 
 GO_AGAIN:
 
-  switch(g_vic_state)
+  switch(g_vic.vic_state)
   {
     case VIC_STATE_HOLD:
     {
-      if(g_ucycles_in_queue >= UCYCLES_LINE)
+      if(g_vic.ucycles_in_queue >= UCYCLES_LINE)
       {
-        g_screen_line_cnt++;
-        g_ucycles_in_queue -= UCYCLES_LINE;
+        g_vic.screen_line_cnt++;
+        g_vic.ucycles_in_queue -= UCYCLES_LINE;
 
         new_line();
 
         /* Doubtful if this is needed */
-        /*if(((g_screen_line_cnt & 0x7) == g_y_scroll) &&
-          g_screen_line_cnt >= LINE_DISP_WIND_START &&
-          g_screen_line_cnt < LINE_BORD_LOWER_START &&
-          g_DEN)
+        /*if(((g_vic.screen_line_cnt & 0x7) == g_vic.y_scroll) &&
+          g_vic.screen_line_cnt >= LINE_DISP_WIND_START &&
+          g_vic.screen_line_cnt < LINE_BORD_LOWER_START &&
+          g_vic.DEN)
         {
-          g_ucycles_in_queue += UCYCLES_BAD_LINE;
+          g_vic.ucycles_in_queue += UCYCLES_BAD_LINE;
         }*/
 
-        if(g_screen_line_cnt == (LINE_MAX - 1))
+        if(g_vic.screen_line_cnt == (LINE_MAX - 1))
         {
-          g_vic_state = VIC_STATE_VERTICAL_BLANKING;
+          g_vic.vic_state = VIC_STATE_VERTICAL_BLANKING;
         }
       }
     }
@@ -2439,39 +2649,39 @@ GO_AGAIN:
     /* 28 lines are blanking lines (300 to 15) */
     case VIC_STATE_VERTICAL_BLANKING:
     {
-      if(g_ucycles_in_queue >= UCYCLES_LINE)
+      if(g_vic.ucycles_in_queue >= UCYCLES_LINE)
       {
-        g_screen_line_cnt++;
-        g_ucycles_in_queue -= UCYCLES_LINE;
+        g_vic.screen_line_cnt++;
+        g_vic.ucycles_in_queue -= UCYCLES_LINE;
 
-        if(g_screen_line_cnt == LINE_MAX)
+        if(g_vic.screen_line_cnt == LINE_MAX)
         {
-          g_screen_line_cnt = 0;
-          g_window_video_base_cnt = 0;
-          g_window_line_cnt = 0;
-          g_window_text_line_cnt = 0;
-          g_window_row_cnt = 0;
+          g_vic.screen_line_cnt = 0;
+          g_vic.window_video_base_cnt = 0;
+          g_vic.window_line_cnt = 0;
+          g_vic.window_text_line_cnt = 0;
+          g_vic.window_row_cnt = 0;
 
           new_frame();
 
           if(g_full_frame_rate)
           {
-            g_display_frame = 1;
+            g_vic.display_frame = 1;
           }
           else
           {
-            g_display_frame = !g_display_frame;
-            if(g_display_frame == 0)
+            g_vic.display_frame = !g_vic.display_frame;
+            if(g_vic.display_frame == 0)
             {
               /* Skipping one frame ... */
-              g_vic_state = VIC_STATE_HOLD;
+              g_vic.vic_state = VIC_STATE_HOLD;
               new_line(); /* Do not forget to report line */
               break;
             }
           }
 
           /* Reset the memory pointer to which pixels are drawn */
-          g_layer_addr_p = g_layer_addr_start_p;
+          g_vic.layer_addr_p = g_line_a;
 
           /* Set the sprite layer so that it points to the very first pixel in display window */
           /* TODO: change when supporting sprites on whole screen */
@@ -2482,40 +2692,30 @@ GO_AGAIN:
           g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND] = g_sprite_layer_addr_start_aap[VIC_MEM_SPRITE_BACKGROUND] +
                                                            LINE_DISP_WIND_START * PIXELS_MAX +
                                                            PIXEL_DISP_WIND_START;
-          g_pixel_sprite_mapping_p = g_pixel_sprite_mapping_start_p + LINE_DISP_WIND_START * PIXELS_MAX + PIXEL_DISP_WIND_START;
+          g_vic.pixel_sprite_mapping_p = g_pixel_sprite_mapping_start_p + LINE_DISP_WIND_START * PIXELS_MAX + PIXEL_DISP_WIND_START;
         }
 
         new_line();
 
         /* Last vblank line is 15 */
-        if(g_screen_line_cnt == LINE_BORD_UPPER_START)
+        if(g_vic.screen_line_cnt == LINE_BORD_UPPER_START)
         {
-          g_vic_state = VIC_STATE_VERTICAL_UPPER_BORDER;
+          g_vic.vic_state = VIC_STATE_VERTICAL_UPPER_BORDER;
         }
       }
     }
     break;
     case VIC_STATE_VERTICAL_UPPER_BORDER:
     {
-      if(g_ucycles_in_queue >= UCYCLES_LINE)
+      if(g_vic.ucycles_in_queue >= UCYCLES_LINE)
       {
-#ifdef HAVE_BORDERS
+        if(scale_get_borders())
         {
-          uint32_t i;
-
-          for(i = 0; i < FORGROUND_WIDTH; i++)
-          {
-            output_pixel_BORDER();
-          }
+          output_line_BORDER();
         }
 
-#ifdef SCREEN_X2
-        g_layer_addr_p += FORGROUND_WIDTH*2;
-#endif
-#endif
-
-        g_screen_line_cnt++;
-        g_ucycles_in_queue -= UCYCLES_LINE;
+        g_vic.screen_line_cnt++;
+        g_vic.ucycles_in_queue -= UCYCLES_LINE;
 
         new_line();
 
@@ -2526,15 +2726,15 @@ GO_AGAIN:
         handle_sprite_redraw_queue();
 
         /* Bad line condition can happen if 0x30 >= line <=0xF7 */
-        if(g_screen_line_cnt == LINE_BAD_LOWER_COND)
+        if(g_vic.screen_line_cnt == LINE_BAD_LOWER_COND)
         {
-          g_vic_state = VIC_STATE_VERTICAL_WAIT_BAD_LINE;
+          g_vic.vic_state = VIC_STATE_VERTICAL_WAIT_BAD_LINE;
 
           /*
            * Set the counter so that next state can know both when a line is done and
            * when the 14 cycle mark is crossed.
            */
-          g_wait_bad_line_cnt = 0; /* 9 * 7 = 63 cycles */
+          g_vic.wait_bad_line_cnt = 0; /* 9 * 7 = 63 cycles */
         }
       }
     }
@@ -2542,64 +2742,54 @@ GO_AGAIN:
     case VIC_STATE_VERTICAL_WAIT_BAD_LINE: /* This state is only for bad lines outside of display window! */
     {
       /* Lets step 7 cycles at a time to speed things up */
-      while(g_ucycles_in_queue >= UCYCLES_BAD_LINE_WAIT)
+      while(g_vic.ucycles_in_queue >= UCYCLES_BAD_LINE_WAIT)
       {
-        g_ucycles_in_queue -= UCYCLES_BAD_LINE_WAIT;
-        g_wait_bad_line_cnt++;
+        g_vic.ucycles_in_queue -= UCYCLES_BAD_LINE_WAIT;
+        g_vic.wait_bad_line_cnt++;
 
         /*
          * In the first phase of cycle 14 of each line, VC is loaded from VCBASE
          * (VCBASE->VC) and VMLI is cleared. If there is a Bad Line Condition in
          * this phase, RC is also reset to zero.
          */
-        if(g_wait_bad_line_cnt == 2)
+        if(g_vic.wait_bad_line_cnt == 2)
         {
-          g_window_video_cnt = g_window_video_base_cnt; /* (VCBASE->VC) */
+          g_vic.window_video_cnt = g_vic.window_video_base_cnt; /* (VCBASE->VC) */
 
           /* Bad line condition */
-          if(((g_screen_line_cnt & 0x7) == g_y_scroll) &&
-             g_DEN)
+          if(((g_vic.screen_line_cnt & 0x7) == g_vic.y_scroll) &&
+             g_vic.DEN)
           {
-            g_window_text_line_cnt++;
-            g_window_row_cnt = 0;
+            g_vic.window_text_line_cnt++;
+            g_vic.window_row_cnt = 0;
             new_text_line();
 
             /* Give 40 cycles extra to vic itself */
-            g_ucycles_in_queue += UCYCLES_BAD_LINE;
+            g_vic.ucycles_in_queue += UCYCLES_BAD_LINE;
           }
         }
 
-        if(g_wait_bad_line_cnt == 9)
+        if(g_vic.wait_bad_line_cnt == 9)
         {
-#ifdef HAVE_BORDERS
+          if(scale_get_borders())
           {
-            uint32_t i;
-
-            for(i = 0; i < FORGROUND_WIDTH; i++)
-            {
-              output_pixel_BORDER();
-            }
+            output_line_BORDER();
           }
 
-#ifdef SCREEN_X2
-          g_layer_addr_p += FORGROUND_WIDTH*2;
-#endif
-#endif
-
-          g_wait_bad_line_cnt = 0; /* 9 * 7 = 63 cycles */
-          g_screen_line_cnt++;
-          g_window_row_cnt++;
+          g_vic.wait_bad_line_cnt = 0; /* 9 * 7 = 63 cycles */
+          g_vic.screen_line_cnt++;
+          g_vic.window_row_cnt++;
 
           new_line();
 
           handle_sprite_redraw_queue();
 
           /* Last upper border line is 50 */
-          if(g_screen_line_cnt == LINE_DISP_WIND_START)
+          if(g_vic.screen_line_cnt == LINE_DISP_WIND_START)
           {
-            g_vic_state = VIC_STATE_HORIZONTAL_LEFT_BLANKING;
+            g_vic.vic_state = VIC_STATE_HORIZONTAL_LEFT_BLANKING;
 
-            if(!g_RSEL)
+            if(!g_vic.RSEL)
             {
               /*
                * If display is set to 24 lines (RSEL=0) then line 51 to 54
@@ -2608,12 +2798,12 @@ GO_AGAIN:
                * so that when entering the display window the border will be
                * rendered instead of the "real" curent graphic mode.
                */
-              g_RSEL_active = 1;
+              g_vic.RSEL_active = 1;
               graphic_mode();
             }
             else
             {
-              g_RSEL_active = 0;
+              g_vic.RSEL_active = 0;
               graphic_mode();
             }
 
@@ -2626,34 +2816,34 @@ GO_AGAIN:
     break;
     case VIC_STATE_HORIZONTAL_LEFT_BLANKING:
     {
-      while(g_ucycles_in_queue >= UCYCLE_PER_PIXEL)
+      while(g_vic.ucycles_in_queue >= UCYCLE_PER_PIXEL)
       {
-        g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-        g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
+        g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+        g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
 
-        if(g_RSEL_active && (g_screen_line_cnt == LINE_EXT_UPPER_BORD))
+        if(g_vic.RSEL_active && (g_vic.screen_line_cnt == LINE_EXT_UPPER_BORD))
         {
           /*
            * At line 55 the display should always be rendered using the
            * "real" current graphic mode regardless of RSEL.
            */
-          g_RSEL_active = 0;
+          g_vic.RSEL_active = 0;
           graphic_mode();
         }
 
-        if(!g_RSEL && (g_screen_line_cnt == LINE_EXT_LOWER_BORD))
+        if(!g_vic.RSEL && (g_vic.screen_line_cnt == LINE_EXT_LOWER_BORD))
         {
           /*
            * At line 247 the display should be rendered as border if
            * RSEL is 0.
            */
-          g_RSEL_active = 1;
+          g_vic.RSEL_active = 1;
           graphic_mode();
         }
 
-        if(g_screen_line_ucycle_cnt == PIXEL_LEFT_BORD_START * UCYCLE_PER_PIXEL)
+        if(g_vic.screen_line_ucycle_cnt == PIXEL_LEFT_BORD_START * UCYCLE_PER_PIXEL)
         {
-          g_vic_state = VIC_STATE_HORIZONTAL_LEFT_BORDER;
+          g_vic.vic_state = VIC_STATE_HORIZONTAL_LEFT_BORDER;
 
           go_again = 1; /* Might have more cycles to spend! */
           break;
@@ -2663,63 +2853,68 @@ GO_AGAIN:
     break;
     case VIC_STATE_HORIZONTAL_LEFT_BORDER:
     {
-      while(g_ucycles_in_queue >= UCYCLE_PER_PIXEL)
+      while(g_vic.ucycles_in_queue >= UCYCLE_PER_PIXEL)
       {
-#ifdef HAVE_BORDERS
-        if(g_screen_line_ucycle_cnt >= (PIXEL_LEFT_BORD_START + 4) * UCYCLE_PER_PIXEL)
+        if(g_vic.screen_line_ucycle_cnt >= PIXEL_FORGROUND_START * UCYCLE_PER_PIXEL)
         {
-          output_pixel_BORDER();
+          if(pixel_visible())
+          {
+            output_pixel_BORDER();
+          }
+          else
+          {
+            g_vic.layer_addr_p++;
+          }
         }
-#endif
-        g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-        g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
+        g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+        g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
 
         /* At cycle 14 VC is loaded and if bad line, then RC is set to zero */
-        if(g_screen_line_ucycle_cnt == PIXEL_BAD_LINE_CHECK * UCYCLE_PER_PIXEL)
+        if(g_vic.screen_line_ucycle_cnt == PIXEL_BAD_LINE_CHECK * UCYCLE_PER_PIXEL)
         {
-          g_window_video_cnt = g_window_video_base_cnt;
+          g_vic.window_video_cnt = g_vic.window_video_base_cnt;
 
           /* Bad line condition */
-          if((g_screen_line_cnt <= LINE_BAD_UPPER_COND) &&
-            ((g_screen_line_cnt & 0x7) == g_y_scroll) &&
-            g_DEN)
+          if((g_vic.screen_line_cnt <= LINE_BAD_UPPER_COND) &&
+            ((g_vic.screen_line_cnt & 0x7) == g_vic.y_scroll) &&
+            g_vic.DEN)
           {
-            g_window_text_line_cnt++;
-            g_window_row_cnt = 0;
+            g_vic.window_text_line_cnt++;
+            g_vic.window_row_cnt = 0;
             new_text_line();
 
             /* Give 40 cycles extra to vic itself */
-            g_ucycles_in_queue += UCYCLES_BAD_LINE;
+            g_vic.ucycles_in_queue += UCYCLES_BAD_LINE;
           }
 
           handle_sprite_redraw_queue();
 
           /* If sprites present, then get memory pointers and refresh them if needed */
-          if(g_sprite_presence_a[g_screen_line_cnt])
+          if(g_sprite_presence_a[g_vic.screen_line_cnt])
           {
-            g_sprite_present_on_current_line = 1;
+            g_vic.sprite_present_on_current_line = 1;
             new_sprite_line();
             refresh_sprites();
 
             /* Vic will steal 2 cycles for every sprite on this row */
-            g_ucycles_in_queue += __builtin_popcount(g_sprite_presence_a[g_screen_line_cnt]) * UCYCLE_BAD_SPRITE;
+            g_vic.ucycles_in_queue += __builtin_popcount(g_sprite_presence_a[g_vic.screen_line_cnt]) * UCYCLE_BAD_SPRITE;
           }
           else
           {
-            g_sprite_present_on_current_line = 0;
+            g_vic.sprite_present_on_current_line = 0;
           }
         }
 
-        if(g_screen_line_ucycle_cnt == PIXEL_DISP_WIND_START * UCYCLE_PER_PIXEL)
+        if(g_vic.screen_line_ucycle_cnt == PIXEL_DISP_WIND_START * UCYCLE_PER_PIXEL)
         {
-          g_vic_state = VIC_STATE_DISPLAY_WINDOW;
+          g_vic.vic_state = VIC_STATE_DISPLAY_WINDOW;
 
           /*
            * If CSEL=0 the left border is extended by 7 pixels and the
            * right one by 9 pixels. However, since xscroll may also print
            * some extra border pixels so take that into account here.
            */
-          if(!g_CSEL && !g_RSEL_active)
+          if(!g_vic.CSEL && !g_vic.RSEL_active)
           {
             uint32_t i;
 
@@ -2728,24 +2923,24 @@ GO_AGAIN:
               output_pixel_BORDER_EXT();
             }
 
-            g_window_bit_cnt -= g_x_scroll;
+            g_vic.window_bit_cnt -= g_vic.x_scroll;
           }
           /*
            * Make x scroll function by skipping some pixels in the start
            * of the line in display window. The pixels still needs to be
            * rendered of course, but the bit counter is not incremented.
            */
-          else if(g_x_scroll != 0)
+          else if(g_vic.x_scroll != 0)
           {
             uint32_t i;
 
-            uint8_t window_bit_cnt_saved = g_window_bit_cnt;
-            for(i = 0; i < g_x_scroll; i++)
+            uint8_t window_bit_cnt_saved = g_vic.window_bit_cnt;
+            for(i = 0; i < g_vic.x_scroll; i++)
             {
                 /* Update pixel */
                 OUTPUT_PIXEL();
             }
-            g_window_bit_cnt = window_bit_cnt_saved;
+            g_vic.window_bit_cnt = window_bit_cnt_saved;
           }
 
           LOAD_DOT_MATRIX();
@@ -2757,31 +2952,31 @@ GO_AGAIN:
     break;
     case VIC_STATE_DISPLAY_WINDOW:
     {
-      while(g_ucycles_in_queue >= UCYCLE_PER_PIXEL)
+      while(g_vic.ucycles_in_queue >= UCYCLE_PER_PIXEL)
       {
         /* Update pixel */
         OUTPUT_PIXEL();
 
         /* Column change */
-        if(g_window_bit_cnt == CHAR_HORIZONTAL_LENGTH)
+        if(g_vic.window_bit_cnt == CHAR_HORIZONTAL_LENGTH)
         {
-          g_window_bit_cnt = 0;
+          g_vic.window_bit_cnt = 0;
 
           /* VC and VMLI are incremented after each g-access in display state */
-          g_window_video_cnt++;
-          g_window_text_line_char_cnt++;
+          g_vic.window_video_cnt++;
+          g_vic.window_text_line_char_cnt++;
 
           /* AKA g-access */
           LOAD_DOT_MATRIX();
         }
 
-        if(!g_CSEL && !g_RSEL_active)
+        if(!g_vic.CSEL && !g_vic.RSEL_active)
         {
-          if(g_screen_line_ucycle_cnt == (PIXEL_RIGHT_BORD_START - PIXELS_EXT_RIGHT_BORD) * UCYCLE_PER_PIXEL)
+          if(g_vic.screen_line_ucycle_cnt == (PIXEL_RIGHT_BORD_START - PIXELS_EXT_RIGHT_BORD) * UCYCLE_PER_PIXEL)
           {
             uint32_t i;
 
-            g_vic_state = VIC_STATE_HORIZONTAL_RIGHT_BORDER;
+            g_vic.vic_state = VIC_STATE_HORIZONTAL_RIGHT_BORDER;
 
             for(i = 0; i < PIXELS_EXT_RIGHT_BORD; i++)
             {
@@ -2795,11 +2990,11 @@ GO_AGAIN:
              * the last increment of video counter and tile counter will not happen.
              * It is needed to be done here.
              */
-            if(g_window_bit_cnt != 0 && (g_window_video_cnt % 40 != 0))
+            if(g_vic.window_bit_cnt != 0 && (g_vic.window_video_cnt % 40 != 0))
             {
-              g_window_bit_cnt = 0;
-              g_window_video_cnt += 2;
-              g_window_text_line_char_cnt += 2;
+              g_vic.window_bit_cnt = 0;
+              g_vic.window_video_cnt += 2;
+              g_vic.window_text_line_char_cnt += 2;
             }
 
             go_again = 1; /* Might have more cycles to spend! */
@@ -2807,18 +3002,18 @@ GO_AGAIN:
           }
         }
 
-        if(g_screen_line_ucycle_cnt == PIXEL_RIGHT_BORD_START * UCYCLE_PER_PIXEL)
+        if(g_vic.screen_line_ucycle_cnt == PIXEL_RIGHT_BORD_START * UCYCLE_PER_PIXEL)
         {
-          g_vic_state = VIC_STATE_HORIZONTAL_RIGHT_BORDER;
+          g_vic.vic_state = VIC_STATE_HORIZONTAL_RIGHT_BORDER;
 
           /*
            * See below comment at same condition.
            */
-          if(g_window_bit_cnt != 0 && (g_window_video_cnt % 40 != 0))
+          if(g_vic.window_bit_cnt != 0 && (g_vic.window_video_cnt % 40 != 0))
           {
-            g_window_bit_cnt = 0;
-            g_window_video_cnt++; 
-            g_window_text_line_char_cnt++;
+            g_vic.window_bit_cnt = 0;
+            g_vic.window_video_cnt++; 
+            g_vic.window_text_line_char_cnt++;
           }
 
           go_again = 1; /* Might have more cycles to spend! */
@@ -2829,26 +3024,31 @@ GO_AGAIN:
     break;
     case VIC_STATE_HORIZONTAL_RIGHT_BORDER:
     {
-      while(g_ucycles_in_queue >= UCYCLE_PER_PIXEL)
+      while(g_vic.ucycles_in_queue >= UCYCLE_PER_PIXEL)
       {
-#ifdef HAVE_BORDERS
-        output_pixel_BORDER();
-#endif
-        g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-        g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
+        if(pixel_visible())
+        {
+          output_pixel_BORDER();
+        }
+        else
+        {
+          g_vic.layer_addr_p++;
+        }
+        g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+        g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
 
         /* At cycle 58 vic checks RC == 7, if so then VCBASE is loaded from VC */
-        if(g_screen_line_ucycle_cnt == PIXEL_LOAD_VCBASE * UCYCLE_PER_PIXEL)
+        if(g_vic.screen_line_ucycle_cnt == PIXEL_LOAD_VCBASE * UCYCLE_PER_PIXEL)
         {
-          if(g_window_row_cnt == 7)
+          if(g_vic.window_row_cnt == 7)
           {
-            g_window_video_base_cnt = g_window_video_cnt;
+            g_vic.window_video_base_cnt = g_vic.window_video_cnt;
           }
         }
 
-        if(g_screen_line_ucycle_cnt == PIXEL_RIGHT_BLANK_START * UCYCLE_PER_PIXEL)
+        if(g_vic.screen_line_ucycle_cnt == PIXEL_RIGHT_BLANK_START * UCYCLE_PER_PIXEL)
         {
-          g_vic_state = VIC_STATE_HORIZONTAL_RIGHT_BLANKING;
+          g_vic.vic_state = VIC_STATE_HORIZONTAL_RIGHT_BLANKING;
           go_again = 1; /* Might have more cycles to spend! */
           break;
         }
@@ -2857,67 +3057,48 @@ GO_AGAIN:
     break;
     case VIC_STATE_HORIZONTAL_RIGHT_BLANKING:
     {
-      while(g_ucycles_in_queue >= UCYCLE_PER_PIXEL)
+      while(g_vic.ucycles_in_queue >= UCYCLE_PER_PIXEL)
       {
-        g_screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
-        g_ucycles_in_queue -= UCYCLE_PER_PIXEL;
+        g_vic.screen_line_ucycle_cnt += UCYCLE_PER_PIXEL;
+        g_vic.ucycles_in_queue -= UCYCLE_PER_PIXEL;
 
-        if(g_screen_line_ucycle_cnt == PIXELS_MAX * UCYCLE_PER_PIXEL) /* New line */
+        if(g_vic.screen_line_ucycle_cnt == PIXELS_MAX * UCYCLE_PER_PIXEL) /* New line */
         {
-          g_screen_line_ucycle_cnt = 0;
-          g_window_bit_cnt = 0;
-          g_screen_line_cnt++;
-          g_window_text_line_char_cnt = 0;
+          output_line_done();
+
+          g_vic.screen_line_ucycle_cnt = 0;
+          g_vic.window_bit_cnt = 0;
+          g_vic.screen_line_cnt++;
+          g_vic.window_text_line_char_cnt = 0;
 
           new_line();
 
-          g_window_line_cnt++;
+          g_vic.window_line_cnt++;
 
           /* Last display line is 250 */
-          if(g_screen_line_cnt == LINE_BORD_LOWER_START)
+          if(g_vic.screen_line_cnt == LINE_BORD_LOWER_START)
           {
-            g_vic_state = VIC_STATE_VERTICAL_LOWER_BORDER;
-
-
-#ifdef HAVE_BORDERS
-#ifdef SCREEN_X2
-            g_layer_addr_p += FORGROUND_WIDTH*2;
-#else
-            g_layer_addr_p += FORGROUND_WIDTH;
-#endif
-#endif
+            g_vic.vic_state = VIC_STATE_VERTICAL_LOWER_BORDER;
 
             go_again = 0;
             break;
           }
           else
           {
-            g_vic_state = VIC_STATE_HORIZONTAL_LEFT_BLANKING;
+            g_vic.vic_state = VIC_STATE_HORIZONTAL_LEFT_BLANKING;
             /* window row counter AKA RC is incremented if in display state */
-            g_window_row_cnt++;
-
-#ifdef SCREEN_X2
-#ifdef HAVE_BORDERS
-            g_layer_addr_p += FORGROUND_WIDTH*2;
-#else
-            g_layer_addr_p = g_layer_addr_start_p +
-                                                        (g_screen_line_cnt*2 - LINE_DISP_WIND_START*2) * FORGROUND_WIDTH*2;
-#endif
-#else
-            g_layer_addr_p = g_layer_addr_start_p +
-                                                        (g_screen_line_cnt - LINE_DISP_WIND_START) * FORGROUND_WIDTH;
-#endif
+            g_vic.window_row_cnt++;
 
             /* Set the sprite layer so that it points to the very first pixel for the current line in display window */
             g_sprite_layer_addr_aap[VIC_MEM_SPRITE_FORGROUND] = g_sprite_layer_addr_start_aap[VIC_MEM_SPRITE_FORGROUND] +
-                                                             g_screen_line_cnt * PIXELS_MAX +
+                                                             g_vic.screen_line_cnt * PIXELS_MAX +
                                                              PIXEL_DISP_WIND_START;
 
             g_sprite_layer_addr_aap[VIC_MEM_SPRITE_BACKGROUND] = g_sprite_layer_addr_start_aap[VIC_MEM_SPRITE_BACKGROUND] +
-                                                             g_screen_line_cnt * PIXELS_MAX +
+                                                             g_vic.screen_line_cnt * PIXELS_MAX +
                                                              PIXEL_DISP_WIND_START;
 
-            g_pixel_sprite_mapping_p = g_pixel_sprite_mapping_start_p + g_screen_line_cnt * PIXELS_MAX + PIXEL_DISP_WIND_START;
+            g_vic.pixel_sprite_mapping_p = g_pixel_sprite_mapping_start_p + g_vic.screen_line_cnt * PIXELS_MAX + PIXEL_DISP_WIND_START;
 
             go_again = 1; /* Might have more cycles to spend! */
             break;
@@ -2928,43 +3109,185 @@ GO_AGAIN:
     break;
     case VIC_STATE_VERTICAL_LOWER_BORDER:
     {
-      if(g_ucycles_in_queue >= UCYCLES_LINE)
+      if(g_vic.ucycles_in_queue >= UCYCLES_LINE)
       {
-#ifdef HAVE_BORDERS
+        if(scale_get_borders())
         {
-          uint32_t i;
-
-          for(i = 0; i < FORGROUND_WIDTH; i++)
-          {
-            output_pixel_BORDER();
-          }
+          output_line_BORDER();
         }
 
-#ifdef SCREEN_X2
-        g_layer_addr_p += FORGROUND_WIDTH*2;
-#endif
-#endif
-        g_screen_line_cnt++;
-        g_ucycles_in_queue -= UCYCLES_LINE;
+        g_vic.screen_line_cnt++;
+        g_vic.ucycles_in_queue -= UCYCLES_LINE;
 
         new_line();
 
         /* Last lower border line is 299 */
-        if(g_screen_line_cnt == LINE_BLANK_START)
+        if(g_vic.screen_line_cnt == LINE_BLANK_START)
         {
-          g_vic_state = VIC_STATE_VERTICAL_BLANKING;
+          g_vic.vic_state = VIC_STATE_VERTICAL_BLANKING;
         }
       }
     }
     break;
   }
 
-  if(go_again && (g_ucycles_in_queue > 0))
+  if(go_again && (g_vic.ucycles_in_queue > 0))
   {
     goto GO_AGAIN;
   }
 }
 
+void vic_set_render(uint8_t active)
+{
+  g_vic.render_off = !active;
+  g_prev_layer_addr_start_p = NULL; /* Nothing rendered while off */
+  update_line_hidden();
+}
+
+void vic_set_viewport(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+  /* Clip to forground, an empty viewport means nothing is rendered */
+  if(x > FORGROUND_WIDTH)
+  {
+    x = FORGROUND_WIDTH;
+  }
+  if(y > FORGROUND_HEIGHT)
+  {
+    y = FORGROUND_HEIGHT;
+  }
+  if(width > FORGROUND_WIDTH - x)
+  {
+    width = FORGROUND_WIDTH - x;
+  }
+  if(height > FORGROUND_HEIGHT - y)
+  {
+    height = FORGROUND_HEIGHT - y;
+  }
+
+  g_vic.view_ucycle_start = (PIXEL_FORGROUND_START + x) * UCYCLE_PER_PIXEL;
+  g_vic.view_ucycle_len = width * UCYCLE_PER_PIXEL;
+  g_vic.view_cropped_x = width != FORGROUND_WIDTH;
+  g_view_line_start = LINE_FORGROUND_START + y;
+  g_view_line_end = LINE_FORGROUND_START + y + height;
+  update_line_hidden();
+}
+
+void vic_set_interlace(uint8_t active)
+{
+  g_interlace = active;
+  g_prev_layer_addr_start_p = NULL; /* First frame is rendered in full */
+}
+
+void vic_log_set_active(uint8_t active)
+{
+  g_log_active = active;
+
+  /* No frame is complete until one frame has passed */
+  g_log_a[0].cnt = 0;
+  g_log_a[0].overflow = 1;
+  g_log_a[1].cnt = 0;
+  g_log_a[1].overflow = 1;
+  if(active)
+  {
+    log_new_frame();
+  }
+
+  bus_event_write_log_subscribe(active ? log_write : NULL);
+}
+
+/*
+ * Gives the writes that happened on a raster line in last
+ * complete frame. Returns number of entries.
+ */
+uint32_t vic_log_get_line(uint32_t line, vic_log_entry_t **entries_pp)
+{
+  vic_log_t *log_p = &g_log_a[!g_log_current];
+  uint32_t low = 0;
+  uint32_t high = log_p->cnt;
+  uint32_t mid;
+  uint32_t first;
+
+  /* Binary search for first entry on line */
+  while(low < high)
+  {
+    mid = (low + high) / 2;
+    if(log_p->entries_a[mid].cycle < line * VIC_LOG_CYCLES_LINE)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  first = low;
+
+  high = log_p->cnt;
+  while(low < high && log_p->entries_a[low].cycle < (line + 1) * VIC_LOG_CYCLES_LINE)
+  {
+    low++;
+  }
+
+  *entries_pp = &log_p->entries_a[first];
+  return low - first;
+}
+
+vic_log_snapshot_t *vic_log_get_snapshot()
+{
+  return &g_log_a[!g_log_current].snapshot;
+}
+
+uint8_t vic_log_get_overflow()
+{
+  return g_log_a[!g_log_current].overflow;
+}
+
+/*
+ * Decodes the video matrix that vic currently points at (bank and $D018)
+ * into ASCII without rendering anything. Each row is terminated by a
+ * newline and the whole text by null. Reversed characters are given as
+ * normal ones and graphic characters as '#'.
+ */
+void vic_get_text(char *text_p)
+{
+  uint8_t *screen_ram_p = g_memory.ram_p + (g_vic.bank << 14) + g_screen_ram_offset;
+  uint8_t lower_case = (g_vic.char_gen_offset & 0x0800) != 0; /* Odd character set */
+  uint32_t row;
+  uint32_t column;
+  uint8_t code;
+
+  for(row = 0; row < VIC_TEXT_ROWS; row++)
+  {
+    for(column = 0; column < VIC_TEXT_COLUMNS; column++)
+    {
+      code = *screen_ram_p++ & 0x7F;
+
+      if(lower_case && code >= 0x01 && code <= 0x1A)
+      {
+        *text_p++ = 'a' + code - 0x01;
+      }
+      else if(code < 0x20)
+      {
+        *text_p++ = '@' + code;
+      }
+      else if(code < 0x40)
+      {
+        *text_p++ = code;
+      }
+      else if(lower_case && code >= 0x41 && code <= 0x5A)
+      {
+        *text_p++ = code;
+      }
+      else
+      {
+        *text_p++ = '#';
+      }
+    }
+    *text_p++ = '\n';
+  }
+  *text_p = '\0';
+}
+
 void vic_set_half_frame_rate()
 {
     g_full_frame_rate = 0;
@@ -346,11 +346,45 @@ typedef enum
     VIC_MEM_MAX
 } vic_mem_sprite_t;
 
+/* SCREEN TEXT */
+
+#define VIC_TEXT_COLUMNS            40
+#define VIC_TEXT_ROWS               25
+
+/* REGISTER WRITE LOG */
+
+#define VIC_LOG_ENTRIES_MAX         2048
+#define VIC_LOG_REGS                0x2F
+#define VIC_LOG_COLOR_RAM_SIZE      1000
+#define VIC_LOG_CYCLES_LINE         63
+
+typedef struct
+{
+  uint16_t cycle; /* Cycle in frame, i.e. raster line * 63 + cycle in line */
+  uint16_t addr; /* $D000-$D3FF, $D800-$DBFF or $DD00 */
+  uint8_t value;
+} vic_log_entry_t;
+
+typedef struct
+{
+  uint8_t regs_a[VIC_LOG_REGS]; /* $D000-$D02E */
+  uint8_t bank; /* $DD00 */
+  uint8_t color_ram_a[VIC_LOG_COLOR_RAM_SIZE];
+} vic_log_snapshot_t;
+
 void vic_set_layer(uint8_t *layer_addr_p);
 void vic_set_memory(uint8_t *mem_addr_p, vic_mem_sprite_t vic_mem_sprite);
 void vic_set_bank(uint8_t value);
 void vic_init();
 void vic_step(uint32_t cc);
+void vic_set_render(uint8_t active);
+void vic_set_viewport(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+void vic_set_interlace(uint8_t active);
+void vic_log_set_active(uint8_t active);
+uint32_t vic_log_get_line(uint32_t line, vic_log_entry_t **entries_pp);
+vic_log_snapshot_t *vic_log_get_snapshot();
+uint8_t vic_log_get_overflow();
+void vic_get_text(char *text_p);
 void vic_set_half_frame_rate();
 void vic_set_full_frame_rate();
 void vic_unlock_frame_rate();
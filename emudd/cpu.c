@@ -1769,12 +1769,23 @@ void cpu_dd_reset()
 
 void cpu_dd_boot()
 {
-  while(((uint32_t)g_cpu.PC & 0xFFFF) != 0xEC9B)
+  while(cpu_dd_get_pc() != DOS_IDLE_LOOP)
   {
     (void)cpu_dd_step();
   }
 }
 
+uint16_t cpu_dd_get_pc()
+{
+  return (uint32_t)g_cpu.PC & 0xFFFF;
+}
+
+/* SO pin, used by byte ready */
+void cpu_dd_set_overflow()
+{
+  g_cpu.SR |= FLAG_OVERFLOW;
+}
+
 void cpu_dd_init()
 {
   reset(RST_VECTOR);
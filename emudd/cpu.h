@@ -28,9 +28,13 @@
 
 #define INTR_IRQ  0x1
 
+#define DOS_IDLE_LOOP   0xEC9B /* Passed every round of the dos main loop */
+
 uint32_t cpu_dd_step();
 void cpu_dd_reset();
 void cpu_dd_boot();
+void cpu_dd_set_overflow();
+uint16_t cpu_dd_get_pc();
 void cpu_dd_init();
 void cpu_jump_to_emu_addr(uint16_t addr);
 
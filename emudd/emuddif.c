@@ -33,15 +33,32 @@
 #include "cpu.h"
 #include "if.h"
 #include "fdd.h"
+#include "gcr.h"
 
 void if_emu_dd_mem_set(uint8_t *mem_p, if_mem_dd_type_t mem_type);
 void if_emu_dd_op_init();
 void if_emu_dd_op_run(int32_t cycles);
 void if_emu_dd_op_reset();
-void if_emu_dd_disk_drive_load(uint32_t *fd_p);
+uint8_t if_emu_dd_op_sleeping();
+uint32_t if_emu_dd_op_cycles();
+void if_emu_dd_disk_drive_load(uint32_t *fd_p, uint8_t write_protect);
+void if_emu_dd_disk_drive_poll();
+uint8_t if_emu_dd_disk_drive_gcr(uint8_t active);
+uint8_t *if_emu_dd_disk_drive_read_sector(uint8_t track, uint8_t sector);
+uint8_t if_emu_dd_disk_drive_write_sector(uint8_t track, uint8_t sector, uint8_t *data_p);
 void if_emu_dd_ports_write_serial(uint8_t data);
 
+#define DOS_ATN_PENDING     0x7C
+#define JOB_QUEUE_SIZE      5
+#define MASK_JOB_PENDING    0x80
+#define SERIAL_LINES_UNKNOWN 0xFF /* Not a valid write, next one always wakes */
+
+extern memory_dd_t g_memory_dd; /* Memory interface */
+
 static int32_t g_cycle_queue;
+static uint32_t g_cycle_cnt;
+static uint8_t g_sleeping; /* Waits in dos idle loop until serial bus changes */
+static uint8_t g_serial_last; /* Lines last written by cc */
 
 if_emu_dd_t g_if_dd_emu =
 {
@@ -51,10 +68,16 @@ if_emu_dd_t g_if_dd_emu =
   {
     if_emu_dd_op_init,
     if_emu_dd_op_run,
-    if_emu_dd_op_reset
+    if_emu_dd_op_reset,
+    if_emu_dd_op_sleeping,
+    if_emu_dd_op_cycles
   },
   {
-    if_emu_dd_disk_drive_load
+    if_emu_dd_disk_drive_load,
+    if_emu_dd_disk_drive_poll,
+    if_emu_dd_disk_drive_gcr,
+    if_emu_dd_disk_drive_read_sector,
+    if_emu_dd_disk_drive_write_sector
   },
   {
     if_emu_dd_ports_write_serial
@@ -70,7 +93,40 @@ void if_emu_dd_mem_set(uint8_t *mem_p, if_mem_dd_type_t mem_type)
     case IF_MEM_DD_TYPE_UTIL2:
       bus_dd_set_memory(mem_p, (memory_bank_dd_t)mem_type);
       break;
+    case IF_MEM_DD_TYPE_DISK:
+      fdd_set_memory(mem_p);
+      break;
+    case IF_MEM_DD_TYPE_GCR:
+      gcr_set_memory(mem_p);
+      break;
+}
 }
+
+/*
+ * Nothing can happen in the drive before the computer talks to it when
+ * the dos is in its idle loop with no atn pending, no job queued and
+ * the motor and led off.
+ */
+static uint8_t idle()
+{
+  uint8_t i;
+
+  if(g_memory_dd.all_p[DOS_ATN_PENDING] != 0 ||
+     (g_memory_dd.all_p[REG_VIA1_IRQ_STATUS] & MASK_VIA_IRQ_STATUS_ATN) ||
+     (g_memory_dd.all_p[REG_VIA2_DATA_PORTB] & (MASK_VIA2_PORTB_MOTOR | MASK_VIA2_PORTB_LED)))
+  {
+    return 0;
+  }
+
+  for(i = 0; i < JOB_QUEUE_SIZE; i++)
+  {
+    if(g_memory_dd.all_p[i] & MASK_JOB_PENDING)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
 }
 
 void if_emu_dd_op_init()
@@ -78,16 +134,26 @@ void if_emu_dd_op_init()
   bus_dd_init();
   via_init();
   cpu_dd_init();
+  gcr_init();
   fdd_init();
 
   /* Lets boot it up a bit before halting */
   cpu_dd_boot();
+  g_sleeping = 0;
+  g_serial_last = SERIAL_LINES_UNKNOWN;
 }
 
 void if_emu_dd_op_run(int32_t cycles)
 {
   uint32_t cc = 0;
 
+  /* Time asleep is not caught up, it only passes */
+  if(g_sleeping)
+  {
+    g_cycle_cnt += cycles;
+    return;
+  }
+
   g_cycle_queue += cycles;
 
   while(g_cycle_queue > 0)
@@ -95,8 +161,22 @@ void if_emu_dd_op_run(int32_t cycles)
     cc = cpu_dd_step();
 
     via_step(cc);
+    gcr_step(cc);
 
     g_cycle_queue -= cc;
+    g_cycle_cnt += cc;
+
+    if(cpu_dd_get_pc() == DOS_IDLE_LOOP && idle())
+    {
+      /* Rest of slice passes asleep, counter must still match cc */
+      g_sleeping = 1;
+      if(g_cycle_queue > 0)
+      {
+        g_cycle_cnt += g_cycle_queue;
+      }
+      g_cycle_queue = 0;
+      break;
+    }
   }
 }
 
@@ -105,14 +185,57 @@ void if_emu_dd_op_reset()
   cpu_dd_reset();
   /* Lets boot it up a bit before halting */
   cpu_dd_boot();
+  g_sleeping = 0;
 }
 
-void if_emu_dd_disk_drive_load(uint32_t *fd_p)
+uint8_t if_emu_dd_op_sleeping()
 {
-  fdd_insert_disk(fd_p);
+  return g_sleeping;
+}
+
+uint32_t if_emu_dd_op_cycles()
+{
+  return g_cycle_cnt;
+}
+
+void if_emu_dd_disk_drive_load(uint32_t *fd_p, uint8_t write_protect)
+{
+  fdd_insert_disk(fd_p, write_protect);
+}
+
+void if_emu_dd_disk_drive_poll()
+{
+  fdd_poll();
+}
+
+uint8_t if_emu_dd_disk_drive_gcr(uint8_t active)
+{
+  return fdd_set_gcr(active);
+}
+
+uint8_t *if_emu_dd_disk_drive_read_sector(uint8_t track, uint8_t sector)
+{
+  return fdd_get_sector(track, sector);
+}
+
+uint8_t if_emu_dd_disk_drive_write_sector(uint8_t track, uint8_t sector, uint8_t *data_p)
+{
+  if(!fdd_write_sector(track, sector, data_p))
+  {
+    return 0;
+  }
+
+  gcr_invalidate(track);
+  return 1;
 }
 
 void if_emu_dd_ports_write_serial(uint8_t data)
 {
+  /* Writes of cia2 port a that keep the lines (e.g. vic bank) do not wake */
+  if(data != g_serial_last)
+  {
+    g_serial_last = data;
+    g_sleeping = 0;
+  }
   via_serial_port_activity(data);
 }
@@ -27,12 +27,24 @@
  * is probably not correct. However, it seems to work with games
  * that are not doing any tricky stuff (like uploading and executing
  * custom code on the disk drive.
+ *
+ * The whole disk image is read into memory when inserted, so a sector
+ * job is only a copy and never waits for the file system. Written
+ * sectors are marked dirty and written back from fdd_poll, in file
+ * order and as few writes as possible, once the drive has been idle
+ * for a while or when the disk is removed.
+ *
+ * For custom drive code the short cut can be replaced by GCR level
+ * emulation, see gcr.c. g64 images are only supported that way.
  */
 
 #include "fdd.h"
 #include "bus.h"
 #include "cpu.h"
+#include "gcr.h"
+#include "via.h"
 #include "if.h"
+#include <string.h>
 
 /*
   Bytes: $00-1F: First directory entry
@@ -90,6 +102,9 @@
 #define CBM_COMMAND_READ_SECTOR_HEADER_AND_EXEC_CODE    0xE0
 #define CBM_COMMAND_READ_SECTOR_HEADER                  0xF0
 
+#define JOB_STATUS_OK                                   0x01
+#define JOB_STATUS_WRITE_PROTECT                        0x08
+
 #define REG_TRACK_BUFFER_0        0x06
 #define REG_SECTOR_BUFFER_0       0x07
 #define REG_TRACK_BUFFER_1        0x08
@@ -108,12 +123,22 @@
 #define ADDRESS_HIGH_BUFFER_4     0x04
 
 #define SECTOR_SIZE               0x100
+#define TRACKS_MAX                40
+#define SECTORS_MAX               768 /* 40 tracks */
+#define FLUSH_IDLE_MS             1000
+
+/* Valid image sizes, with or without one error byte per sector */
+#define D64_SIZE_35               174848
+#define D64_SIZE_35_ERRORS        175531
+#define D64_SIZE_40               196608
+#define D64_SIZE_40_ERRORS        197376
 
 static void event_write_cbm(uint16_t addr, uint8_t value);
 
 typedef struct
 {
   uint32_t offset;
+  uint8_t sectors;
 } track_t;
 
 extern memory_dd_t g_memory_dd; /* Memory interface */
@@ -121,51 +146,119 @@ extern if_host_t g_if_host; /* Main interface */
 
 static track_t g_tracks[41] =
 {
-  {0x000000}, // track start at 1, not 0
-  {0x000000}, // 1
-  {0x001500}, // 2
-  {0x002A00}, // 3
-  {0x003F00}, // 4
-  {0x005400}, // 5
-  {0x006900}, // 6
-  {0x007E00}, // 7
-  {0x009300}, // 8
-  {0x00A800}, // 9
-  {0x00BD00}, // 10
-  {0x00D200}, // 11
-  {0x00E700}, // 12
-  {0x00FC00}, // 13
-  {0x011100}, // 14
-  {0x012600}, // 15
-  {0x013B00}, // 16
-  {0x015000}, // 17
-  {0x016500}, // 18
-  {0x017800}, // 19
-  {0x018B00}, // 20
-  {0x019E00}, // 21
-  {0x01B100}, // 22
-  {0x01C400}, // 23
-  {0x01D700}, // 24
-  {0x01EA00}, // 25
-  {0x01FC00}, // 26
-  {0x020E00}, // 27
-  {0x022000}, // 28
-  {0x023200}, // 29
-  {0x024400}, // 30
-  {0x025600}, // 31
-  {0x026700}, // 32
-  {0x027800}, // 33
-  {0x028900}, // 34
-  {0x029A00}, // 35
-  {0x02AB00}, // 36
-  {0x02BC00}, // 37
-  {0x02CD00}, // 38
-  {0x02DE00}, // 39
-  {0x02EF00}, // 40
+  {0x000000, 0}, // track start at 1, not 0
+  {0x000000, 21}, // 1
+  {0x001500, 21}, // 2
+  {0x002A00, 21}, // 3
+  {0x003F00, 21}, // 4
+  {0x005400, 21}, // 5
+  {0x006900, 21}, // 6
+  {0x007E00, 21}, // 7
+  {0x009300, 21}, // 8
+  {0x00A800, 21}, // 9
+  {0x00BD00, 21}, // 10
+  {0x00D200, 21}, // 11
+  {0x00E700, 21}, // 12
+  {0x00FC00, 21}, // 13
+  {0x011100, 21}, // 14
+  {0x012600, 21}, // 15
+  {0x013B00, 21}, // 16
+  {0x015000, 21}, // 17
+  {0x016500, 19}, // 18
+  {0x017800, 19}, // 19
+  {0x018B00, 19}, // 20
+  {0x019E00, 19}, // 21
+  {0x01B100, 19}, // 22
+  {0x01C400, 19}, // 23
+  {0x01D700, 19}, // 24
+  {0x01EA00, 18}, // 25
+  {0x01FC00, 18}, // 26
+  {0x020E00, 18}, // 27
+  {0x022000, 18}, // 28
+  {0x023200, 18}, // 29
+  {0x024400, 18}, // 30
+  {0x025600, 17}, // 31
+  {0x026700, 17}, // 32
+  {0x027800, 17}, // 33
+  {0x028900, 17}, // 34
+  {0x029A00, 17}, // 35
+  {0x02AB00, 17}, // 36
+  {0x02BC00, 17}, // 37
+  {0x02CD00, 17}, // 38
+  {0x02DE00, 17}, // 39
+  {0x02EF00, 17}, // 40
 };
 
 static uint8_t g_command = 0;
 static uint32_t *g_file_p;
+static uint8_t *g_disk_p; /* Disk image, given by host */
+static uint32_t g_disk_size; /* Zero when no image is inserted */
+static uint8_t g_disk_tracks;
+static uint8_t g_disk_g64;
+static uint8_t g_write_protect; /* File could only be opened for reading, or g64 */
+static uint32_t g_dirty_a[SECTORS_MAX / 32]; /* One bit per sector in file order */
+static uint8_t g_dirty;
+static uint32_t g_dirty_ms; /* Time of last write */
+
+static uint8_t *sector_get(uint8_t track, uint8_t sector)
+{
+  if(track == 0 || track > g_disk_tracks || sector >= g_tracks[track].sectors)
+  {
+    return NULL;
+  }
+
+  return g_disk_p + g_tracks[track].offset + sector * SECTOR_SIZE;
+}
+
+static void sector_mark_dirty(uint8_t *sector_p)
+{
+  uint32_t index = (sector_p - g_disk_p) / SECTOR_SIZE;
+
+  g_dirty_a[index / 32] |= 1 << (index % 32);
+  g_dirty = 1;
+  g_dirty_ms = g_if_host.if_host_time.time_get_ms_fp();
+}
+
+static uint8_t sector_dirty(uint32_t index)
+{
+  return (g_dirty_a[index / 32] >> (index % 32)) & 0x1;
+}
+
+static void flush()
+{
+  uint32_t sectors = g_tracks[g_disk_tracks].offset / SECTOR_SIZE + g_tracks[g_disk_tracks].sectors;
+  uint32_t first;
+  uint32_t index = 0;
+  uint32_t length;
+
+  while(index < sectors)
+  {
+    if(!sector_dirty(index))
+    {
+      index++;
+      continue;
+    }
+
+    /* Neighbouring dirty sectors are written at once */
+    first = index;
+    while(index < sectors && sector_dirty(index))
+    {
+      index++;
+    }
+    length = (index - first) * SECTOR_SIZE;
+
+    g_if_host.if_host_filesys.filesys_seek_fp(g_file_p, first * SECTOR_SIZE);
+    if(g_if_host.if_host_filesys.filesys_write_fp(g_file_p, g_disk_p + first * SECTOR_SIZE, length) != length)
+    {
+      g_if_host.if_host_printer.print_fp("(DD) Error writing disk file!", PRINT_TYPE_ERROR);
+      break;
+    }
+  }
+
+  g_if_host.if_host_filesys.filesys_flush_fp(g_file_p);
+  memset(g_dirty_a, 0, sizeof(g_dirty_a));
+  g_dirty = 0;
+}
 
 static void event_write_cbm(uint16_t addr, uint8_t value)
 {
@@ -186,12 +279,14 @@ static void event_write_cbm(uint16_t addr, uint8_t value)
         g_memory_dd.all_p[buffer] = 0x01;
         break;
       case CBM_COMMAND_READ_SECTOR:
+      case CBM_COMMAND_WRITE_SECTOR:
       case CBM_COMMAND_READ_SECTOR_HEADER_AND_EXEC_CODE:
       case CBM_COMMAND_READ_SECTOR_HEADER:
       case CBM_COMMAND_EXEC_CODE:
       {
         uint8_t buffer_low = 0;
         uint16_t buffer_pointer = 0;
+        uint8_t status = JOB_STATUS_OK;
 
         switch(buffer)
         {
@@ -244,20 +339,43 @@ static void event_write_cbm(uint16_t addr, uint8_t value)
             break;
         }
 
-        g_if_host.if_host_filesys.filesys_seek_fp(g_file_p, g_tracks[track].offset + sector * SECTOR_SIZE);
-
         g_memory_dd.all_p[0x3f] = buffer; /* Previous work place in queue (0 - 5) */
         g_memory_dd.all_p[0x4c] = sector; /* Last read sector */
 
         if(g_command == CBM_COMMAND_READ_SECTOR)
         {
-          uint32_t bytes_read;
+          uint8_t *sector_p = sector_get(track, sector);
           g_if_host.if_host_stats.stats_led_fp(0);
-          bytes_read = g_if_host.if_host_filesys.filesys_read_fp(g_file_p, &g_memory_dd.all_p[buffer_pointer], 0x100);
-          if(bytes_read != 0x100)
+          if(sector_p == NULL)
           {
             g_if_host.if_host_printer.print_fp("(DD) Error reading disk file!", PRINT_TYPE_ERROR);
           }
+          else
+          {
+            memcpy(&g_memory_dd.all_p[buffer_pointer], sector_p, SECTOR_SIZE);
+          }
+          g_if_host.if_host_stats.stats_led_fp(1);
+        }
+
+        if(g_command == CBM_COMMAND_WRITE_SECTOR)
+        {
+          uint8_t *sector_p = sector_get(track, sector);
+          g_if_host.if_host_stats.stats_led_fp(0);
+          if(sector_p == NULL)
+          {
+            g_if_host.if_host_printer.print_fp("(DD) Error writing disk file!", PRINT_TYPE_ERROR);
+          }
+          else if(g_write_protect)
+          {
+            /* Dos checks the sense line before, this is for custom code */
+            status = JOB_STATUS_WRITE_PROTECT;
+          }
+          else
+          {
+            memcpy(sector_p, &g_memory_dd.all_p[buffer_pointer], SECTOR_SIZE);
+            sector_mark_dirty(sector_p);
+            gcr_invalidate(track);
+          }
           g_if_host.if_host_stats.stats_led_fp(1);
         }
 
@@ -269,7 +387,7 @@ static void event_write_cbm(uint16_t addr, uint8_t value)
           g_memory_dd.all_p[0x19] = sector;
         }
 
-        g_memory_dd.all_p[buffer] = 0x01;
+        g_memory_dd.all_p[buffer] = status;
 
         if(g_command == CBM_COMMAND_READ_SECTOR_HEADER_AND_EXEC_CODE ||
           g_command == CBM_COMMAND_EXEC_CODE)
@@ -279,9 +397,6 @@ static void event_write_cbm(uint16_t addr, uint8_t value)
         }
       }
       break;
-    case CBM_COMMAND_WRITE_SECTOR:
-      g_memory_dd.all_p[buffer] = 0x01;
-      break;
     case CBM_COMMAND_VERIFY_SECTOR:
       g_memory_dd.all_p[buffer] = 0x01;
       break;
@@ -294,14 +409,145 @@ static void event_write_cbm(uint16_t addr, uint8_t value)
 
 void fdd_init()
 {
-    bus_dd_event_write_subscribe(0x0000, event_write_cbm);
-    bus_dd_event_write_subscribe(0x0001, event_write_cbm);
-    bus_dd_event_write_subscribe(0x0002, event_write_cbm);
-    bus_dd_event_write_subscribe(0x0003, event_write_cbm);
-    bus_dd_event_write_subscribe(0x0004, event_write_cbm);
+  if(g_write_protect)
+  {
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] &= ~MASK_VIA2_PORTB_WR_PROTECT;
+  }
+  fdd_set_gcr(gcr_get_active());
 }
 
-void fdd_insert_disk(uint32_t *fd_p)
+uint8_t fdd_set_gcr(uint8_t active)
 {
+  uint16_t addr;
+
+  /* g64 images can only be read at gcr level */
+  if(g_disk_g64)
+  {
+    active = 1;
+  }
+
+  for(addr = ADDRESS_HIGH_BUFFER_0; addr <= ADDRESS_HIGH_BUFFER_4; addr++)
+  {
+    if(active)
+    {
+      bus_dd_event_write_unsubscribe(addr, event_write_cbm);
+    }
+    else
+    {
+      bus_dd_event_write_subscribe(addr, event_write_cbm);
+    }
+  }
+
+  gcr_set_active(active);
+
+  return active;
+}
+
+void fdd_insert_disk(uint32_t *fd_p, uint8_t write_protect)
+{
+  uint32_t size;
+
+  /* Old disk must be written back before it is let go */
+  gcr_eject();
+  if(g_dirty)
+  {
+    flush();
+  }
+
   g_file_p = fd_p;
+  g_disk_size = 0;
+  g_disk_tracks = 0;
+  g_disk_g64 = 0;
+  g_write_protect = write_protect;
+  if(g_write_protect)
+  {
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] &= ~MASK_VIA2_PORTB_WR_PROTECT;
+  }
+  else
+  {
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] |= MASK_VIA2_PORTB_WR_PROTECT; /* Not protected */
+  }
+
+  if(g_file_p == NULL || g_disk_p == NULL)
+  {
+    return;
+  }
+
+  g_if_host.if_host_filesys.filesys_seek_fp(g_file_p, 0);
+  size = g_if_host.if_host_filesys.filesys_read_fp(g_file_p, g_disk_p, IF_MEMORY_DD_DISK_SIZE);
+
+  if(gcr_insert_g64(g_disk_p, size))
+  {
+    g_disk_g64 = 1;
+    g_write_protect = 1;
+    g_disk_size = size;
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] &= ~MASK_VIA2_PORTB_WR_PROTECT;
+    fdd_set_gcr(1);
+    g_if_host.if_host_printer.print_fp("(DD) g64 image, gcr mode on", PRINT_TYPE_INFO);
+    return;
+  }
+
+  switch(size)
+  {
+    case D64_SIZE_35:
+    case D64_SIZE_35_ERRORS:
+      g_disk_tracks = 35;
+      break;
+    case D64_SIZE_40:
+    case D64_SIZE_40_ERRORS:
+      g_disk_tracks = TRACKS_MAX;
+      break;
+    default:
+      g_if_host.if_host_printer.print_fp("(DD) Unknown disk file size!", PRINT_TYPE_ERROR);
+      return;
+  }
+
+  g_disk_size = size;
+}
+
+void fdd_poll()
+{
+  if(g_dirty &&
+     g_if_host.if_host_time.time_get_ms_fp() - g_dirty_ms > FLUSH_IDLE_MS)
+  {
+    flush();
+  }
+}
+
+uint8_t *fdd_get_sector(uint8_t track, uint8_t sector)
+{
+  return sector_get(track, sector);
+}
+
+uint8_t fdd_get_sectors(uint8_t track)
+{
+  if(track == 0 || track > g_disk_tracks)
+  {
+    return 0;
+  }
+
+  return g_tracks[track].sectors;
+}
+
+uint8_t fdd_write_sector(uint8_t track, uint8_t sector, uint8_t *data_p)
+{
+  uint8_t *sector_p = sector_get(track, sector);
+
+  if(sector_p == NULL || g_write_protect)
+  {
+    return 0;
+  }
+
+  if(memcmp(sector_p, data_p, SECTOR_SIZE) != 0)
+  {
+    memcpy(sector_p, data_p, SECTOR_SIZE);
+    sector_mark_dirty(sector_p);
+  }
+
+  return 1;
+}
+
+void fdd_set_memory(uint8_t *mem_p)
+{
+  g_disk_p = mem_p;
 }
@@ -28,6 +28,12 @@
 #include "emuddif.h"
 
 void fdd_init();
-void fdd_insert_disk(uint32_t *fd_p);
+void fdd_insert_disk(uint32_t *fd_p, uint8_t write_protect);
+void fdd_set_memory(uint8_t *mem_p);
+void fdd_poll();
+uint8_t fdd_set_gcr(uint8_t active);
+uint8_t *fdd_get_sector(uint8_t track, uint8_t sector);
+uint8_t fdd_get_sectors(uint8_t track);
+uint8_t fdd_write_sector(uint8_t track, uint8_t sector, uint8_t *data_p);
 
 #endif
@@ -0,0 +1,555 @@
+/*
+ * memwa2 gcr component
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+/**
+ * GCR level disk emulation, used instead of the job queue short cut
+ * in fdd.c when active. The DOS, or code uploaded to the drive, then
+ * reads the disk through VIA2 as on the real thing. Every track is a
+ * stream of GCR bytes: d64 tracks are encoded into a cache the first
+ * time the head reaches them and g64 tracks are used as they are.
+ * The head passes one byte every 26-32 drive cycles depending on the
+ * density set in VIA2, so the cost is one table read per byte.
+ *
+ * Tracks written at GCR level are decoded back into the d64 image
+ * when the head leaves the track or the motor stops. g64 images are
+ * write protected.
+ */
+
+#include "gcr.h"
+#include "fdd.h"
+#include "bus.h"
+#include "via.h"
+#include "cpu.h"
+#include "if.h"
+#include <string.h>
+
+#define HALF_TRACKS_MAX           84
+#define HALF_TRACK_START          34 /* Track 18 */
+#define TRACK_SLOT_SIZE           0x2000 /* One d64 track in cache */
+#define TRACK_SLOTS               (IF_MEMORY_DD_GCR_SIZE / TRACK_SLOT_SIZE)
+#define BYTE_CYCLES_MAX           32 /* Lowest density */
+
+#define SYNC_SIZE                 5
+#define SYNC_BYTE                 0xFF
+#define GAP_BYTE                  0x55
+#define HEADER_GAP_SIZE           9
+#define HEADER_BLOCK_ID           0x08
+#define HEADER_BLOCK_SIZE         8
+#define DATA_BLOCK_ID             0x07
+#define DATA_BLOCK_SIZE           260
+#define SECTOR_SIZE               0x100
+
+#define BAM_TRACK                 18
+#define BAM_DISK_ID               0xA2
+
+#define G64_SIGNATURE             "GCR-1541"
+#define G64_SIGNATURE_SIZE        8
+#define G64_HALF_TRACKS           0x09
+#define G64_TRACK_OFFSETS         0x0C
+
+typedef struct
+{
+  uint8_t *data_p; /* NULL if not encoded or unformatted */
+  uint16_t length;
+} gcr_track_t;
+
+typedef struct
+{
+  uint8_t active;
+  uint8_t g64;
+  uint8_t half_track;
+  uint8_t motor;
+  uint8_t byte_cycles;
+  uint8_t last; /* Previous byte under head */
+  uint8_t written; /* Track under head has been written */
+  uint16_t pos;
+  uint32_t cycles;
+} gcr_t;
+
+extern memory_dd_t g_memory_dd; /* Memory interface */
+
+static const uint8_t g_encode_a[16] =
+{
+  0x0A, 0x0B, 0x12, 0x13, 0x0E, 0x0F, 0x16, 0x17,
+  0x09, 0x19, 0x1A, 0x1B, 0x0D, 0x1D, 0x1E, 0x15
+};
+
+/* Indexed by density, which depends on speed zone of track */
+static const uint16_t g_track_size_a[4] = {6250, 6666, 7142, 7692};
+static const uint8_t g_sector_gap_a[4] = {9, 12, 17, 8};
+
+static uint8_t g_decode_a[32];
+static gcr_track_t g_track_a[HALF_TRACKS_MAX];
+static uint8_t *g_cache_p; /* d64 tracks, given by host */
+static uint8_t g_slot_track_a[TRACK_SLOTS]; /* Track encoded in slot, 0 if free */
+static uint8_t g_slot_next; /* Slot to reuse next, oldest first */
+static gcr_t g_gcr;
+
+static uint8_t track_density(uint8_t track)
+{
+  if(track < 18)
+  {
+    return 3;
+  }
+  if(track < 25)
+  {
+    return 2;
+  }
+  if(track < 31)
+  {
+    return 1;
+  }
+  return 0;
+}
+
+/* Four bytes become five, size must be multiple of four */
+static uint8_t *encode(uint8_t *dst_p, uint8_t *src_p, uint32_t size)
+{
+  uint32_t bits = 0;
+  uint8_t count = 0;
+  uint32_t i;
+
+  for(i = 0; i < size * 2; i++)
+  {
+    bits = (bits << 5) | g_encode_a[(i & 1) ? src_p[i / 2] & 0x0F : src_p[i / 2] >> 4];
+    count += 5;
+    if(count >= 8)
+    {
+      count -= 8;
+      *dst_p++ = bits >> count;
+    }
+  }
+
+  return dst_p;
+}
+
+static uint8_t decode(uint8_t *dst_p, gcr_track_t *track_p, uint16_t pos, uint32_t size)
+{
+  uint32_t bits = 0;
+  uint8_t count = 0;
+  uint8_t nybble;
+  uint32_t i;
+
+  for(i = 0; i < size * 2; i++)
+  {
+    if(count < 5)
+    {
+      bits = (bits << 8) | track_p->data_p[pos];
+      pos = (pos + 1) % track_p->length;
+      count += 8;
+    }
+    count -= 5;
+
+    nybble = g_decode_a[(bits >> count) & 0x1F];
+    if(nybble == 0xFF)
+    {
+      return 0;
+    }
+
+    if(i & 1)
+    {
+      dst_p[i / 2] |= nybble;
+    }
+    else
+    {
+      dst_p[i / 2] = nybble << 4;
+    }
+  }
+
+  return 1;
+}
+
+static void encode_track(uint8_t track)
+{
+  gcr_track_t *track_p = &g_track_a[(track - 1) * 2];
+  uint8_t sectors = fdd_get_sectors(track);
+  uint8_t density = track_density(track);
+  uint8_t *bam_p = fdd_get_sector(BAM_TRACK, 0);
+  uint8_t block_a[DATA_BLOCK_SIZE];
+  uint8_t *dst_p;
+  uint8_t *sector_p;
+  uint8_t id1;
+  uint8_t id2;
+  uint8_t sector;
+  uint8_t slot;
+  uint16_t i;
+
+  if(g_cache_p == NULL || sectors == 0 || bam_p == NULL)
+  {
+    return;
+  }
+
+  /* Invalidated track keeps its slot, otherwise oldest track is dropped */
+  for(slot = 0; slot < TRACK_SLOTS && g_slot_track_a[slot] != track; slot++);
+  if(slot == TRACK_SLOTS)
+  {
+    slot = g_slot_next;
+    g_slot_next = (g_slot_next + 1) % TRACK_SLOTS;
+    if(g_slot_track_a[slot] != 0)
+    {
+      /* Written tracks are decoded when leaving them, so nothing is lost */
+      g_track_a[(g_slot_track_a[slot] - 1) * 2].data_p = NULL;
+    }
+    g_slot_track_a[slot] = track;
+  }
+
+  id1 = bam_p[BAM_DISK_ID];
+  id2 = bam_p[BAM_DISK_ID + 1];
+  dst_p = g_cache_p + slot * TRACK_SLOT_SIZE;
+  track_p->data_p = dst_p;
+  track_p->length = g_track_size_a[density];
+
+  for(sector = 0; sector < sectors; sector++)
+  {
+    sector_p = fdd_get_sector(track, sector);
+
+    memset(dst_p, SYNC_BYTE, SYNC_SIZE);
+    dst_p += SYNC_SIZE;
+
+    block_a[0] = HEADER_BLOCK_ID;
+    block_a[1] = sector ^ track ^ id2 ^ id1;
+    block_a[2] = sector;
+    block_a[3] = track;
+    block_a[4] = id2;
+    block_a[5] = id1;
+    block_a[6] = 0x0F;
+    block_a[7] = 0x0F;
+    dst_p = encode(dst_p, block_a, HEADER_BLOCK_SIZE);
+
+    memset(dst_p, GAP_BYTE, HEADER_GAP_SIZE);
+    dst_p += HEADER_GAP_SIZE;
+    memset(dst_p, SYNC_BYTE, SYNC_SIZE);
+    dst_p += SYNC_SIZE;
+
+    block_a[0] = DATA_BLOCK_ID;
+    block_a[SECTOR_SIZE + 1] = 0;
+    for(i = 0; i < SECTOR_SIZE; i++)
+    {
+      block_a[i + 1] = sector_p[i];
+      block_a[SECTOR_SIZE + 1] ^= sector_p[i];
+    }
+    block_a[SECTOR_SIZE + 2] = 0x00;
+    block_a[SECTOR_SIZE + 3] = 0x00;
+    dst_p = encode(dst_p, block_a, DATA_BLOCK_SIZE);
+
+    memset(dst_p, GAP_BYTE, g_sector_gap_a[density]);
+    dst_p += g_sector_gap_a[density];
+  }
+
+  memset(dst_p, GAP_BYTE, track_p->data_p + track_p->length - dst_p);
+}
+
+static void decode_track(uint8_t track)
+{
+  gcr_track_t *track_p = &g_track_a[(track - 1) * 2];
+  uint8_t block_a[DATA_BLOCK_SIZE];
+  uint8_t sector = 0xFF; /* From last header found */
+  uint8_t checksum;
+  uint16_t length = track_p->length;
+  uint16_t pos;
+  uint16_t i;
+
+  if(track_p->data_p == NULL)
+  {
+    return;
+  }
+
+  for(pos = 0; pos < length; pos++)
+  {
+    /* A block starts right after a sync */
+    if(track_p->data_p[pos] == SYNC_BYTE ||
+       track_p->data_p[(pos + length - 1) % length] != SYNC_BYTE ||
+       track_p->data_p[(pos + length - 2) % length] != SYNC_BYTE)
+    {
+      continue;
+    }
+
+    if(decode(block_a, track_p, pos, HEADER_BLOCK_SIZE) &&
+       block_a[0] == HEADER_BLOCK_ID && block_a[3] == track)
+    {
+      sector = block_a[2];
+    }
+    else if(sector != 0xFF &&
+            decode(block_a, track_p, pos, DATA_BLOCK_SIZE) &&
+            block_a[0] == DATA_BLOCK_ID)
+    {
+      checksum = 0;
+      for(i = 0; i < SECTOR_SIZE; i++)
+      {
+        checksum ^= block_a[i + 1];
+      }
+      if(checksum == block_a[SECTOR_SIZE + 1])
+      {
+        fdd_write_sector(track, sector, &block_a[1]);
+      }
+      sector = 0xFF;
+    }
+  }
+}
+
+static void leave_track()
+{
+  if(g_gcr.written)
+  {
+    g_gcr.written = 0;
+    if(!g_gcr.g64 && !(g_gcr.half_track & 1))
+    {
+      decode_track(g_gcr.half_track / 2 + 1);
+    }
+  }
+}
+
+static gcr_track_t *track_get()
+{
+  gcr_track_t *track_p = &g_track_a[g_gcr.half_track];
+
+  if(track_p->data_p == NULL && !g_gcr.g64 && !(g_gcr.half_track & 1))
+  {
+    encode_track(g_gcr.half_track / 2 + 1);
+  }
+
+  return track_p->data_p != NULL ? track_p : NULL;
+}
+
+static void byte_ready()
+{
+  /* Byte ready goes to SO pin of cpu when CA2 is high */
+  if((g_memory_dd.all_p[REG_VIA2_PERIPHERAL_CTRL] & MASK_VIA_PERIPHERAL_CTRL_CA2) == MASK_VIA_PERIPHERAL_CTRL_CA2_HIGH)
+  {
+    cpu_dd_set_overflow();
+  }
+
+  /* and to CA1 */
+  g_memory_dd.all_p[REG_VIA2_IRQ_STATUS] |= MASK_VIA_IRQ_STATUS_BYTE_READY;
+  if(g_memory_dd.all_p[REG_VIA2_IRQ_ENABLE] & MASK_VIA_IRQ_ENABLE_BYTE_READY)
+  {
+    g_memory_dd.all_p[REG_VIA2_IRQ_STATUS] |= MASK_VIA_IRQ_STATUS_IRQ_OCCURED;
+  }
+}
+
+void gcr_init()
+{
+  uint8_t i;
+
+  memset(g_decode_a, 0xFF, sizeof(g_decode_a));
+  for(i = 0; i < 16; i++)
+  {
+    g_decode_a[g_encode_a[i]] = i;
+  }
+
+  leave_track();
+  g_gcr.half_track = HALF_TRACK_START;
+  g_gcr.motor = 0;
+  g_gcr.byte_cycles = BYTE_CYCLES_MAX;
+  g_gcr.last = 0;
+  g_gcr.pos = 0;
+  g_gcr.cycles = 0;
+}
+
+void gcr_step(uint32_t cc)
+{
+  gcr_track_t *track_p;
+  uint8_t byte;
+
+  if(!g_gcr.active || !g_gcr.motor)
+  {
+    return;
+  }
+
+  g_gcr.cycles += cc;
+  if(g_gcr.cycles < g_gcr.byte_cycles)
+  {
+    return;
+  }
+  g_gcr.cycles -= g_gcr.byte_cycles;
+
+  track_p = track_get();
+  if(track_p == NULL)
+  {
+    /* Nothing passes the head */
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] |= MASK_VIA2_PORTB_SYNC;
+    g_gcr.last = 0;
+    return;
+  }
+
+  if(g_gcr.pos >= track_p->length)
+  {
+    g_gcr.pos = 0;
+  }
+
+  /* CB2 low is write mode */
+  if((g_memory_dd.all_p[REG_VIA2_PERIPHERAL_CTRL] & MASK_VIA_PERIPHERAL_CTRL_CB2) == MASK_VIA_PERIPHERAL_CTRL_CB2_LOW)
+  {
+    if(!g_gcr.g64)
+    {
+      track_p->data_p[g_gcr.pos] = g_memory_dd.all_p[REG_VIA2_DATA_PORTA];
+      g_gcr.written = 1;
+    }
+    g_gcr.pos++;
+    g_gcr.last = 0;
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] |= MASK_VIA2_PORTB_SYNC;
+    byte_ready();
+    return;
+  }
+
+  byte = track_p->data_p[g_gcr.pos++];
+
+  /* Sync is ten or more one bits, no byte ready while in it */
+  if(byte == SYNC_BYTE && g_gcr.last == SYNC_BYTE)
+  {
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] &= ~MASK_VIA2_PORTB_SYNC;
+  }
+  else
+  {
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] |= MASK_VIA2_PORTB_SYNC;
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTA] = byte;
+    byte_ready();
+  }
+
+  g_gcr.last = byte;
+}
+
+void gcr_set_active(uint8_t active)
+{
+  if(!active)
+  {
+    leave_track();
+    /* Job queue short cut expects sync all the time */
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] &= ~MASK_VIA2_PORTB_SYNC;
+  }
+  else
+  {
+    g_memory_dd.all_p[REG_VIA2_DATA_PORTB] |= MASK_VIA2_PORTB_SYNC;
+  }
+
+  g_gcr.active = active;
+}
+
+uint8_t gcr_get_active()
+{
+  return g_gcr.active;
+}
+
+void gcr_port_write(uint8_t old, uint8_t value)
+{
+  /* Stepper phases, one step is a half track */
+  switch((value - old) & MASK_VIA2_PORTB_HEAD)
+  {
+    case 1:
+      if(g_gcr.half_track < HALF_TRACKS_MAX - 1)
+      {
+        leave_track();
+        g_gcr.half_track++;
+      }
+      break;
+    case 3:
+      if(g_gcr.half_track > 0)
+      {
+        leave_track();
+        g_gcr.half_track--;
+      }
+      break;
+  }
+
+  if(!(value & MASK_VIA2_PORTB_MOTOR) && (old & MASK_VIA2_PORTB_MOTOR))
+  {
+    leave_track();
+  }
+
+  g_gcr.motor = value & MASK_VIA2_PORTB_MOTOR;
+  g_gcr.byte_cycles = BYTE_CYCLES_MAX - 2 * ((value & MASK_VIA2_PORTB_DATA_DENSITY) >> 5);
+}
+
+uint8_t gcr_insert_g64(uint8_t *image_p, uint32_t size)
+{
+  uint8_t half_tracks;
+  uint32_t offset;
+  uint16_t length;
+  uint8_t i;
+
+  if(size < G64_TRACK_OFFSETS ||
+     memcmp(image_p, G64_SIGNATURE, G64_SIGNATURE_SIZE) != 0)
+  {
+    return 0;
+  }
+
+  half_tracks = image_p[G64_HALF_TRACKS];
+  if(half_tracks > HALF_TRACKS_MAX)
+  {
+    half_tracks = HALF_TRACKS_MAX;
+  }
+  if(size < G64_TRACK_OFFSETS + half_tracks * 4)
+  {
+    return 0;
+  }
+
+  gcr_eject();
+
+  /* Speed zone table is not needed, density is set by the drive */
+  for(i = 0; i < half_tracks; i++)
+  {
+    offset = image_p[G64_TRACK_OFFSETS + i * 4] |
+             image_p[G64_TRACK_OFFSETS + i * 4 + 1] << 8 |
+             image_p[G64_TRACK_OFFSETS + i * 4 + 2] << 16 |
+             image_p[G64_TRACK_OFFSETS + i * 4 + 3] << 24;
+    if(offset == 0 || offset > size - 2)
+    {
+      continue;
+    }
+
+    length = image_p[offset] | image_p[offset + 1] << 8;
+    if(length == 0 || length > size - offset - 2)
+    {
+      continue;
+    }
+
+    g_track_a[i].data_p = image_p + offset + 2;
+    g_track_a[i].length = length;
+  }
+
+  g_gcr.g64 = 1;
+
+  return 1;
+}
+
+void gcr_eject()
+{
+  leave_track();
+  memset(g_track_a, 0, sizeof(g_track_a));
+  memset(g_slot_track_a, 0, sizeof(g_slot_track_a));
+  g_slot_next = 0;
+  g_gcr.g64 = 0;
+}
+
+void gcr_invalidate(uint8_t track)
+{
+  if(!g_gcr.g64 && track > 0 && track <= HALF_TRACKS_MAX / 2)
+  {
+    g_track_a[(track - 1) * 2].data_p = NULL;
+  }
+}
+
+void gcr_set_memory(uint8_t *mem_p)
+{
+  g_cache_p = mem_p;
+}
@@ -0,0 +1,40 @@
+/*
+ * memwa2 gcr component
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+ 
+
+
+#ifndef _GCR_H
+#define _GCR_H
+
+#include "emuddif.h"
+
+void gcr_init();
+void gcr_step(uint32_t cc);
+void gcr_set_active(uint8_t active);
+uint8_t gcr_get_active();
+void gcr_port_write(uint8_t old, uint8_t value);
+uint8_t gcr_insert_g64(uint8_t *image_p, uint32_t size);
+void gcr_eject();
+void gcr_invalidate(uint8_t track);
+void gcr_set_memory(uint8_t *mem_p);
+
+#endif
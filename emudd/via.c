@@ -30,6 +30,7 @@
 #include "bus.h"
 #include "via.h"
 #include "cpu.h"
+#include "gcr.h"
 #include "if.h"
 #include <string.h>
 
@@ -441,6 +442,7 @@ static void via2_event_write_porta(uint16_t addr, uint8_t value)
 static void via2_event_write_portb(uint16_t addr, uint8_t value)
 {
   uint8_t mask = g_memory_dd.all_p[REG_VIA2_DIRECTION_PORTB];
+  uint8_t old = g_memory_dd.all_p[addr];
 
   /* Update if led is changed */
   if((value & 0x08) != (g_memory_dd.all_p[addr] & 0x08))
@@ -450,6 +452,9 @@ static void via2_event_write_portb(uint16_t addr, uint8_t value)
 
   g_memory_dd.all_p[addr] &= ~mask; /* Clear the bits allowed to write to */
   g_memory_dd.all_p[addr] |= value & mask; /* Write the bits allowed to write to */
+
+  /* Head, motor and density */
+  gcr_port_write(old, g_memory_dd.all_p[addr]);
 }
 
 static void via2_event_write_irq_status(uint16_t addr, uint8_t value)
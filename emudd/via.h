@@ -340,11 +340,18 @@ Bit #6: 1 = Timer underflow occurred.
 #define MASK_VIA_IRQ_STATUS_IRQ_OCCURED     0x80
 #define MASK_VIA_IRQ_STATUS_ATN             0x02
 #define MASK_VIA_IRQ_STATUS_TIMER           0x40
+#define MASK_VIA_IRQ_STATUS_BYTE_READY      0x02 /* CA1 of VIA2 */
+
+#define MASK_VIA_PERIPHERAL_CTRL_CA2        0x0E
+#define MASK_VIA_PERIPHERAL_CTRL_CA2_HIGH   0x0E
+#define MASK_VIA_PERIPHERAL_CTRL_CB2        0xE0
+#define MASK_VIA_PERIPHERAL_CTRL_CB2_LOW    0xC0
 
 #define MASK_VIA_AUXILIARY_TIMER_CTRL       0xC0
 
 #define MASK_VIA_IRQ_ENABLE_ATN               0x02
 #define MASK_VIA_IRQ_ENABLE_TIMER             0x40
+#define MASK_VIA_IRQ_ENABLE_BYTE_READY        0x02
 
 void via_init();
 void via_step(uint32_t cc);
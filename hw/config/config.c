@@ -264,6 +264,7 @@ void HAL_LTDC_MspInit(LTDC_HandleTypeDef *hltdc)
 
     /* Enable the LTDC and DMA2D clocks */
     __HAL_RCC_LTDC_CLK_ENABLE();
+    __HAL_RCC_DMA2D_CLK_ENABLE();
 
     /* No worries, it will be enabled by hal again */
     //__HAL_LTDC_DISABLE(hltdc);
@@ -30,6 +30,7 @@
 #include "ff.h"
 #include "adv7511.h"
 #include "disp.h"
+#include "if.h"
 
 #define TEST_FILE               "testfile"
 #define TEST_PATTERN_REPS       1000
@@ -38,6 +39,8 @@
 #define TEST_SDRAM_SIZE         0x800000
 #define TEST_SCREEN_WIDTH       800
 #define TEST_SCREEN_HEIGHT      600
+#define BENCH_FRAME_CYCLES      19656 /* Pal, 312 lines * 63 cycles */
+#define DWT_UNLOCK_KEY          0xC5ACCE55
 
 static FATFS fatfs;
 static FIL fil;
@@ -46,6 +49,8 @@ static char sd_path_and_file[] = {"0:/"TEST_FILE};
 static char test_pattern[] = {"abcdefghijklmnopqrstuvxyz1234567890"};
 static char test_pattern_cmp[sizeof(test_pattern)];
 
+extern if_emu_cc_t g_if_cc_emu;
+
 typedef enum
 {
     DIAG_SDRAM_STATUS_OK,
@@ -279,3 +284,49 @@ exit:
     return diag_status;
 }
 
+static uint32_t bench_cycles_per_frame(uint32_t frames)
+{
+    uint32_t start;
+    uint32_t i;
+
+    start = DWT->CYCCNT;
+    for(i = 0; i < frames; i++)
+    {
+        g_if_cc_emu.if_emu_cc_op.op_run_fp(BENCH_FRAME_CYCLES);
+    }
+
+    return (DWT->CYCCNT - start) / frames;
+}
+
+/*
+ * Core cycles per emulated frame with the d-cache on and off. Cortex-M7
+ * has no event counter for d-cache misses, so this does not count misses,
+ * it only shows how much emulation depends on the d-cache. CYCCNT is 32
+ * bits, so one run (all frames with or without d-cache) must be shorter
+ * than about 20 s at 216 MHz. Emulation goes on during the benchmark and
+ * frame rate must be unlocked, otherwise vic waits for the display.
+ */
+void diag_vic_bench(uint32_t frames)
+{
+    uint32_t cached;
+    uint32_t uncached;
+
+    if(frames == 0)
+    {
+        return;
+    }
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = DWT_UNLOCK_KEY;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    cached = bench_cycles_per_frame(frames);
+
+    SCB_DisableDCache();
+    uncached = bench_cycles_per_frame(frames);
+    SCB_EnableDCache();
+
+    printf("vic bench: %u cycles/frame with d-cache, %u without, %u more without\n",
+           (unsigned int)cached, (unsigned int)uncached,
+           (unsigned int)(uncached > cached ? uncached - cached : 0));
+}
@@ -41,5 +41,6 @@ typedef enum
 
 diag_status_t diag_run();
 diag_status_t diag_sdcard_run();
+void diag_vic_bench(uint32_t frames);
 
 #endif
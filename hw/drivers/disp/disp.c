@@ -51,14 +51,31 @@
 #define DISP_MAIN_LAYER       0
 #define DISP_EMU_LAYER        1
 
+#define DISP_BUFFER_NONE      0xFF
+#define DISP_FLIP_LINE_MARGIN 8 /* Lines before vertical blanking to latch next frame */
+
 #define CLUT_TEXT_BG_POS      16
 #define CLUT_TEXT_FG_POS      17
 #define CLUT_MARKER_POS       18
 #define CLUT_MAX              19
+#define DISP_CACHE_LINE_SIZE  32
 
 LTDC_HandleTypeDef g_ltdc_handle; /* used by irq.c */
 static LTDC_LayerCfgTypeDef g_ltdc_layer_cfg_a[2];
-static uint32_t g_memory_addr_a[3];
+static uint32_t g_memory_addr_a[4];
+
+/*
+ * Presentation queue for the emulator layer. Buffer MEM_ADDR_BUFFER1 to
+ * MEM_ADDR_BUFFER3 rotate between these states. The emulator owns whatever
+ * buffer is in none of them. Only the LTDC interrupt moves a buffer from
+ * ready to reload to scan, so the emulator never waits for the display and
+ * the display never shows a buffer that is being rendered.
+ */
+static volatile uint8_t g_flip_scan; /* Currently scanned out by LTDC */
+static volatile uint8_t g_flip_reload; /* Latched, shown at next vertical blanking */
+static volatile uint8_t g_flip_ready; /* Latest completed frame, not yet latched */
+static uint32_t *g_copy_dst_p; /* Lines written by DMA2D, invalidated when done */
+static uint32_t g_copy_length;
 
 static uint32_t clut_a[CLUT_MAX] =
 {
@@ -83,6 +100,60 @@ static uint32_t clut_a[CLUT_MAX] =
     0x151bfb, /* marker */
 };
 
+static uint8_t flip_get_index(uint32_t memory)
+{
+    uint8_t i;
+
+    for(i = MEM_ADDR_BUFFER1; i <= MEM_ADDR_BUFFER3; i++)
+    {
+        if(g_memory_addr_a[i] == memory)
+        {
+            return i;
+        }
+    }
+
+    return DISP_BUFFER_NONE;
+}
+
+static uint8_t flip_get_free()
+{
+    uint8_t i;
+
+    for(i = MEM_ADDR_BUFFER1; i <= MEM_ADDR_BUFFER3; i++)
+    {
+        if(i != g_flip_scan && i != g_flip_reload && i != g_flip_ready)
+        {
+            return i;
+        }
+    }
+
+    return DISP_BUFFER_NONE;
+}
+
+static uint8_t flip_take_free()
+{
+    uint8_t next = flip_get_free();
+
+    if(next == DISP_BUFFER_NONE)
+    {
+        /* Scanned, latched and ready hold all buffers, drop the ready frame */
+        next = g_flip_ready;
+        g_flip_ready = DISP_BUFFER_NONE;
+    }
+
+    return next;
+}
+
+static void flip_reset()
+{
+    __HAL_LTDC_DISABLE_IT(&g_ltdc_handle, LTDC_IT_LI);
+    __HAL_LTDC_DISABLE_IT(&g_ltdc_handle, LTDC_IT_RR);
+
+    g_flip_scan = MEM_ADDR_BUFFER1; /* Emulator layer always starts at this one */
+    g_flip_reload = DISP_BUFFER_NONE;
+    g_flip_ready = DISP_BUFFER_NONE;
+}
+
 void disp_init(disp_mode_t disp_mode)
 {
     switch(disp_mode)
@@ -142,8 +213,11 @@ void disp_init(disp_mode_t disp_mode)
     HAL_LTDC_EnableCLUT(&g_ltdc_handle, 0);
     HAL_LTDC_EnableCLUT(&g_ltdc_handle, 1);
 
-    HAL_LTDC_ProgramLineEvent(&g_ltdc_handle, 200);
-    __HAL_LTDC_DISABLE_IT(&g_ltdc_handle, LTDC_IT_LI); /* Disable line events for now */
+    /* Line event is used to latch the next emulator frame just before vertical blanking */
+    HAL_LTDC_ProgramLineEvent(&g_ltdc_handle, g_ltdc_handle.Init.AccumulatedActiveH - DISP_FLIP_LINE_MARGIN);
+    __HAL_LTDC_DISABLE_IT(&g_ltdc_handle, LTDC_IT_LI); /* Enabled when a frame is ready */
+
+    flip_reset();
 }
 
 void *disp_get_layer(uint8_t layer)
@@ -183,6 +257,12 @@ void disp_set_layer(uint8_t layer,
     g_ltdc_layer_cfg_a[layer].PixelFormat = pixel_format;
     g_ltdc_layer_cfg_a[layer].FBStartAdress = g_memory_addr_a[layer];
 
+    if(layer == DISP_EMU_LAYER)
+    {
+        /* Any queued frame belongs to the old layer setup */
+        flip_reset();
+    }
+
     HAL_LTDC_ConfigLayer(&g_ltdc_handle, &g_ltdc_layer_cfg_a[layer], layer);
 }
 
@@ -226,18 +306,125 @@ void disp_move_layer(uint8_t layer, uint32_t x, uint32_t y)
 
 void disp_flip_buffer(uint8_t **done_buffer_pp)
 {
-    /* Set layer to be displayed */
-    HAL_LTDC_SetAddress(&g_ltdc_handle, (uint32_t)*done_buffer_pp, DISP_EMU_LAYER);
+    uint8_t done;
+    uint8_t next;
+
+    done = flip_get_index((uint32_t)*done_buffer_pp);
+
+    HAL_NVIC_DisableIRQ(LTDC_IRQn);
 
-    /* And shift buffer */
-    if((uint32_t)*done_buffer_pp == g_memory_addr_a[MEM_ADDR_BUFFER1])
+    if(done == DISP_BUFFER_NONE || done == g_flip_scan || done == g_flip_reload)
     {
-        *done_buffer_pp = (uint8_t *)g_memory_addr_a[MEM_ADDR_BUFFER2];
+        /* Frame was not rendered in a buffer owned by the emulator, drop it */
+        next = flip_take_free();
+    }
+    else if(g_flip_ready != DISP_BUFFER_NONE)
+    {
+        /* Previous frame never made it to screen, replace it and reuse its buffer */
+        next = g_flip_ready;
+        g_flip_ready = done;
     }
     else
     {
-        *done_buffer_pp = (uint8_t *)g_memory_addr_a[MEM_ADDR_BUFFER1];
+        g_flip_ready = done;
+        next = flip_get_free();
+
+        if(next == DISP_BUFFER_NONE)
+        {
+            /*
+             * Both other buffers are scanned and latched (a few lines before
+             * vertical blanking). Drop this frame rather than wait.
+             */
+            g_flip_ready = DISP_BUFFER_NONE;
+            next = done;
+        }
+    }
+
+    if(g_flip_ready != DISP_BUFFER_NONE && g_flip_reload == DISP_BUFFER_NONE)
+    {
+        __HAL_LTDC_CLEAR_FLAG(&g_ltdc_handle, LTDC_FLAG_LI);
+        __HAL_LTDC_ENABLE_IT(&g_ltdc_handle, LTDC_IT_LI);
+    }
+
+    HAL_NVIC_EnableIRQ(LTDC_IRQn);
+
+    *done_buffer_pp = (uint8_t *)g_memory_addr_a[next];
+}
+
+void disp_copy(uint8_t *dst_p, uint8_t *src_p, uint32_t length)
+{
+    uint32_t head;
+    uint32_t body;
+
+    /* Only one copy in flight, DMA2D is started right away */
+    disp_copy_wait();
+
+    /*
+     * Only whole cache lines of the destination are given to DMA2D. Rows
+     * are not cache line aligned (e.g. 400 bytes), so the lines at both
+     * ends are shared with rows that the cpu keeps writing meanwhile.
+     * Those bytes are copied by the cpu instead.
+     */
+    head = (DISP_CACHE_LINE_SIZE - ((uint32_t)dst_p & (DISP_CACHE_LINE_SIZE - 1))) & (DISP_CACHE_LINE_SIZE - 1);
+    if(head >= length)
+    {
+        memcpy(dst_p, src_p, length);
+        return;
+    }
+
+    body = (length - head) & ~(DISP_CACHE_LINE_SIZE - 1);
+    memcpy(dst_p, src_p, head);
+    memcpy(dst_p + head + body, src_p + head + body, length - head - body);
+    if(body == 0)
+    {
+        return;
     }
+
+    dst_p += head;
+    src_p += head;
+
+    /* Layers are in cached sdram, make sure DMA2D and cpu agree on content */
+    SCB_CleanDCache_by_Addr((uint32_t *)src_p, body);
+    SCB_InvalidateDCache_by_Addr((uint32_t *)dst_p, body);
+
+    /* Memory to memory, moved as ARGB8888 since the length is 4 byte aligned */
+    DMA2D->CR = DMA2D_M2M;
+    DMA2D->FGPFCCR = DMA2D_INPUT_ARGB8888;
+    DMA2D->FGMAR = (uint32_t)src_p;
+    DMA2D->FGOR = 0;
+    DMA2D->OPFCCR = DMA2D_OUTPUT_ARGB8888;
+    DMA2D->OMAR = (uint32_t)dst_p;
+    DMA2D->OOR = 0;
+    DMA2D->NLR = ((body / 4) << 16) | 1;
+    DMA2D->CR |= DMA2D_CR_START;
+
+    g_copy_dst_p = (uint32_t *)dst_p;
+    g_copy_length = body;
+}
+
+void disp_copy_wait()
+{
+    while(DMA2D->CR & DMA2D_CR_START) {;}
+
+    if(g_copy_dst_p != NULL)
+    {
+        /* Cpu may have speculatively cached old content while DMA2D wrote it */
+        SCB_InvalidateDCache_by_Addr(g_copy_dst_p, g_copy_length);
+        g_copy_dst_p = NULL;
+    }
+}
+
+uint8_t *disp_acquire_buffer()
+{
+    uint8_t next;
+
+    disp_copy_wait();
+
+    HAL_NVIC_DisableIRQ(LTDC_IRQn);
+    next = flip_take_free();
+    HAL_NVIC_EnableIRQ(LTDC_IRQn);
+
+    return (uint8_t *)g_memory_addr_a[next];
 }
 
 void disp_set_clut_table(uint32_t *clut_p)
@@ -247,6 +434,11 @@ void disp_set_clut_table(uint32_t *clut_p)
     HAL_LTDC_ConfigCLUT(&g_ltdc_handle, clut_a, CLUT_MAX, 1);
 }
 
+uint32_t *disp_get_clut_table()
+{
+    return clut_a;
+}
+
 void disp_enable_clut(uint8_t layer)
 {
     HAL_LTDC_EnableCLUT(&g_ltdc_handle, layer);
@@ -268,6 +460,44 @@ void HAL_LTDC_ErrorCallback(LTDC_HandleTypeDef *hltdc)
 
 void HAL_LTDC_LineEvenCallback(LTDC_HandleTypeDef *hltdc)
 {
-    main_error("HAL LTDC line callback!", __FILE__, __LINE__, (uint32_t)hltdc->ErrorCode);
-    //HAL_LTDC_ProgramLineEvent(hltdc, 200);
+    if(g_flip_ready == DISP_BUFFER_NONE)
+    {
+        return;
+    }
+
+    if(g_flip_reload != DISP_BUFFER_NONE)
+    {
+        /* Previous reload still pending, try again next frame */
+        __HAL_LTDC_ENABLE_IT(hltdc, LTDC_IT_LI);
+        return;
+    }
+
+    /*
+     * Registers are written directly here since the HAL functions takes the
+     * handle lock, which may already be held by the thread that got interrupted.
+     */
+    g_flip_reload = g_flip_ready;
+    g_flip_ready = DISP_BUFFER_NONE;
+    LTDC_LAYER(hltdc, DISP_EMU_LAYER)->CFBAR = g_memory_addr_a[g_flip_reload];
+    __HAL_LTDC_ENABLE_IT(hltdc, LTDC_IT_RR);
+    hltdc->Instance->SRCR = LTDC_RELOAD_VERTICAL_BLANKING;
+}
+
+void HAL_LTDC_ReloadEventCallback(LTDC_HandleTypeDef *hltdc)
+{
+    if(g_flip_reload == DISP_BUFFER_NONE)
+    {
+        return;
+    }
+
+    /* Latched frame is now on screen, the one before it is free again */
+    g_flip_scan = g_flip_reload;
+    g_flip_reload = DISP_BUFFER_NONE;
+    hltdc->LayerCfg[DISP_EMU_LAYER].FBStartAdress = g_memory_addr_a[g_flip_scan];
+
+    if(g_flip_ready != DISP_BUFFER_NONE)
+    {
+        /* Frame was submitted while waiting for reload */
+        __HAL_LTDC_ENABLE_IT(hltdc, LTDC_IT_LI);
+    }
 }
@@ -30,6 +30,7 @@
 #define MEM_ADDR_BUFFER0    0
 #define MEM_ADDR_BUFFER1    1
 #define MEM_ADDR_BUFFER2    2
+#define MEM_ADDR_BUFFER3    3
 
 typedef enum
 {
@@ -77,7 +78,11 @@ void disp_deactivate_layer(uint8_t layer);
 void disp_fill_layer(uint8_t layer, uint32_t color);
 void disp_move_layer(uint8_t layer, uint32_t x, uint32_t y);
 void disp_flip_buffer(uint8_t **done_buffer_pp);
+uint8_t *disp_acquire_buffer();
+void disp_copy(uint8_t *dst_p, uint8_t *src_p, uint32_t length);
+void disp_copy_wait();
 void disp_set_clut_table(uint32_t *clut_p);
+uint32_t *disp_get_clut_table();
 void disp_enable_clut(uint8_t layer);
 void disp_disable_clut(uint8_t layer);
 
@@ -26,14 +26,10 @@
  */
 
 #include "timer.h"
-#include "if.h"
-
-extern if_emu_cc_t g_if_cc_emu;
 
 static TIM_HandleTypeDef g_tim_handle_type;
 static uint32_t g_timer_ms;
 static uint32_t g_timer3;
-static uint8_t g_timer;
 
 void HAL_TIM_Base_MspInit(TIM_HandleTypeDef *htim)
 {
@@ -111,16 +107,7 @@ void timer_init()
 
 void systimer_tick()
 {
-    g_timer++;
     g_timer_ms++;
-    if(g_timer == 100)
-    {
-        if(g_if_cc_emu.if_emu_cc_time.time_tenth_second_fp != NULL)
-        {
-            g_if_cc_emu.if_emu_cc_time.time_tenth_second_fp();
-        }
-        g_timer = 0;
-    }
 }
 
 uint32_t timer_get_ms()
@@ -43,6 +43,8 @@
 #include "crc.h"
 #include "sidbus.h"
 #include "sm.h"
+#include "stream.h"
+#include "record.h"
 
 uint32_t *if_host_filesys_open(char *path_p, uint8_t mode);
 void if_host_filesys_close(uint32_t *fd_p);
@@ -62,8 +64,21 @@ uint32_t if_host_calc_checksum(uint8_t *buffer_p, uint32_t length);
 uint8_t if_host_ports_read_serial(if_emu_dev_t if_emu_dev);
 void if_host_ports_write_serial(if_emu_dev_t if_emu_dev, uint8_t data);
 void if_host_disp_flip(uint8_t **done_buffer_pp);
+void if_host_disp_copy(uint8_t *dst_p, uint8_t *src_p, uint32_t length);
 void if_host_ee_tape_play(uint8_t play);
 void if_host_ee_tape_motor(uint8_t motor);
+uint8_t *if_host_disk_read_sector(uint8_t track, uint8_t sector);
+uint8_t if_host_disk_write_sector(uint8_t track, uint8_t sector, uint8_t *data_p);
+
+#define SERIAL_QUEUE_SIZE       16 /* Must be power of two */
+#define SERIAL_BUSY_CYCLES      20000 /* Bus counts as busy this long after a line change */
+#define SERIAL_LINES_UNKNOWN    0xFF /* Not a valid write, next one is always a change */
+
+typedef struct
+{
+    uint32_t cycle; /* Cc cycle when line changed */
+    uint8_t data;
+} serial_msg_t;
 
 if_host_t g_if_host =
 {
@@ -101,17 +116,99 @@ if_host_t g_if_host =
         if_host_ports_write_serial,
     },
     {
-        if_host_disp_flip
+        if_host_disp_flip,
+        if_host_disp_copy
     },
     {
         if_host_ee_tape_play,
         if_host_ee_tape_motor
+    },
+    {
+        if_host_disk_read_sector,
+        if_host_disk_write_sector
     }
 };
 
 extern if_emu_cc_t g_if_cc_emu;
 extern if_emu_dd_t g_if_dd_emu;
 
+/*
+ * Cc runs ahead and dd lags behind, at most one slice. Lines written by
+ * cc are queued with the cycle they were written and delivered when dd
+ * has been run up to that cycle. Lines written by dd go straight to cc,
+ * which is already past that cycle. Dd is caught up when cc samples the
+ * bus, when the queue is full and otherwise once per slice.
+ */
+static serial_msg_t g_serial_queue_a[SERIAL_QUEUE_SIZE];
+static uint8_t g_serial_queue_head;
+static uint8_t g_serial_queue_tail;
+static uint8_t g_serial_lines_a[2]; /* Last written by cc and dd */
+static uint8_t g_serial_dd_active;
+static uint32_t g_serial_dd_cycle; /* Cc cycle that dd has been run up to */
+static uint32_t g_serial_dd_offset; /* Cc cycle minus dd cycle */
+static uint32_t g_serial_change_cycle; /* Cc cycle of last line change */
+
+static void serial_run_dd(uint32_t cycle)
+{
+    int32_t cycles = (int32_t)(cycle - g_serial_dd_cycle);
+
+    if(cycles <= 0)
+    {
+        return;
+    }
+
+    g_serial_dd_cycle = cycle;
+    g_if_dd_emu.if_emu_dd_op.op_run_fp(cycles);
+}
+
+static void serial_sync_dd(uint32_t cycle)
+{
+    serial_msg_t *msg_p;
+
+    while(g_serial_queue_tail != g_serial_queue_head)
+    {
+        msg_p = &g_serial_queue_a[g_serial_queue_tail];
+
+        if((int32_t)(msg_p->cycle - cycle) > 0)
+        {
+            break;
+        }
+
+        serial_run_dd(msg_p->cycle);
+        g_if_dd_emu.if_emu_dd_ports.if_emu_dd_ports_write_serial_fp(msg_p->data);
+        g_serial_queue_tail = (g_serial_queue_tail + 1) & (SERIAL_QUEUE_SIZE - 1);
+    }
+
+    serial_run_dd(cycle);
+}
+
+void hostif_serial_dd_active(uint8_t active)
+{
+    /* Both start out at the same cycle */
+    g_serial_dd_active = active;
+    g_serial_dd_cycle = g_if_cc_emu.if_emu_cc_op.op_cycles_fp();
+    g_serial_dd_offset = g_serial_dd_cycle - g_if_dd_emu.if_emu_dd_op.op_cycles_fp();
+    g_serial_change_cycle = g_serial_dd_cycle - SERIAL_BUSY_CYCLES;
+    g_serial_lines_a[IF_EMU_DEV_CC] = SERIAL_LINES_UNKNOWN;
+    g_serial_lines_a[IF_EMU_DEV_DD] = SERIAL_LINES_UNKNOWN;
+    g_serial_queue_head = 0;
+    g_serial_queue_tail = 0;
+}
+
+uint8_t hostif_serial_busy()
+{
+    return g_serial_dd_active &&
+           (g_if_cc_emu.if_emu_cc_op.op_cycles_fp() - g_serial_change_cycle) < SERIAL_BUSY_CYCLES;
+}
+
+void hostif_serial_sync()
+{
+    if(g_serial_dd_active)
+    {
+        serial_sync_dd(g_if_cc_emu.if_emu_cc_op.op_cycles_fp());
+    }
+}
+
 uint32_t *if_host_filesys_open(char *path_p, uint8_t mode)
 {
     FRESULT res;
@@ -203,6 +300,7 @@ void if_host_filesys_seek(uint32_t *fd_p, uint32_t pos)
 
 void if_host_sid_write(uint8_t addr, uint8_t data)
 {
+    record_sid(addr, data, g_if_cc_emu.if_emu_cc_op.op_cycles_fp());
     sidbus_write(addr, data);
 }
 
@@ -280,23 +378,59 @@ uint8_t if_host_ports_read_serial(if_emu_dev_t if_emu_dev)
 {
     switch(if_emu_dev)
     {
-        case IF_EMU_DEV_CC:
-          break;
-        case IF_EMU_DEV_DD:
-          break;
+        case IF_EMU_DEV_CC: /* Computer samples serial port, dd must be at same cycle */
+            hostif_serial_sync();
+            return g_serial_lines_a[IF_EMU_DEV_DD];
+        case IF_EMU_DEV_DD: /* Disk drive is never ahead, queued lines are already delivered */
+            return g_serial_lines_a[IF_EMU_DEV_CC];
     }
 
-    return 0; /* Not used atm */
+    return 0;
 }
 
 void if_host_ports_write_serial(if_emu_dev_t if_emu_dev, uint8_t data)
 {
+    uint8_t head;
+
+    if(!g_serial_dd_active)
+    {
+        switch(if_emu_dev)
+        {
+            case IF_EMU_DEV_CC:
+                g_if_dd_emu.if_emu_dd_ports.if_emu_dd_ports_write_serial_fp(data);
+                break;
+            case IF_EMU_DEV_DD:
+                g_if_cc_emu.if_emu_cc_ports.if_emu_cc_ports_write_serial_fp(data);
+                break;
+        }
+        return;
+    }
+
+    /* Writes that keep the lines (e.g. vic bank in cia2 port a) are not passed on */
+    if(data == g_serial_lines_a[if_emu_dev])
+    {
+        return;
+    }
+    g_serial_lines_a[if_emu_dev] = data;
+
     switch(if_emu_dev)
     {
         case IF_EMU_DEV_CC: /* Computer writes to serial port */
-            g_if_dd_emu.if_emu_dd_ports.if_emu_dd_ports_write_serial_fp(data);
+            g_serial_change_cycle = g_if_cc_emu.if_emu_cc_op.op_cycles_fp();
+
+            head = (g_serial_queue_head + 1) & (SERIAL_QUEUE_SIZE - 1);
+            if(head == g_serial_queue_tail)
+            {
+                /* Queue full, deliver what is there */
+                serial_sync_dd(g_serial_queue_a[(g_serial_queue_head - 1) & (SERIAL_QUEUE_SIZE - 1)].cycle);
+            }
+
+            g_serial_queue_a[g_serial_queue_head].cycle = g_serial_change_cycle;
+            g_serial_queue_a[g_serial_queue_head].data = data;
+            g_serial_queue_head = head;
             break;
-        case IF_EMU_DEV_DD: /* Disk drive writes to serial port */
+        case IF_EMU_DEV_DD: /* Disk drive writes to serial port, cc is already past this cycle */
+            g_serial_change_cycle = g_if_dd_emu.if_emu_dd_op.op_cycles_fp() + g_serial_dd_offset;
             g_if_cc_emu.if_emu_cc_ports.if_emu_cc_ports_write_serial_fp(data);
             break;
     }
@@ -304,9 +438,18 @@ void if_host_ports_write_serial(if_emu_dev_t if_emu_dev, uint8_t data)
 
 void if_host_disp_flip(uint8_t **done_buffer_pp)
 {
+    /* Scaled rows may still be copied by DMA2D */
+    disp_copy_wait();
+    stream_frame(*done_buffer_pp);
+    record_frame(*done_buffer_pp, g_if_cc_emu.if_emu_cc_op.op_cycles_fp());
     disp_flip_buffer(done_buffer_pp);
 }
 
+void if_host_disp_copy(uint8_t *dst_p, uint8_t *src_p, uint32_t length)
+{
+    disp_copy(dst_p, src_p, length);
+}
+
 void if_host_ee_tape_play(uint8_t play)
 {
     sm_tape_play(play);
@@ -314,8 +457,19 @@ void if_host_ee_tape_play(uint8_t play)
 
 void if_host_ee_tape_motor(uint8_t motor)
 {
+    sm_tape_motor(motor);
     if(sm_get_disp_stats_flag())
     {
         stage_draw_info(INFO_TAPE_MOTOR, motor);
     }
 }
+
+uint8_t *if_host_disk_read_sector(uint8_t track, uint8_t sector)
+{
+    return g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_read_sector_fp(track, sector);
+}
+
+uint8_t if_host_disk_write_sector(uint8_t track, uint8_t sector, uint8_t *data_p)
+{
+    return g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_write_sector_fp(track, sector, data_p);
+}
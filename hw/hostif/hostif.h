@@ -27,4 +27,8 @@
 #include "stm32f7xx_hal.h"
 #include "main.h"
 
+void hostif_serial_dd_active(uint8_t active);
+uint8_t hostif_serial_busy();
+void hostif_serial_sync();
+
 #endif
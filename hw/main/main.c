@@ -42,6 +42,12 @@
 #include "ff.h"
 #include "sm.h"
 #include "sdcard.h"
+#include "stream.h"
+#include "record.h"
+
+#if CC_STAGE_FILES_ADDR + IF_MEMORY_CC_STAGE_FILES_SIZE > SDRAM_ADDR + SDRAM_SIZE
+#error "Regions in sdram do not leave room for the stage files"
+#endif
 
 #define BUFFER_SIZE        0x1000
 #define DEFAULT_KEY_MAX    71
@@ -124,6 +130,7 @@ int main()
     disp_set_memory(MEM_ADDR_BUFFER0, CC_DISP_BUFFER1_ADDR);
     disp_set_memory(MEM_ADDR_BUFFER1, CC_DISP_BUFFER2_ADDR);
     disp_set_memory(MEM_ADDR_BUFFER2, CC_DISP_BUFFER3_ADDR);
+    disp_set_memory(MEM_ADDR_BUFFER3, CC_DISP_BUFFER4_ADDR);
 
     if(f_mount(&g_fatfs, (TCHAR const*)g_sd_path_p, 1) != FR_OK)
     {
@@ -298,6 +305,8 @@ int main()
     }
 
     stage_init(CC_STAGE_FILES_ADDR);
+    stream_init(STREAM_REF_ADDR, STREAM_BUFFER_ADDR);
+    record_init(RECORD_ADDR);
     stage_select_layer(0);
 
     /* Give commodore computer (cc) some memory to work with */
@@ -311,13 +320,16 @@ int main()
     g_if_cc_emu.if_emu_cc_mem.mem_set_fp((uint8_t *)CC_SPRITE1_BASE_ADDR, IF_MEM_CC_TYPE_SPRITE1); /* sprite virtual layer (background) by emu */
     g_if_cc_emu.if_emu_cc_mem.mem_set_fp((uint8_t *)CC_SPRITE2_BASE_ADDR, IF_MEM_CC_TYPE_SPRITE2); /* sprite virtual layer (forground) by emu */
     g_if_cc_emu.if_emu_cc_mem.mem_set_fp((uint8_t *)CC_SPRITE3_BASE_ADDR, IF_MEM_CC_TYPE_SPRITE3); /* sprite mapping by emu */
+    g_if_cc_emu.if_emu_cc_mem.mem_set_fp((uint8_t *)CC_TAPE_ADDR, IF_MEM_CC_TYPE_TAPE); /* decoded tape pulses by emu */
 
     /* Give disk drive (dd) some memory to work with */
     g_if_dd_emu.if_emu_dd_mem.mem_set_fp((uint8_t *)DD_ALL_BASE_ADDR, IF_MEM_DD_TYPE_ALL);
     g_if_dd_emu.if_emu_dd_mem.mem_set_fp((uint8_t *)DD_UTIL1_BASE_ADDR, IF_MEM_DD_TYPE_UTIL1);
     g_if_dd_emu.if_emu_dd_mem.mem_set_fp((uint8_t *)DD_UTIL2_BASE_ADDR, IF_MEM_DD_TYPE_UTIL2);
+    g_if_dd_emu.if_emu_dd_mem.mem_set_fp((uint8_t *)DD_DISK_ADDR, IF_MEM_DD_TYPE_DISK); /* disk image by emu */
+    g_if_dd_emu.if_emu_dd_mem.mem_set_fp((uint8_t *)DD_GCR_ADDR, IF_MEM_DD_TYPE_GCR); /* encoded disk tracks by emu */
 
-    g_if_cc_emu.if_emu_cc_display.display_layer_set_fp((uint8_t *)CC_DISP_BUFFER2_ADDR);
+    g_if_cc_emu.if_emu_cc_display.display_layer_set_fp(disp_acquire_buffer());
     g_if_cc_emu.if_emu_cc_ue.ue_keybd_map_set_fp(g_keybd_map_a);
 
     sm_init();
@@ -34,10 +34,15 @@
 #define SDRAM_ADDR              0x60000000
 #define SDRAM_SIZE              0x800000
 
+#define STREAM_REF_SIZE         0x20000
+#define STREAM_BUFFER_SIZE      0x40000
+#define RECORD_SIZE             0x70000
+
 #define CC_DISP_BUFFER1_ADDR   (SDRAM_ADDR)
 #define CC_DISP_BUFFER2_ADDR   (CC_DISP_BUFFER1_ADDR + IF_MEMORY_CC_SCREEN_BUFFER1_SIZE)
 #define CC_DISP_BUFFER3_ADDR   (CC_DISP_BUFFER2_ADDR + IF_MEMORY_CC_SCREEN_BUFFER2_SIZE)
-#define CC_SPRITE1_BASE_ADDR   (CC_DISP_BUFFER3_ADDR + IF_MEMORY_CC_SCREEN_BUFFER3_SIZE)
+#define CC_DISP_BUFFER4_ADDR   (CC_DISP_BUFFER3_ADDR + IF_MEMORY_CC_SCREEN_BUFFER3_SIZE)
+#define CC_SPRITE1_BASE_ADDR   (CC_DISP_BUFFER4_ADDR + IF_MEMORY_CC_SCREEN_BUFFER4_SIZE)
 #define CC_SPRITE2_BASE_ADDR   (CC_SPRITE1_BASE_ADDR + IF_MEMORY_CC_SPRITE1_SIZE)
 #define CC_SPRITE3_BASE_ADDR   (CC_SPRITE2_BASE_ADDR + IF_MEMORY_CC_SPRITE2_SIZE)
 #define CC_RAM_BASE_ADDR       (CC_SPRITE3_BASE_ADDR + IF_MEMORY_CC_SPRITE3_SIZE)
@@ -54,12 +59,18 @@
 #define DD_ALL_BASE_ADDR       (CC_UTIL2_BASE_ADDR + IF_MEMORY_CC_UTIL2_SIZE)
 #define DD_UTIL1_BASE_ADDR     (DD_ALL_BASE_ADDR + IF_MEMORY_DD_ALL_SIZE)
 #define DD_UTIL2_BASE_ADDR     (DD_UTIL1_BASE_ADDR + IF_MEMORY_DD_UTIL1_SIZE)
+#define STREAM_REF_ADDR        (DD_UTIL2_BASE_ADDR + IF_MEMORY_DD_UTIL2_SIZE)
+#define STREAM_BUFFER_ADDR     (STREAM_REF_ADDR + STREAM_REF_SIZE)
+#define RECORD_ADDR            (STREAM_BUFFER_ADDR + STREAM_BUFFER_SIZE)
+#define CC_TAPE_ADDR           (RECORD_ADDR + RECORD_SIZE)
+#define DD_DISK_ADDR           (CC_TAPE_ADDR + IF_MEMORY_CC_TAPE_SIZE)
+#define DD_GCR_ADDR            (DD_DISK_ADDR + IF_MEMORY_DD_DISK_SIZE)
 
 /*
  * This can get all the remaining memory to support as
  * many filenames as possible.
  */
-#define CC_STAGE_FILES_ADDR    (DD_UTIL2_BASE_ADDR + IF_MEMORY_DD_UTIL2_SIZE)
+#define CC_STAGE_FILES_ADDR    (DD_GCR_ADDR + IF_MEMORY_DD_GCR_SIZE)
 
 #define CC_BROM_LOAD_ADDR      0x0000A000
 #define CC_CROM_LOAD_ADDR      0x0000D000
@@ -207,6 +207,14 @@ void CDC_Itf_Flush()
   }
 }
 
+uint8_t CDC_Itf_TxIdle()
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)g_usbd_device.pClassData;
+
+  /* Not configured (no host attached) counts as busy */
+  return hcdc != NULL && hcdc->TxState == 0 && UserTxBufferCntr == 0;
+}
+
 void CDC_Iif_RegisterReceiveCb(ReceiveCb_t *NewReceiveCb)
 {
   ReceiveCb = NewReceiveCb;
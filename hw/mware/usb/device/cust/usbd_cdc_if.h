@@ -86,6 +86,7 @@ typedef void (ReceiveCb_t)(uint8_t* Buf, uint32_t Len);
 void CDC_Iif_RegisterReceiveCb(ReceiveCb_t *NewReceiveCb);
 void CDC_Itf_Send(uint8_t *Buf, uint32_t Len);
 void CDC_Itf_Flush();
+uint8_t CDC_Itf_TxIdle();
 #endif /* __USBD_CDC_IF_H */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
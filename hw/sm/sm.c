@@ -35,14 +35,26 @@
 #include "ff.h"
 #include "main.h"
 #include "timer.h"
+#include "stream.h"
+#include "record.h"
+#include "hostif.h"
+#include "diag.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 #define CLOCK_PAL               985248
 #define MAX_EXEC_CYCLES         400
+#define BUSY_EXEC_CYCLES        50 /* Less skew to disk drive when serial bus is busy */
 #define LONG_PRESS_MS           500
 #define LONG_PRESS_DELAY_MS     30
+#define UPPER_BORDER            32
+#define LEFT_BORDER             44
+#define FORGROUND_WIDTH         400
+#define FORGROUND_HEIGHT        282
+#define WINDOW_WIDTH            320
+#define WINDOW_HEIGHT           200
+#define TAPE_RECORD_FILES_MAX   1000
 
 extern if_emu_cc_t g_if_cc_emu;
 extern if_emu_dd_t g_if_dd_emu;
@@ -57,10 +69,125 @@ static uint8_t g_key_active;
 static uint32_t g_key_active_start;
 static uint32_t g_key_active_long_press_delay;
 static uint8_t g_disk_drive_on;
+static uint8_t g_disk_gcr; /* Drive reads disk at GCR level */
 static uint8_t g_lock_freq_pal;
 static uint8_t g_disp_info;
-static uint8_t g_limit_frame_rate; /* Emulator can half its emulated frame rate to gain performance */
+static framerate_t g_framerate; /* Emulator can half its frame rate or interlace to gain performance */
 static uint8_t g_tape_play;
+static uint8_t g_tape_fast_load; /* Kernal tape loader is trapped */
+static uint8_t g_tape_warp; /* Run unlocked and headless while tape motor is on */
+static uint8_t g_tape_motor;
+static uint8_t g_tape_warp_applied; /* Warp currently set in emulator display */
+static uint32_t g_tape_counter;
+static FIL g_tape_record_fil;
+static uint8_t g_tape_recording;
+static uint8_t g_scaler_mode;
+static uint32_t g_vic_bench_frames; /* Requested from console */
+
+/* Scale and borders, only modes that fits on screen (3x does not) */
+static const uint8_t g_scaler_modes_aa[][2] =
+{
+    {2, 1},
+    {2, 0},
+    {1, 1},
+    {1, 0}
+};
+
+static void set_scaler(uint8_t mode)
+{
+    g_scaler_mode = mode;
+    g_if_cc_emu.if_emu_cc_display.display_scaler_set_fp(g_scaler_modes_aa[mode][0], g_scaler_modes_aa[mode][1]);
+
+    /* No need for emulator to render borders that are not shown */
+    if(g_scaler_modes_aa[mode][1])
+    {
+        g_if_cc_emu.if_emu_cc_display.display_viewport_set_fp(0, 0, FORGROUND_WIDTH, FORGROUND_HEIGHT);
+    }
+    else
+    {
+        g_if_cc_emu.if_emu_cc_display.display_viewport_set_fp(LEFT_BORDER, UPPER_BORDER, WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+    stage_set_scaler(g_scaler_modes_aa[mode][0], g_scaler_modes_aa[mode][1]);
+    stream_set_scaler(g_scaler_modes_aa[mode][0], g_scaler_modes_aa[mode][1]);
+    record_set_scaler(g_scaler_modes_aa[mode][0], g_scaler_modes_aa[mode][1]);
+}
+
+static void set_framerate(framerate_t framerate)
+{
+    g_framerate = framerate;
+    if(g_disp_info)
+    {
+        stage_draw_info(INFO_FRAMERATE, g_framerate);
+    }
+    g_if_cc_emu.if_emu_cc_display.display_limit_frame_rate_fp(g_framerate == FRAMERATE_HALF);
+    g_if_cc_emu.if_emu_cc_display.display_interlace_fp(g_framerate == FRAMERATE_INTERLACED);
+}
+
+/* Frame rate lock and render as given by freq lock, tape warp and tape motor */
+static void set_speed()
+{
+    uint8_t warp;
+
+    warp = g_tape_warp && g_tape_motor;
+    g_if_cc_emu.if_emu_cc_display.display_lock_frame_rate_fp(warp ? 0 : g_lock_freq_pal);
+
+    /* Render is only changed when warp changes, other render off settings are kept */
+    if(warp != g_tape_warp_applied)
+    {
+        g_tape_warp_applied = warp;
+        g_if_cc_emu.if_emu_cc_display.display_render_fp(!warp);
+    }
+}
+
+static uint8_t tape_record_start()
+{
+    char path_a[24];
+    FRESULT res = FR_EXIST;
+    uint32_t i;
+
+    /* Same folder as tape browser lists, so recording can be played back */
+    f_mkdir("0:/tap");
+
+    for(i = 0; i < TAPE_RECORD_FILES_MAX && res == FR_EXIST; i++)
+    {
+        sprintf(path_a, "0:/tap/tap%03u.tap", (unsigned int)i);
+        res = f_open(&g_tape_record_fil, path_a, FA_CREATE_NEW | FA_WRITE);
+    }
+
+    if(res != FR_OK)
+    {
+        return 0;
+    }
+
+    g_tape_recording = 1;
+    g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_record_fp((uint32_t *)&g_tape_record_fil);
+    return 1;
+}
+
+static void tape_record_stop()
+{
+    if(g_tape_recording)
+    {
+        g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_record_fp(NULL);
+        f_close(&g_tape_record_fil);
+        g_tape_recording = 0;
+    }
+}
+
+static void update_tape_counter()
+{
+    uint32_t counter;
+
+    counter = g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_counter_fp();
+    if(counter != g_tape_counter)
+    {
+        g_tape_counter = counter;
+        if(g_disp_info)
+        {
+            stage_draw_info(INFO_TAPE_COUNTER, g_tape_counter);
+        }
+    }
+}
 
 static void show_info_bar(uint8_t show)
 {
@@ -69,9 +196,10 @@ static void show_info_bar(uint8_t show)
         disp_activate_layer(0);
         stage_draw_info(INFO_DISK, g_disk_drive_on);
         stage_draw_info(INFO_FPS, 0);
-        stage_draw_info(INFO_FRAMERATE, g_limit_frame_rate);
+        stage_draw_info(INFO_FRAMERATE, g_framerate);
         stage_draw_info(INFO_FREQLOCK, g_lock_freq_pal);
         stage_draw_info(INFO_TAPE_BUTTON, g_tape_play);
+        stage_draw_info(INFO_TAPE_COUNTER, g_tape_counter);
         stage_draw_fw(); /* Upper right corner is reserved for this */
     }
     else
@@ -320,6 +448,9 @@ static void read_keybd()
                 break;
             case 0x3B: /* CTRL + F2 */
                 g_disk_drive_on = !g_disk_drive_on;
+                /* Virtual drive on device 8 while drive emulator is off */
+                g_if_cc_emu.if_emu_cc_disk_drive.disk_drive_virtual_fp(!g_disk_drive_on);
+                hostif_serial_dd_active(g_disk_drive_on);
                 if(g_disp_info)
                 {
                     stage_draw_info(INFO_DISK, g_disk_drive_on);
@@ -331,15 +462,10 @@ static void read_keybd()
                 {
                     stage_draw_info(INFO_FREQLOCK, g_lock_freq_pal);
                 }
-                g_if_cc_emu.if_emu_cc_display.display_lock_frame_rate_fp(g_lock_freq_pal);
+                set_speed();
                 break;
             case 0x3D: /* CTRL + F4 */
-                g_limit_frame_rate = !g_limit_frame_rate;
-                if(g_disp_info)
-                {
-                    stage_draw_info(INFO_FRAMERATE, g_limit_frame_rate);
-                }
-                g_if_cc_emu.if_emu_cc_display.display_limit_frame_rate_fp(g_limit_frame_rate);
+                set_framerate((g_framerate + 1) % FRAMERATE_MAX);
                 break;
             case 0x3E: /* CTRL + F5 */
                 g_tape_play = !g_tape_play;
@@ -357,6 +483,26 @@ static void read_keybd()
                 /* Make sure to leave any error state */
                 change_state(SM_STATE_EMULATOR);
                 break;
+            case 0x40: /* CTRL + F7 */
+                if(g_current_state == SM_STATE_EMULATOR)
+                {
+                    set_scaler((g_scaler_mode + 1) % (sizeof(g_scaler_modes_aa) / sizeof(g_scaler_modes_aa[0])));
+                    stage_prepare(STAGE_EMULATION);
+                    show_info_bar(g_disp_info);
+                    g_if_cc_emu.if_emu_cc_display.display_layer_set_fp(disp_acquire_buffer());
+                }
+                break;
+            case 0x41: /* CTRL + F8 */
+                if(record_active())
+                {
+                    record_stop();
+                }
+                else if(!record_start())
+                {
+                    stage_set_message("Could not start recording!");
+                    stage_draw_info(INFO_PRINT, 0);
+                }
+                break;
             case 0x42: /* CTRL + F9 */
                 if(g_current_state == SM_STATE_EMULATOR)
                 {
@@ -375,11 +521,15 @@ static void read_keybd()
                 {
                     change_state(SM_STATE_EMULATOR);
 
+                    /* Tape recording must be saved before emulator forgets it */
+                    tape_record_stop();
                     g_if_cc_emu.if_emu_cc_op.op_init_fp();
                     g_if_dd_emu.if_emu_dd_op.op_init_fp();
 
                     /* Reset disk drive setting */
                     g_disk_drive_on = 0;
+                    g_if_cc_emu.if_emu_cc_disk_drive.disk_drive_virtual_fp(!g_disk_drive_on);
+                    hostif_serial_dd_active(g_disk_drive_on);
                     if(g_disp_info)
                     {
                         stage_draw_info(INFO_DISK, g_disk_drive_on);
@@ -391,27 +541,68 @@ static void read_keybd()
                     {
                         stage_draw_info(INFO_FREQLOCK, g_lock_freq_pal);
                     }
-                    g_if_cc_emu.if_emu_cc_display.display_lock_frame_rate_fp(g_lock_freq_pal);
+
+                    /* Tape motor is off after init */
+                    g_tape_motor = 0;
+                    set_speed();
 
                     /* Reset frame rate setting */
-                    g_limit_frame_rate = 1;
-                    if(g_disp_info)
-                    {
-                        stage_draw_info(INFO_FRAMERATE, g_limit_frame_rate);
-                    }
-                    g_if_cc_emu.if_emu_cc_display.display_limit_frame_rate_fp(g_limit_frame_rate);
+                    set_framerate(FRAMERATE_HALF);
 
                     /* Reset all emulator vic pointers */
                     g_if_cc_emu.if_emu_cc_mem.mem_set_fp((uint8_t *)CC_SPRITE1_BASE_ADDR, IF_MEM_CC_TYPE_SPRITE1);
                     g_if_cc_emu.if_emu_cc_mem.mem_set_fp((uint8_t *)CC_SPRITE2_BASE_ADDR, IF_MEM_CC_TYPE_SPRITE2);
                     g_if_cc_emu.if_emu_cc_mem.mem_set_fp((uint8_t *)CC_SPRITE3_BASE_ADDR, IF_MEM_CC_TYPE_SPRITE3);
-                    g_if_cc_emu.if_emu_cc_display.display_layer_set_fp((uint8_t *)CC_DISP_BUFFER2_ADDR);
+                    g_if_cc_emu.if_emu_cc_display.display_layer_set_fp(disp_acquire_buffer());
                     stage_clear_last_messsage();
                 }
                 break;
             case 0x45: /* CTRL + F12 */
+                g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_load_fp(NULL, 0); /* Write back disk */
                 NVIC_SystemReset();
                 break;
+            case 0x4A: /* CTRL + Home */
+                g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_wind_fp(IF_EMU_CC_TAPE_WIND_START);
+                break;
+            case 0x4B: /* CTRL + PageUp */
+                g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_wind_fp(-1);
+                break;
+            case 0x4E: /* CTRL + PageDown */
+                g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_wind_fp(1);
+                break;
+            case 0x4D: /* CTRL + End */
+                if(g_tape_recording)
+                {
+                    tape_record_stop();
+                    stage_set_message("Tape recording saved");
+                }
+                else if(tape_record_start())
+                {
+                    stage_set_message("Tape recording");
+                }
+                else
+                {
+                    stage_set_message("Could not start tape recording!");
+                }
+                stage_draw_info(INFO_PRINT, 0);
+                break;
+            case 0x47: /* CTRL + Scroll Lock */
+                g_disk_gcr = g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_gcr_fp(!g_disk_gcr);
+                stage_set_message(g_disk_gcr ? "Disk gcr mode on" : "Disk gcr mode off");
+                stage_draw_info(INFO_PRINT, 0);
+                break;
+            case 0x49: /* CTRL + Insert */
+                g_tape_fast_load = !g_tape_fast_load;
+                g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_fast_load_fp(g_tape_fast_load);
+                stage_set_message(g_tape_fast_load ? "Tape fast load on" : "Tape fast load off");
+                stage_draw_info(INFO_PRINT, 0);
+                break;
+            case 0x4C: /* CTRL + Delete */
+                g_tape_warp = !g_tape_warp;
+                set_speed();
+                stage_set_message(g_tape_warp ? "Tape warp on" : "Tape warp off");
+                stage_draw_info(INFO_PRINT, 0);
+                break;
             case 79: /* Right Arrow */
                 break;
             case 80: /* Left Arrow */
@@ -444,6 +635,7 @@ static void read_keybd()
             if(g_key_active == 40) /* Return key */
             {
                 FRESULT res = FR_OK;
+                uint8_t write_protect;
                 char *path_p = stage_get_selected_path();
                 char *filename_p = stage_get_selected_filename();
                 char *path_and_filename_p = (char *)calloc(1, strlen(path_p) + strlen(filename_p) + 2);
@@ -452,14 +644,30 @@ static void read_keybd()
                 /* If file was previously opened, then free fd before allocating new one */
                 if(g_fd_p != NULL)
                 {
+                    /*
+                     * Tape reads and disk writes back in the background,
+                     * so both must let go of the file
+                     */
+                    g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_load_fp(NULL);
+                    g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_load_fp(NULL, 0);
                     f_close(g_fd_p);
                     free(g_fd_p);
                     g_fd_p = NULL;
                 }
 
                 /* Create new fd and try and open file */
+                file_list_type_t file_list_type = stage_get_selected_file_list_type();
                 g_fd_p = (FIL *)calloc(1, sizeof(FIL));
-                res = f_open(g_fd_p, path_and_filename_p, FA_READ);
+                /* Disk images are written back by disk drive */
+                write_protect = 0;
+                res = f_open(g_fd_p, path_and_filename_p,
+                             file_list_type == FILE_LIST_TYPE_FLOPPY ? FA_READ | FA_WRITE : FA_READ);
+                if(res != FR_OK && file_list_type == FILE_LIST_TYPE_FLOPPY)
+                {
+                    /* Read only file or card, disk is write protected */
+                    write_protect = 1;
+                    res = f_open(g_fd_p, path_and_filename_p, FA_READ);
+                }
                 free(path_and_filename_p);
                 if(res != FR_OK)
                 {
@@ -468,7 +676,6 @@ static void read_keybd()
                     break;
                 }
 
-                file_list_type_t file_list_type = stage_get_selected_file_list_type();
                 switch(file_list_type)
                 {
                     case FILE_LIST_TYPE_CASETTE:
@@ -476,7 +683,7 @@ static void read_keybd()
                         change_state(SM_STATE_EMULATOR);
                         break;
                     case FILE_LIST_TYPE_FLOPPY:
-                        g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_load_fp((uint32_t *)g_fd_p);
+                        g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_load_fp((uint32_t *)g_fd_p, write_protect);
                         change_state(SM_STATE_EMULATOR);
                         break;
                     case FILE_LIST_TYPE_T64:
@@ -521,18 +728,26 @@ static void read_keybd()
 void sm_init()
 {
     g_fd_p = NULL;
+    set_scaler(0);
     change_state(SM_STATE_EMULATOR);
 
     g_if_cc_emu.if_emu_cc_op.op_init_fp();
     g_if_dd_emu.if_emu_dd_op.op_init_fp();
 
     g_disk_drive_on = 0;
+    g_if_cc_emu.if_emu_cc_disk_drive.disk_drive_virtual_fp(!g_disk_drive_on);
+    hostif_serial_dd_active(g_disk_drive_on);
     g_lock_freq_pal = 1;
     g_disp_info = 0;
-    g_limit_frame_rate = 1;
     g_tape_play = 0;
-    g_if_cc_emu.if_emu_cc_display.display_lock_frame_rate_fp(g_lock_freq_pal);
-    g_if_cc_emu.if_emu_cc_display.display_limit_frame_rate_fp(g_limit_frame_rate);
+    g_tape_fast_load = 0;
+    g_tape_warp = 0;
+    g_tape_motor = 0;
+    g_tape_warp_applied = 0;
+    g_tape_counter = 0;
+    g_tape_recording = 0;
+    set_speed();
+    set_framerate(FRAMERATE_HALF);
 }
 
 void sm_run()
@@ -542,15 +757,17 @@ void sm_run()
         switch(g_current_state)
         {
             case SM_STATE_EMULATOR:
-                if(g_disk_drive_on)
-                {
-                    /* If disk drive is turned on, then run both emulators */
-                    g_if_cc_emu.if_emu_cc_op.op_run_fp(25);
-                    g_if_dd_emu.if_emu_dd_op.op_run_fp(25);
-                }
-                else
+                /* Disk drive runs behind, at most one slice, and is caught up on serial bus access */
+                g_if_cc_emu.if_emu_cc_op.op_run_fp(hostif_serial_busy() ? BUSY_EXEC_CYCLES : MAX_EXEC_CYCLES);
+                hostif_serial_sync();
+
+                if(g_vic_bench_frames != 0)
                 {
-                    g_if_cc_emu.if_emu_cc_op.op_run_fp(MAX_EXEC_CYCLES);
+                    /* Locked frame rate would measure the wait for display */
+                    g_if_cc_emu.if_emu_cc_display.display_lock_frame_rate_fp(0);
+                    diag_vic_bench(g_vic_bench_frames);
+                    set_speed();
+                    g_vic_bench_frames = 0;
                 }
 
                 break;
@@ -579,6 +796,11 @@ void sm_run()
         }
         keybd_poll();
         read_keybd();
+        stream_poll();
+        record_poll();
+        g_if_cc_emu.if_emu_cc_tape_drive.tape_drive_poll_fp();
+        g_if_dd_emu.if_emu_dd_disk_drive.disk_drive_poll_fp();
+        update_tape_counter();
     }
 }
 
@@ -605,3 +827,17 @@ void sm_tape_play(uint8_t play)
         stage_draw_info(INFO_TAPE_BUTTON, g_tape_play);
     }
 }
+
+void sm_vic_bench(uint32_t frames)
+{
+    g_vic_bench_frames = frames;
+}
+
+void sm_tape_motor(uint8_t motor)
+{
+    g_tape_motor = motor;
+    if(g_tape_warp)
+    {
+        set_speed();
+    }
+}
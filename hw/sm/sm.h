@@ -42,5 +42,7 @@ uint8_t sm_get_disp_stats_flag();
 void sm_error_occured();
 sm_state_t sm_get_state();
 void sm_tape_play(uint8_t play);
+void sm_tape_motor(uint8_t motor);
+void sm_vic_bench(uint32_t frames);
 
 #endif
\ No newline at end of file
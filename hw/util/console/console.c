@@ -33,6 +33,10 @@
 #include "usbd_core.h"
 #include "usbd_cdc.h"
 #include "usbd_cdc_if.h"
+#include "stream.h"
+#include "record.h"
+#include "sm.h"
+#include "if.h"
 #include <string.h>
 
 #define STDOUT_FILENO 	1
@@ -43,6 +47,7 @@
 USBD_HandleTypeDef g_usbd_device;
 extern USBD_DescriptorsTypeDef VCP_Desc;
 extern USBD_CDC_ItfTypeDef  USBD_CDC_fops;
+extern if_emu_cc_t g_if_cc_emu;
 
 typedef enum
 {
@@ -50,17 +55,30 @@ typedef enum
     CMD_I2C_WRITE,
     CMD_MEM_READ,
     CMD_MEM_WRITE,
+    CMD_STREAM_ON,
+    CMD_STREAM_OFF,
+    CMD_RECORD_INTERVAL,
+    CMD_SCREEN_TEXT,
+    CMD_VIC_BENCH,
+    CMD_VIC_LOG,
     CMD_MAX
 } cmd_t;
 
-static char *g_cmd_list_ap[5] = {"i2c_read", "i2c_write", "mem_read", "mem_write", NULL};
+static char *g_cmd_list_ap[11] = {"i2c_read", "i2c_write", "mem_read", "mem_write", "stream_on", "stream_off", "record_interval", "screen_text", "vic_bench", "vic_log", NULL};
 
 static char *g_console_help_p =   "[i2c_read <reg>], read adv7511 register\r" \
                                 "[i2c_write <reg> <val>], write adv7511 register\r" \
                                 "[mem_read <addr>], read memory address\r" \
-                                "[mem_write <addr> <val>], write to memory address\n";
+                                "[mem_write <addr> <val>], write to memory address\r" \
+                                "[stream_on], start sending emulator frames\r" \
+                                "[stream_off], stop sending emulator frames\r" \
+                                "[record_interval <n>], record every nth frame (ctrl + f8)\r" \
+                                "[screen_text], print emulator screen as text\r" \
+                                "[vic_bench <frames>], cycles per frame with and without d-cache, each run < 20 s\r" \
+                                "[vic_log <line|off>], vic writes on raster line in last frame\n";
 static uint8_t g_cmd_input_str_a[128] = "";
 static uint8_t g_cmd_input_cnt = 0;
+static uint8_t g_vic_log_active = 0;
 static char g_delimiter_a[2] = " ";
 
 static uint32_t console_atoi(char *str_p)
@@ -163,6 +181,82 @@ static void console_interpret(uint8_t *buf, uint32_t len)
             printf("writing 0x%02X to address 0x%02X\n", val, (unsigned int)addr);
         }
         break;
+        case CMD_STREAM_ON:
+            stream_start();
+        break;
+        case CMD_STREAM_OFF:
+            stream_stop();
+            printf("stream stopped\n");
+        break;
+        case CMD_RECORD_INTERVAL:
+        {
+            uint8_t interval;
+            if(argsv_pp[1] == NULL)
+            {
+                printf("need one argument!\n");
+                break;
+            }
+            interval = console_atoi(argsv_pp[1]);
+            if(interval == 0 || interval > RECORD_INTERVAL_MAX)
+            {
+                printf("interval must be 1 - %d!\n", RECORD_INTERVAL_MAX);
+                break;
+            }
+            record_set_interval(interval);
+            printf("recording every %d frame(s)\n", interval);
+        }
+        break;
+        case CMD_SCREEN_TEXT:
+        {
+            static char text_a[IF_EMU_CC_TEXT_SIZE];
+            g_if_cc_emu.if_emu_cc_display.display_text_get_fp(text_a);
+            printf("%s", text_a);
+        }
+        break;
+        case CMD_VIC_BENCH:
+            if(argsv_pp[1] == NULL)
+            {
+                printf("need one argument!\n");
+                break;
+            }
+            /* Runs from main loop, not from here */
+            sm_vic_bench(console_atoi(argsv_pp[1]));
+        break;
+        case CMD_VIC_LOG:
+        {
+            static if_reg_log_line_t log_line;
+            uint8_t i;
+            if(argsv_pp[1] == NULL)
+            {
+                printf("need one argument!\n");
+                break;
+            }
+            if(strcmp(argsv_pp[1], "off") == 0)
+            {
+                g_vic_log_active = 0;
+                g_if_cc_emu.if_emu_cc_display.display_reg_log_fp(0);
+                printf("vic log stopped\n");
+                break;
+            }
+            if(!g_vic_log_active)
+            {
+                /* Nothing logged yet, first complete frame is next one */
+                g_vic_log_active = 1;
+                g_if_cc_emu.if_emu_cc_display.display_reg_log_fp(1);
+                printf("vic log started, run again for line\n");
+                break;
+            }
+            g_if_cc_emu.if_emu_cc_display.display_reg_log_line_fp(console_atoi(argsv_pp[1]), &log_line);
+            printf("frame start: d011=%02X d016=%02X d018=%02X dd00=%02X%s\n",
+                   log_line.regs_a[0x11], log_line.regs_a[0x16], log_line.regs_a[0x18],
+                   log_line.bank, log_line.complete ? "" : " (incomplete)");
+            for(i = 0; i < log_line.cnt; i++)
+            {
+                printf("cycle %2d: $%04X = %02X\n", log_line.writes_a[i].cycle,
+                       log_line.writes_a[i].addr, log_line.writes_a[i].value);
+            }
+        }
+        break;
     default:
         printf("%s", g_console_help_p);
     }
@@ -189,7 +283,10 @@ static void console_receive(uint8_t *buf, uint32_t len)
         if(g_cmd_input_str_a[i] == '\r')
         {
             /* Send new line */
-            CDC_Itf_Send((uint8_t *)"\n", 1);
+            if(!stream_active())
+            {
+                CDC_Itf_Send((uint8_t *)"\n", 1);
+            }
 
             /* Remove CR and NL */
             while(g_cmd_input_str_a[g_cmd_input_cnt - 1] == '\n' ||
@@ -207,8 +304,11 @@ static void console_receive(uint8_t *buf, uint32_t len)
         }
     }
 
-    /* Remote echo */
-    CDC_Itf_Send((uint8_t *)buf, len);
+    /* Remote echo, not while streaming since it would break the framing */
+    if(!stream_active())
+    {
+        CDC_Itf_Send((uint8_t *)buf, len);
+    }
 }
 
 void console_init()
@@ -234,6 +334,12 @@ void console_init()
 /* So that printf() will output on this device */
 int _write(int file, char *ptr, int len)
 {
+    /* Stream owns the cdc channel, prints would break its framing */
+    if(stream_active())
+    {
+        return len;
+    }
+
     switch (file)
     {
     case STDOUT_FILENO: /*stdout*/
@@ -0,0 +1,506 @@
+/*
+ * memwa2 record utility
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+/**
+ * Records the emulator display and all sid writes to a file on the
+ * sd card so that a session can be replayed exactly. Every frame, or
+ * every nth frame, is captured as 4 bit palette indices (two pixels per
+ * byte, first pixel in low nibble) in native resolution. Capturing is
+ * only a copy into a free slot, the compression and the sd card writes
+ * are done a few rows at a time from record_poll so that emulation is
+ * not stalled for a whole frame.
+ *
+ * File layout (all little endian):
+ *
+ * header:  'M' 'W' 'R' 'C' | version (1) | interval (1) | width (2) |
+ *          height (2) | palette 16 * argb (4)
+ * chunks:  'S' | count (2) | lost (2) | count * (cycles (4) | reg (1) | data (1))
+ *          'F' | frame number (4) | cycles (4) | dropped (2) | tokens
+ *          'E' | frames (4)
+ *
+ * Frame tokens are <skip varint> <length varint> <length xor bytes>
+ * against the previous captured frame (zero for the first one) and
+ * continue until width * height / 2 bytes are covered. The sid writes
+ * that happened before a frame are always stored before it.
+ */
+
+#include "record.h"
+#include "disp.h"
+#include "ff.h"
+#include <string.h>
+#include <stdio.h>
+
+#define RECORD_VERSION          1
+#define RECORD_SLOTS            4
+#define RECORD_SLOT_SIZE        0x10000
+#define RECORD_SID_EVENTS       0x1000
+#define RECORD_OUT_SIZE         0x10000
+#define RECORD_WRITE_SIZE       0x1000 /* Sd card is written in blocks of this size */
+#define RECORD_ROWS_PER_POLL    16
+#define RECORD_LITERAL_MAX      128
+#define RECORD_FILES_MAX        1000
+
+#define WINDOW_WIDTH            320
+#define WINDOW_HEIGHT           200
+#define FORGROUND_WIDTH         400
+#define FORGROUND_HEIGHT        282
+
+typedef struct
+{
+    uint32_t frame;
+    uint32_t cycles;
+    uint32_t sid_end; /* Sid events up to this index belong before frame */
+    uint16_t dropped; /* Frames dropped before this one since no slot was free */
+} slot_t;
+
+typedef struct
+{
+    uint32_t cycles;
+    uint8_t addr;
+    uint8_t data;
+} sid_event_t;
+
+static FIL g_fil;
+static uint8_t *g_slot_mem_p;
+static uint8_t *g_prev_p;
+static sid_event_t *g_sid_a;
+static uint8_t *g_out_p;
+static uint32_t g_out_len;
+static slot_t g_slot_a[RECORD_SLOTS];
+static uint8_t g_slot_head;
+static uint8_t g_slot_tail;
+static uint8_t g_slot_cnt;
+static uint32_t g_sid_head;
+static uint32_t g_sid_tail;
+static uint16_t g_sid_lost;
+static uint16_t g_dropped;
+static uint32_t g_frame_cnt;
+static uint32_t g_frames_written;
+static uint8_t g_interval = 1; /* Used for next recording */
+static uint8_t g_rec_interval;
+static uint8_t g_interval_cnt;
+static uint32_t g_width;
+static uint32_t g_height;
+static uint32_t g_scale;
+static uint8_t g_active;
+static uint8_t g_encoding;
+static uint32_t g_enc_row;
+static uint32_t g_enc_skip;
+static uint8_t g_literal_a[RECORD_LITERAL_MAX];
+static uint32_t g_literal_len;
+static uint8_t g_out_error;
+
+static uint8_t write_out(uint32_t min_len);
+
+/* Writes out buffer to sd card first if length does not fit */
+static uint8_t out_room(uint32_t length)
+{
+    if(g_out_len + length <= RECORD_OUT_SIZE)
+    {
+        return 1;
+    }
+
+    if(!write_out(0))
+    {
+        g_out_error = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+static void put_u8(uint8_t value)
+{
+    if(!out_room(1))
+    {
+        return;
+    }
+
+    g_out_p[g_out_len++] = value;
+}
+
+static void put_u16(uint16_t value)
+{
+    put_u8(value & 0xFF);
+    put_u8(value >> 8);
+}
+
+static void put_u32(uint32_t value)
+{
+    put_u16(value & 0xFFFF);
+    put_u16(value >> 16);
+}
+
+static void put_varint(uint32_t value)
+{
+    while(value >= 0x80)
+    {
+        put_u8((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    put_u8(value);
+}
+
+static void put_span()
+{
+    put_varint(g_enc_skip);
+    put_varint(g_literal_len);
+    if(out_room(g_literal_len))
+    {
+        memcpy(g_out_p + g_out_len, g_literal_a, g_literal_len);
+        g_out_len += g_literal_len;
+    }
+    g_literal_len = 0;
+    g_enc_skip = 0;
+}
+
+static uint8_t write_out(uint32_t min_len)
+{
+    UINT bytes_written;
+
+    if(g_out_len < min_len || g_out_len == 0)
+    {
+        return 1;
+    }
+
+    if(f_write(&g_fil, g_out_p, g_out_len, &bytes_written) != FR_OK ||
+       bytes_written != g_out_len)
+    {
+        printf("[ERR] record: failed to write to sd card\n");
+        return 0;
+    }
+
+    g_out_len = 0;
+    return 1;
+}
+
+static void put_sid_events(uint32_t sid_end)
+{
+    sid_event_t *sid_event_p;
+    uint32_t count = sid_end - g_sid_tail;
+
+    if(count == 0 && g_sid_lost == 0)
+    {
+        return;
+    }
+
+    put_u8('S');
+    put_u16(count);
+    put_u16(g_sid_lost);
+    g_sid_lost = 0;
+
+    while(g_sid_tail != sid_end)
+    {
+        sid_event_p = &g_sid_a[g_sid_tail % RECORD_SID_EVENTS];
+        put_u32(sid_event_p->cycles);
+        put_u8(sid_event_p->addr);
+        put_u8(sid_event_p->data);
+        g_sid_tail++;
+    }
+}
+
+static void encode_rows(uint32_t rows)
+{
+    uint32_t row_size = g_width / 2;
+    uint8_t *slot_p = g_slot_mem_p + g_slot_tail * RECORD_SLOT_SIZE + g_enc_row * row_size;
+    uint8_t *prev_p = g_prev_p + g_enc_row * row_size;
+    uint32_t i;
+    uint8_t delta;
+
+    if(g_enc_row + rows > g_height)
+    {
+        rows = g_height - g_enc_row;
+    }
+
+    for(i = 0; i < rows * row_size; i++)
+    {
+        delta = slot_p[i] ^ prev_p[i];
+        prev_p[i] = slot_p[i];
+
+        if(delta == 0)
+        {
+            if(g_literal_len != 0)
+            {
+                put_span();
+            }
+            g_enc_skip++;
+        }
+        else
+        {
+            g_literal_a[g_literal_len++] = delta;
+            if(g_literal_len == RECORD_LITERAL_MAX)
+            {
+                put_span();
+            }
+        }
+    }
+
+    g_enc_row += rows;
+}
+
+static void encode_step()
+{
+    slot_t *slot_p;
+
+    if(!g_encoding)
+    {
+        if(g_slot_cnt == 0)
+        {
+            return;
+        }
+
+        slot_p = &g_slot_a[g_slot_tail];
+        put_sid_events(slot_p->sid_end);
+
+        put_u8('F');
+        put_u32(slot_p->frame);
+        put_u32(slot_p->cycles);
+        put_u16(slot_p->dropped);
+
+        g_enc_row = 0;
+        g_enc_skip = 0;
+        g_literal_len = 0;
+        g_encoding = 1;
+    }
+
+    encode_rows(RECORD_ROWS_PER_POLL);
+
+    if(g_enc_row == g_height)
+    {
+        /* Last span also covers trailing unchanged bytes */
+        put_span();
+        g_encoding = 0;
+        g_frames_written++;
+        g_slot_tail = (g_slot_tail + 1) % RECORD_SLOTS;
+        g_slot_cnt--;
+    }
+}
+
+void record_init(uint32_t memory)
+{
+    g_slot_mem_p = (uint8_t *)memory;
+    g_prev_p = g_slot_mem_p + RECORD_SLOTS * RECORD_SLOT_SIZE;
+    g_sid_a = (sid_event_t *)(g_prev_p + RECORD_SLOT_SIZE);
+    g_out_p = (uint8_t *)g_sid_a + RECORD_SID_EVENTS * sizeof(sid_event_t);
+    g_active = 0;
+    record_set_scaler(1, 1);
+}
+
+void record_set_scaler(uint8_t scale, uint8_t borders)
+{
+    /* Geometry is fixed for the whole file */
+    if(g_active)
+    {
+        record_stop();
+    }
+
+    g_scale = scale;
+    g_width = borders ? FORGROUND_WIDTH : WINDOW_WIDTH;
+    g_height = borders ? FORGROUND_HEIGHT : WINDOW_HEIGHT;
+}
+
+void record_set_interval(uint8_t interval)
+{
+    if(interval == 0 || interval > RECORD_INTERVAL_MAX)
+    {
+        return;
+    }
+
+    g_interval = interval;
+}
+
+uint8_t record_start()
+{
+    uint32_t *clut_p = disp_get_clut_table();
+    char path_a[16];
+    FRESULT res = FR_EXIST;
+    uint32_t i;
+
+    if(g_active)
+    {
+        return 1;
+    }
+
+    for(i = 0; i < RECORD_FILES_MAX && res == FR_EXIST; i++)
+    {
+        sprintf(path_a, "0:/rec%03u.mwr", (unsigned int)i);
+        res = f_open(&g_fil, path_a, FA_CREATE_NEW | FA_WRITE);
+    }
+
+    if(res != FR_OK)
+    {
+        printf("[ERR] record: could not create file\n");
+        return 0;
+    }
+
+    g_out_len = 0;
+    g_out_error = 0;
+    put_u8('M');
+    put_u8('W');
+    put_u8('R');
+    put_u8('C');
+    put_u8(RECORD_VERSION);
+    put_u8(g_interval);
+    put_u16(g_width);
+    put_u16(g_height);
+    for(i = 0; i < 16; i++)
+    {
+        put_u32(clut_p[i]);
+    }
+
+    memset(g_prev_p, 0x00, g_width * g_height / 2);
+    g_slot_head = 0;
+    g_slot_tail = 0;
+    g_slot_cnt = 0;
+    g_sid_head = 0;
+    g_sid_tail = 0;
+    g_sid_lost = 0;
+    g_dropped = 0;
+    g_frame_cnt = 0;
+    g_frames_written = 0;
+    g_rec_interval = g_interval;
+    g_interval_cnt = 0;
+    g_encoding = 0;
+    g_active = 1;
+
+    printf("[INFO] record: writing to %s\n", path_a);
+    return 1;
+}
+
+void record_stop()
+{
+    if(!g_active)
+    {
+        return;
+    }
+
+    g_active = 0;
+
+    /* Everything captured so far must end up in file */
+    while(g_encoding || g_slot_cnt != 0)
+    {
+        encode_step();
+        if(!write_out(RECORD_WRITE_SIZE))
+        {
+            break;
+        }
+    }
+
+    put_sid_events(g_sid_head);
+    put_u8('E');
+    put_u32(g_frames_written);
+    write_out(0);
+
+    f_close(&g_fil);
+    printf("[INFO] record: stopped after %u frames\n", (unsigned int)g_frames_written);
+}
+
+uint8_t record_active()
+{
+    return g_active;
+}
+
+void record_frame(uint8_t *frame_p, uint32_t cycles)
+{
+    uint8_t *slot_p;
+    uint8_t *row_p;
+    uint32_t x;
+    uint32_t y;
+
+    if(!g_active)
+    {
+        return;
+    }
+
+    g_frame_cnt++;
+
+    if(++g_interval_cnt < g_rec_interval)
+    {
+        return;
+    }
+    g_interval_cnt = 0;
+
+    if(g_slot_cnt == RECORD_SLOTS)
+    {
+        g_dropped++; /* Encoder is behind, sd card too slow */
+        return;
+    }
+
+    slot_p = g_slot_mem_p + g_slot_head * RECORD_SLOT_SIZE;
+    for(y = 0; y < g_height; y++)
+    {
+        /* Only first pixel of every scaled block is looked at */
+        row_p = frame_p + y * g_scale * g_width * g_scale;
+
+        for(x = 0; x < g_width; x += 2)
+        {
+            *slot_p++ = (row_p[x * g_scale] & 0x0F) | (row_p[(x + 1) * g_scale] << 4);
+        }
+    }
+
+    g_slot_a[g_slot_head].frame = g_frame_cnt;
+    g_slot_a[g_slot_head].cycles = cycles;
+    g_slot_a[g_slot_head].sid_end = g_sid_head;
+    g_slot_a[g_slot_head].dropped = g_dropped;
+    g_dropped = 0;
+
+    g_slot_head = (g_slot_head + 1) % RECORD_SLOTS;
+    g_slot_cnt++;
+}
+
+void record_sid(uint8_t addr, uint8_t data, uint32_t cycles)
+{
+    sid_event_t *sid_event_p;
+
+    if(!g_active)
+    {
+        return;
+    }
+
+    if(g_sid_head - g_sid_tail == RECORD_SID_EVENTS)
+    {
+        g_sid_lost++;
+        return;
+    }
+
+    sid_event_p = &g_sid_a[g_sid_head % RECORD_SID_EVENTS];
+    sid_event_p->cycles = cycles;
+    sid_event_p->addr = addr;
+    sid_event_p->data = data;
+    g_sid_head++;
+}
+
+void record_poll()
+{
+    if(!g_active)
+    {
+        return;
+    }
+
+    encode_step();
+
+    if(g_out_error || !write_out(RECORD_WRITE_SIZE))
+    {
+        record_stop();
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * memwa2 record utility
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include "stm32f7xx_hal.h"
+#include "main.h"
+
+#define RECORD_INTERVAL_MAX     50
+
+void record_init(uint32_t memory);
+void record_set_scaler(uint8_t scale, uint8_t borders);
+void record_set_interval(uint8_t interval);
+uint8_t record_start();
+void record_stop();
+uint8_t record_active();
+void record_frame(uint8_t *frame_p, uint32_t cycles);
+void record_sid(uint8_t addr, uint8_t data, uint32_t cycles);
+void record_poll();
+
+#endif
@@ -49,10 +49,13 @@
 #define RIGHT_BORDER            36
 #define FORGROUND_WIDTH         (320 + LEFT_BORDER + RIGHT_BORDER)
 #define FORGROUND_HEIGHT        (200 + UPPER_BORDER + LOWER_BORDER)
+#define WINDOW_WIDTH            320
+#define WINDOW_HEIGHT           200
 #define FILENAME_HIGHT          10
 #define FILES_IN_COLUMN         (SCREEN_HEIGHT/FILENAME_HIGHT)
 #define FILENAME_LENGTH_PIXELS  (20*8)
 #define FILE_COLUMNS            (SCREEN_WIDTH/FILENAME_LENGTH_PIXELS)
+#define FILES_MAX               (IF_MEMORY_CC_STAGE_FILES_SIZE / sizeof(file_t))
 
 #define STRING_INFO_FPS               "EFPS: "
 #define STRING_INFO_DISK_ACTIVE       "DD.ACTIVE"
@@ -61,10 +64,12 @@
 #define STRING_INFO_FREQLOCK_INACTIVE "FREQ.UNLOCK"
 #define STRING_INFO_FRAMERATE_HALF    "FRATE.HALF"
 #define STRING_INFO_FRAMERATE_FULL    "FRATE.FULL"
+#define STRING_INFO_FRAMERATE_INTL    "FRATE.INTL"
 #define STRING_INFO_TAPE_PLAY         "TAPE.PLAY"
 #define STRING_INFO_TAPE_STOP         "TAPE.STOP"
 #define STRING_INFO_TAPE_ON           "TAPE.ON"
 #define STRING_INFO_TAPE_OFF          "TAPE.OFF"
+#define STRING_INFO_TAPE_COUNTER      "TAPE."
  
 #define STRING_INFO_PRINT             "MSG: "
 #define CHAR_INFO_DISK_LED_ACTIVE     0xB8
@@ -82,10 +87,12 @@
 #define XPOS_INFO_FREQLOCK_INACTIVE 13*8*2
 #define XPOS_INFO_FRAMERATE_HALF    13*8*3
 #define XPOS_INFO_FRAMERATE_FULL    13*8*3
+#define XPOS_INFO_FRAMERATE_INTL    13*8*3
 #define XPOS_INFO_TAPE_PLAY         13*8*4
 #define XPOS_INFO_TAPE_STOP         13*8*4
 #define XPOS_INFO_TAPE_ON           13*8*5
 #define XPOS_INFO_TAPE_OFF          13*8*5
+#define XPOS_INFO_TAPE_COUNTER      13*8*6
 #define XPOS_INFO_PRINT             0
 
 #define YPOS_INFO_FPS               0
@@ -97,10 +104,12 @@
 #define YPOS_INFO_FREQLOCK_INACTIVE 0
 #define YPOS_INFO_FRAMERATE_HALF    0
 #define YPOS_INFO_FRAMERATE_FULL    0
+#define YPOS_INFO_FRAMERATE_INTL    0
 #define YPOS_INFO_TAPE_PLAY         0
 #define YPOS_INFO_TAPE_STOP         0
 #define YPOS_INFO_TAPE_ON           0
 #define YPOS_INFO_TAPE_OFF          0
+#define YPOS_INFO_TAPE_COUNTER      0
 #define YPOS_INFO_PRINT             8
 
 typedef enum
@@ -178,6 +187,8 @@ static uint32_t g_file_list_cnt;
 static uint32_t g_current_file;
 static uint32_t g_current_page;
 static char *g_last_message;
+static uint32_t g_emu_width = FORGROUND_WIDTH * 2; /* Emulator layer size, given by scaler setting */
+static uint32_t g_emu_height = FORGROUND_HEIGHT * 2;
 
 static char *g_icon_path_ap[] =
 {
@@ -230,6 +241,12 @@ static FRESULT scan_files(file_list_type_t file_list_type, char *path_p, uint32_
     {
         for(;;)
         {
+            /* Rest of the folder is not listed when memory is full */
+            if(*items_p >= FILES_MAX)
+            {
+                break;
+            }
+
             res = f_readdir(&dir, &fno);
             if(res != FR_OK || fno.fname[0] == 0)
             {
@@ -479,27 +496,15 @@ static void prepare_emulation()
     disp_deactivate_layer(0);
     disp_deactivate_layer(1);
 
-#ifdef SCREEN_X2
     disp_set_layer(1,
-        (SCREEN_WIDTH-FORGROUND_WIDTH*2)/2,
-        (SCREEN_WIDTH-FORGROUND_WIDTH*2)/2 + FORGROUND_WIDTH*2,
-        (SCREEN_HEIGHT-FORGROUND_HEIGHT*2)/2,
-        (SCREEN_HEIGHT-FORGROUND_HEIGHT*2)/2 + FORGROUND_HEIGHT*2,
-        FORGROUND_WIDTH*2,
-        FORGROUND_HEIGHT*2,
+        (SCREEN_WIDTH-g_emu_width)/2,
+        (SCREEN_WIDTH-g_emu_width)/2 + g_emu_width,
+        (SCREEN_HEIGHT-g_emu_height)/2,
+        (SCREEN_HEIGHT-g_emu_height)/2 + g_emu_height,
+        g_emu_width,
+        g_emu_height,
         255,
         LTDC_PIXEL_FORMAT_L8);
-#else
-    disp_set_layer(1,
-        (SCREEN_WIDTH-FORGROUND_WIDTH)/2,
-        (SCREEN_WIDTH-FORGROUND_WIDTH)/2 + FORGROUND_WIDTH,
-        (SCREEN_HEIGHT-FORGROUND_HEIGHT)/2,
-        (SCREEN_HEIGHT-FORGROUND_HEIGHT)/2 + FORGROUND_HEIGHT,
-        FORGROUND_WIDTH,
-        FORGROUND_HEIGHT,
-        255,
-        LTDC_PIXEL_FORMAT_L8);
-#endif
 
     disp_enable_clut(0);
     disp_enable_clut(1);
@@ -814,7 +819,7 @@ void stage_input_key(stage_t stage, char keybd_key)
     }
 }
 
-void stage_draw_info(info_t info, uint8_t value)
+void stage_draw_info(info_t info, uint32_t value)
 {
     switch(info)
     {
@@ -882,7 +887,8 @@ void stage_draw_info(info_t info, uint8_t value)
           }
           break;
       case INFO_FRAMERATE:
-          if(value)
+          /* All frame rate strings have the same length */
+          if(value == FRAMERATE_HALF)
           {
               clear_string(strlen(STRING_INFO_FRAMERATE_FULL),
                            XPOS_INFO_FRAMERATE_HALF,
@@ -891,6 +897,15 @@ void stage_draw_info(info_t info, uint8_t value)
                           XPOS_INFO_FRAMERATE_HALF,
                           YPOS_INFO_FRAMERATE_HALF);
           }
+          else if(value == FRAMERATE_INTERLACED)
+          {
+              clear_string(strlen(STRING_INFO_FRAMERATE_FULL),
+                           XPOS_INFO_FRAMERATE_INTL,
+                           YPOS_INFO_FRAMERATE_INTL);
+              draw_string(STRING_INFO_FRAMERATE_INTL,
+                          XPOS_INFO_FRAMERATE_INTL,
+                          YPOS_INFO_FRAMERATE_INTL);
+          }
           else
           {
               clear_string(strlen(STRING_INFO_FRAMERATE_HALF),
@@ -941,6 +956,18 @@ void stage_draw_info(info_t info, uint8_t value)
                           YPOS_INFO_TAPE_OFF);
           }
           break;
+      case INFO_TAPE_COUNTER:
+        {
+            /* Three digits like the real datasette counter */
+            char buf[4];
+            buf[0] = '0' + (value / 100) % 10;
+            buf[1] = '0' + (value / 10) % 10;
+            buf[2] = '0' + value % 10;
+            buf[3] = '\0';
+            draw_string(STRING_INFO_TAPE_COUNTER, XPOS_INFO_TAPE_COUNTER, YPOS_INFO_TAPE_COUNTER);
+            draw_string(buf, XPOS_INFO_TAPE_COUNTER + strlen(STRING_INFO_TAPE_COUNTER)*8, YPOS_INFO_TAPE_COUNTER);
+        }
+        break;
       case INFO_PRINT:
           clear_string(strlen(STRING_INFO_PRINT) + 25,
                        XPOS_INFO_PRINT,
@@ -958,6 +985,20 @@ void stage_draw_info(info_t info, uint8_t value)
     }
 }
 
+void stage_set_scaler(uint8_t scale, uint8_t borders)
+{
+    if(borders)
+    {
+        g_emu_width = FORGROUND_WIDTH * scale;
+        g_emu_height = FORGROUND_HEIGHT * scale;
+    }
+    else
+    {
+        g_emu_width = WINDOW_WIDTH * scale;
+        g_emu_height = WINDOW_HEIGHT * scale;
+    }
+}
+
 void stage_set_message(char *string_p)
 {
     if(g_last_message != NULL)
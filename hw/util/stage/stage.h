@@ -53,9 +53,18 @@ typedef enum
     INFO_FRAMERATE,
     INFO_TAPE_BUTTON,
     INFO_TAPE_MOTOR,
+    INFO_TAPE_COUNTER,
     INFO_PRINT
 } info_t;
 
+typedef enum
+{
+    FRAMERATE_FULL,
+    FRAMERATE_HALF,
+    FRAMERATE_INTERLACED,
+    FRAMERATE_MAX
+} framerate_t;
+
 void stage_init(uint32_t memory);
 void stage_prepare(stage_t stage);
 void stage_select_layer(uint8_t layer);
@@ -68,7 +77,8 @@ void stage_input_key(stage_t stage, char keybd_key);
 char *stage_get_selected_filename();
 char *stage_get_selected_path();
 file_list_type_t stage_get_selected_file_list_type();
-void stage_draw_info(info_t info, uint8_t value);
+void stage_draw_info(info_t info, uint32_t value);
 void stage_set_message(char *string_p);
+void stage_set_scaler(uint8_t scale, uint8_t borders);
 
 #endif
@@ -0,0 +1,269 @@
+/*
+ * memwa2 stream utility
+ *
+ * Copyright (c) 2016 Mathias Edman <mail@dicetec.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ * USA
+ *
+ */
+
+
+/**
+ * Streams the emulator display over the usb cable (cdc) so that
+ * a viewer on the other end can show it. Only the difference to the
+ * previous frame is sent. Every completed frame is xor:ed against a
+ * reference copy of the last sent frame (in native resolution, i.e.
+ * not scaled) and the changed spans are encoded like this:
+ *
+ * header:  'M' 'W' 'F' 'D' | flags (1) | width (2) | height (2) |
+ *          frame number (4) | payload length (4), all little endian
+ * payload: repeated <skip varint> <length varint> <length xor bytes>
+ *
+ * Varints are LEB128. Skip is the number of unchanged pixels before the
+ * span. If STREAM_FLAG_KEY is set the viewer should clear its frame
+ * before applying the payload. Frames without any change are not sent
+ * at all. If the link is busy sending the previous frame the new frame
+ * is skipped, the reference is untouched so next delta is still valid.
+ * Console prints and echo are dropped while streaming since they share
+ * the cdc channel and would break the framing.
+ */
+
+#include "stream.h"
+#include "usbd_cdc_if.h"
+#include <string.h>
+
+#define STREAM_FLAG_KEY         0x01
+#define STREAM_HEADER_SIZE      17
+#define STREAM_LITERAL_MAX      128
+#define STREAM_CHUNK_SIZE       192 /* Must fit cdc tx buffer together with prints */
+#define STREAM_VARINT_MAX       5
+
+#define WINDOW_WIDTH            320
+#define WINDOW_HEIGHT           200
+#define FORGROUND_WIDTH         400
+#define FORGROUND_HEIGHT        282
+
+static uint8_t *g_ref_p;
+static uint8_t *g_buffer_p;
+static uint8_t *g_out_p;
+static uint32_t g_buffer_len;
+static uint32_t g_buffer_sent;
+static uint32_t g_width;
+static uint32_t g_height;
+static uint32_t g_scale;
+static uint32_t g_frame_cnt;
+static uint8_t g_active;
+static uint8_t g_keyframe;
+static uint8_t g_literal_a[STREAM_LITERAL_MAX];
+static uint32_t g_literal_len;
+
+static void put_varint(uint32_t value)
+{
+    while(value >= 0x80)
+    {
+        *g_out_p++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *g_out_p++ = value;
+}
+
+static void put_u16(uint16_t value)
+{
+    *g_out_p++ = value & 0xFF;
+    *g_out_p++ = value >> 8;
+}
+
+static void put_u32(uint32_t value)
+{
+    put_u16(value & 0xFFFF);
+    put_u16(value >> 16);
+}
+
+static uint8_t put_span(uint32_t skip)
+{
+    if(g_out_p + STREAM_VARINT_MAX * 2 + g_literal_len > g_buffer_p + STREAM_BUFFER_SIZE)
+    {
+        return 0; /* Does not fit */
+    }
+
+    put_varint(skip);
+    put_varint(g_literal_len);
+    memcpy(g_out_p, g_literal_a, g_literal_len);
+    g_out_p += g_literal_len;
+    g_literal_len = 0;
+
+    return 1;
+}
+
+void stream_init(uint32_t ref_memory, uint32_t buffer_memory)
+{
+    g_ref_p = (uint8_t *)ref_memory;
+    g_buffer_p = (uint8_t *)buffer_memory;
+    g_active = 0;
+    stream_set_scaler(1, 1);
+}
+
+void stream_set_scaler(uint8_t scale, uint8_t borders)
+{
+    g_scale = scale;
+    g_width = borders ? FORGROUND_WIDTH : WINDOW_WIDTH;
+    g_height = borders ? FORGROUND_HEIGHT : WINDOW_HEIGHT;
+
+    /* Geometry changed so viewer needs a complete frame */
+    g_keyframe = 1;
+}
+
+void stream_start()
+{
+    g_buffer_len = 0;
+    g_buffer_sent = 0;
+    g_frame_cnt = 0;
+    g_keyframe = 1;
+    g_active = 1;
+}
+
+void stream_stop()
+{
+    g_active = 0;
+}
+
+uint8_t stream_active()
+{
+    return g_active;
+}
+
+void stream_frame(uint8_t *frame_p)
+{
+    uint8_t *row_p;
+    uint8_t *ref_p;
+    uint32_t skip = 0;
+    uint32_t x;
+    uint32_t y;
+    uint8_t delta;
+    uint8_t flags = 0;
+
+    if(!g_active)
+    {
+        return;
+    }
+
+    g_frame_cnt++;
+
+    if(g_buffer_sent != g_buffer_len)
+    {
+        return; /* Still sending previous frame */
+    }
+
+    if(g_keyframe)
+    {
+        memset(g_ref_p, 0x00, g_width * g_height);
+        flags |= STREAM_FLAG_KEY;
+        g_keyframe = 0;
+    }
+
+    g_out_p = g_buffer_p + STREAM_HEADER_SIZE;
+    g_literal_len = 0;
+    ref_p = g_ref_p;
+
+    for(y = 0; y < g_height; y++)
+    {
+        /* Only first pixel of every scaled block is looked at */
+        row_p = frame_p + y * g_scale * g_width * g_scale;
+
+        for(x = 0; x < g_width; x++)
+        {
+            delta = row_p[x * g_scale] ^ *ref_p;
+
+            if(delta == 0)
+            {
+                if(g_literal_len != 0)
+                {
+                    if(!put_span(skip))
+                    {
+                        goto OVERFLOW;
+                    }
+                    skip = 0;
+                }
+                skip++;
+            }
+            else
+            {
+                *ref_p = row_p[x * g_scale];
+                g_literal_a[g_literal_len++] = delta;
+
+                if(g_literal_len == STREAM_LITERAL_MAX)
+                {
+                    if(!put_span(skip))
+                    {
+                        goto OVERFLOW;
+                    }
+                    skip = 0;
+                }
+            }
+            ref_p++;
+        }
+    }
+
+    if(g_literal_len != 0 && !put_span(skip))
+    {
+        goto OVERFLOW;
+    }
+
+    if(g_out_p == g_buffer_p + STREAM_HEADER_SIZE && !(flags & STREAM_FLAG_KEY))
+    {
+        return; /* Identical frame, nothing to send */
+    }
+
+    g_buffer_len = g_out_p - g_buffer_p;
+    g_buffer_sent = 0;
+
+    /* Fill in header now when size is known */
+    g_out_p = g_buffer_p;
+    *g_out_p++ = 'M';
+    *g_out_p++ = 'W';
+    *g_out_p++ = 'F';
+    *g_out_p++ = 'D';
+    *g_out_p++ = flags;
+    put_u16(g_width);
+    put_u16(g_height);
+    put_u32(g_frame_cnt);
+    put_u32(g_buffer_len - STREAM_HEADER_SIZE);
+    return;
+
+OVERFLOW:
+    /* Reference is partly updated, start over with a complete frame */
+    g_keyframe = 1;
+}
+
+void stream_poll()
+{
+    uint32_t len;
+
+    if(g_buffer_sent == g_buffer_len || !CDC_Itf_TxIdle())
+    {
+        return;
+    }
+
+    len = g_buffer_len - g_buffer_sent;
+    if(len > STREAM_CHUNK_SIZE)
+    {
+        len = STREAM_CHUNK_SIZE;
+    }
+
+    CDC_Itf_Send(g_buffer_p + g_buffer_sent, len);
+    CDC_Itf_Flush();
+    g_buffer_sent += len;
+}
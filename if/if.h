@@ -32,10 +32,15 @@
 #define IF_MEMORY_CC_CROM_ACTUAL_SIZE       0x1000
 #define IF_MEMORY_DD_DOS_ACTUAL_SIZE        0x4000
 
+#define IF_EMU_CC_TEXT_SIZE                 (25 * (40 + 1) + 1)
+#define IF_EMU_CC_REG_LOG_REGS              0x2F /* $D000-$D02E */
+#define IF_EMU_CC_REG_LOG_LINE_MAX          64 /* Writes on one raster line */
+#define IF_EMU_CC_TAPE_WIND_START           (-0x10000) /* Blocks to wind for start of tape */
 
 #define IF_MEMORY_CC_SCREEN_BUFFER1_SIZE    0x100000
 #define IF_MEMORY_CC_SCREEN_BUFFER2_SIZE    0x100000
 #define IF_MEMORY_CC_SCREEN_BUFFER3_SIZE    0x100000
+#define IF_MEMORY_CC_SCREEN_BUFFER4_SIZE    0x76000 /* Only emulator frames (L8) */
 #define IF_MEMORY_CC_RAM_SIZE               0x10000
 #define IF_MEMORY_CC_KROM_SIZE              0x10000
 #define IF_MEMORY_CC_BROM_SIZE              0x10000
@@ -47,16 +52,20 @@
 #define IF_MEMORY_CC_SPRITE2_SIZE           0x40000
 #define IF_MEMORY_CC_SPRITE3_SIZE           0x40000
 #define IF_MEMORY_CC_STAGE_FILES_SIZE       0x100000
+#define IF_MEMORY_CC_TAPE_SIZE              0x40000
 
 #define IF_MEMORY_DD_ALL_SIZE               0x10000
 #define IF_MEMORY_DD_UTIL1_SIZE             0x40000
 #define IF_MEMORY_DD_UTIL2_SIZE             0x40000
+#define IF_MEMORY_DD_DISK_SIZE              0x60000
+#define IF_MEMORY_DD_GCR_SIZE               0x10000
 
 typedef enum
 {
     IF_DISPLAY_LAYER_BUFFER1, /* Size = 0x100000 (800x600x2) */
     IF_DISPLAY_LAYER_BUFFER2, /* Size = 0x100000 (800x600x2) */
-    IF_DISPLAY_LAYER_BUFFER3 /* Size = 0x100000 (800x600x2) */
+    IF_DISPLAY_LAYER_BUFFER3, /* Size = 0x100000 (800x600x2) */
+    IF_DISPLAY_LAYER_BUFFER4 /* Size = 0x76000 (800x600x1) */
 } if_display_layer_t;
 
 typedef enum
@@ -113,7 +122,8 @@ typedef enum
     IF_MEM_CC_TYPE_UTIL2,     /* Size = 0x40000 */
     IF_MEM_CC_TYPE_SPRITE1,   /* Size = 0x40000 */
     IF_MEM_CC_TYPE_SPRITE2,   /* Size = 0x40000 */
-    IF_MEM_CC_TYPE_SPRITE3    /* Size = 0x20000 */
+    IF_MEM_CC_TYPE_SPRITE3,   /* Size = 0x20000 */
+    IF_MEM_CC_TYPE_TAPE       /* Size = 0x40000 */
 } if_mem_cc_type_t;
 
 typedef struct
@@ -123,6 +133,22 @@ typedef struct
     uint8_t matrix_y; /* The y coordinate for c64 keyboard matrix */
 } if_keybd_map_t;
 
+typedef struct
+{
+    uint8_t cycle; /* Cycle in raster line */
+    uint8_t value;
+    uint16_t addr; /* $D000-$D3FF, $D800-$DBFF or $DD00 */
+} if_reg_write_t;
+
+typedef struct
+{
+    uint8_t regs_a[IF_EMU_CC_REG_LOG_REGS]; /* When frame started */
+    uint8_t bank; /* $DD00 when frame started */
+    uint8_t complete; /* Not set if log was just activated or writes did not fit */
+    uint8_t cnt;
+    if_reg_write_t writes_a[IF_EMU_CC_REG_LOG_LINE_MAX];
+} if_reg_log_line_t;
+
 typedef void (*if_emu_cc_ue_joyst_t)(if_joyst_port_t if_joyst_port, if_joyst_action_t if_joyst_action, if_joyst_action_state_t if_action_state);
 typedef void (*if_emu_cc_ue_keybd_t)(uint8_t *keybd_keys_p, uint8_t max_keys, if_key_state_t if_key_shift, if_key_state_t if_key_ctrl);
 typedef void (*if_emu_cc_ue_keybd_map_set_t)(if_keybd_map_t *if_keybd_map_p);
@@ -131,13 +157,27 @@ typedef void (*if_emu_cc_mem_set_t)(uint8_t *mem_p, if_mem_cc_type_t if_mem_type
 typedef void (*if_emu_cc_op_init_t)();
 typedef void (*if_emu_cc_op_run_t)(int32_t cycles);
 typedef void (*if_emu_cc_op_reset_t)();
+typedef uint32_t (*if_emu_cc_op_cycles_t)();
 typedef void (*if_emu_cc_tape_drive_load_t)(uint32_t *fd_p);
 typedef void (*if_emu_cc_tape_drive_play_t)();
 typedef void (*if_emu_cc_tape_drive_stop_t)();
-typedef void (*if_emu_cc_time_tenth_second_t)();
+typedef void (*if_emu_cc_tape_drive_poll_t)();
+typedef void (*if_emu_cc_tape_drive_fast_load_t)(uint8_t active);
+typedef void (*if_emu_cc_tape_drive_wind_t)(int32_t blocks);
+typedef uint32_t (*if_emu_cc_tape_drive_counter_t)();
+typedef void (*if_emu_cc_tape_drive_record_t)(uint32_t *fd_p);
+typedef void (*if_emu_cc_disk_drive_virtual_t)(uint8_t active);
 typedef void (*if_emu_cc_ports_write_serial_t)(uint8_t data);
 typedef void (*if_emu_cc_display_limit_frame_rate_t)(uint8_t active);
 typedef void (*if_emu_cc_display_lock_frame_rate_t)(uint8_t active);
+typedef void (*if_emu_cc_display_scaler_set_t)(uint8_t scale, uint8_t borders);
+typedef void (*if_emu_cc_display_render_t)(uint8_t active);
+typedef void (*if_emu_cc_display_interlace_t)(uint8_t active);
+typedef void (*if_emu_cc_display_reg_log_t)(uint8_t active);
+typedef void (*if_emu_cc_display_reg_log_line_t)(uint16_t line, if_reg_log_line_t *log_line_p);
+typedef void (*if_emu_cc_display_viewport_set_t)(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+typedef void (*if_emu_cc_display_text_get_t)(char *text_p);
+typedef uint8_t (*if_emu_cc_op_run_until_text_t)(char *text_p, uint32_t cycles_max);
 
 typedef struct
 {
@@ -151,6 +191,13 @@ typedef struct
     if_emu_cc_display_layer_set_t display_layer_set_fp;
     if_emu_cc_display_limit_frame_rate_t display_limit_frame_rate_fp;
     if_emu_cc_display_lock_frame_rate_t display_lock_frame_rate_fp;
+    if_emu_cc_display_scaler_set_t display_scaler_set_fp; /* Layer width is (borders ? 400 : 320) * scale */
+    if_emu_cc_display_render_t display_render_fp; /* Inactive means headless, no pixels and no flips */
+    if_emu_cc_display_interlace_t display_interlace_fp; /* Even and odd lines are rendered every other frame */
+    if_emu_cc_display_viewport_set_t display_viewport_set_fp; /* Only pixels inside are rendered, 1x coordinates with borders (400x282) */
+    if_emu_cc_display_reg_log_t display_reg_log_fp; /* Log cycle stamped vic, color ram and bank writes every frame */
+    if_emu_cc_display_reg_log_line_t display_reg_log_line_fp; /* Writes on a raster line in last complete frame */
+    if_emu_cc_display_text_get_t display_text_get_fp; /* Screen as ASCII, 25 rows of 40 + newline, null terminated (IF_EMU_CC_TEXT_SIZE) */
 } if_emu_cc_display_t;
 
 typedef struct
@@ -163,6 +210,8 @@ typedef struct
     if_emu_cc_op_init_t op_init_fp;
     if_emu_cc_op_run_t op_run_fp;
     if_emu_cc_op_reset_t op_reset_fp;
+    if_emu_cc_op_cycles_t op_cycles_fp; /* Free running count of emulated cycles, wraps */
+    if_emu_cc_op_run_until_text_t op_run_until_text_fp; /* Runs until text is on screen, 0 if cycles_max passed first */
 } if_emu_cc_op_t;
 
 typedef struct
@@ -170,12 +219,17 @@ typedef struct
     if_emu_cc_tape_drive_load_t tape_drive_load_fp;
     if_emu_cc_tape_drive_play_t tape_drive_play_fp;
     if_emu_cc_tape_drive_stop_t tape_drive_stop_fp;
+    if_emu_cc_tape_drive_poll_t tape_drive_poll_fp; /* Reads ahead on tape file, call regularly outside of op_run */
+    if_emu_cc_tape_drive_fast_load_t tape_drive_fast_load_fp; /* Traps kernal tape loader, standard blocks load at once */
+    if_emu_cc_tape_drive_wind_t tape_drive_wind_fp; /* Blocks forward (or back if negative), call outside of op_run */
+    if_emu_cc_tape_drive_counter_t tape_drive_counter_fp; /* Seconds of tape played */
+    if_emu_cc_tape_drive_record_t tape_drive_record_fp; /* Records to empty file, NULL ends it, call outside of op_run */
 } if_emu_cc_tape_drive_t;
 
 typedef struct
 {
-    if_emu_cc_time_tenth_second_t time_tenth_second_fp;
-} if_emu_cc_time_t;
+    if_emu_cc_disk_drive_virtual_t disk_drive_virtual_fp; /* Traps kernal load, save and serial bus for device 8, served from disk in dd */
+} if_emu_cc_disk_drive_t;
 
 typedef struct
 {
@@ -194,7 +248,7 @@ typedef struct
     if_emu_cc_mem_t if_emu_cc_mem;
     if_emu_cc_op_t if_emu_cc_op;
     if_emu_cc_tape_drive_t if_emu_cc_tape_drive;
-    if_emu_cc_time_t if_emu_cc_time;
+    if_emu_cc_disk_drive_t if_emu_cc_disk_drive;
     if_emu_cc_ports_t if_emu_cc_ports;
 } if_emu_cc_t;
 
@@ -208,13 +262,21 @@ typedef enum
     IF_MEM_DD_TYPE_ALL,       /* Size = 0x10000 */
     IF_MEM_DD_TYPE_UTIL1,     /* Size = 0x50000 */
     IF_MEM_DD_TYPE_UTIL2,     /* Size = 0x50000 */
+    IF_MEM_DD_TYPE_DISK,      /* Size = 0x60000 */
+    IF_MEM_DD_TYPE_GCR,       /* Size = 0x10000 */
 } if_mem_dd_type_t;
 
 typedef void (*if_emu_dd_mem_set_t)(uint8_t *mem_p, if_mem_dd_type_t if_mem_type);
 typedef void (*if_emu_dd_op_init_t)();
 typedef void (*if_emu_dd_op_run_t)(int32_t cycles);
 typedef void (*if_emu_dd_op_reset_t)();
-typedef void (*if_emu_dd_disk_drive_load_t)(uint32_t *fd_p);
+typedef uint8_t (*if_emu_dd_op_sleeping_t)();
+typedef uint32_t (*if_emu_dd_op_cycles_t)();
+typedef void (*if_emu_dd_disk_drive_load_t)(uint32_t *fd_p, uint8_t write_protect);
+typedef void (*if_emu_dd_disk_drive_poll_t)();
+typedef uint8_t (*if_emu_dd_disk_drive_gcr_t)(uint8_t active);
+typedef uint8_t *(*if_emu_dd_disk_drive_read_sector_t)(uint8_t track, uint8_t sector);
+typedef uint8_t (*if_emu_dd_disk_drive_write_sector_t)(uint8_t track, uint8_t sector, uint8_t *data_p);
 typedef void (*if_emu_dd_ports_write_serial_t)(uint8_t data);
 
 typedef struct
@@ -227,11 +289,17 @@ typedef struct
     if_emu_dd_op_init_t op_init_fp;
     if_emu_dd_op_run_t op_run_fp;
     if_emu_dd_op_reset_t op_reset_fp;
+    if_emu_dd_op_sleeping_t op_sleeping_fp; /* Idle until serial port is written, op_run does nothing meanwhile */
+    if_emu_dd_op_cycles_t op_cycles_fp; /* Free running count of emulated cycles, also while sleeping, wraps */
 } if_emu_dd_op_t;
 
 typedef struct
 {
-    if_emu_dd_disk_drive_load_t disk_drive_load_fp;
+    if_emu_dd_disk_drive_load_t disk_drive_load_fp; /* File must be writable unless write protected, NULL writes back and removes disk */
+    if_emu_dd_disk_drive_poll_t disk_drive_poll_fp; /* Writes back disk when idle, call regularly outside of op_run */
+    if_emu_dd_disk_drive_gcr_t disk_drive_gcr_fp; /* GCR level emulation for custom drive code, returns mode in use */
+    if_emu_dd_disk_drive_read_sector_t disk_drive_read_sector_fp; /* Sector in d64 image, NULL if none */
+    if_emu_dd_disk_drive_write_sector_t disk_drive_write_sector_fp; /* Written back like drive writes, 0 if no such sector */
 } if_emu_dd_disk_drive_t;
 
 typedef struct
@@ -286,9 +354,24 @@ typedef void (*if_host_stats_led_t)(uint8_t led);
 typedef uint32_t (*if_host_calc_checksum_t)(uint8_t *buffer_p, uint32_t length);
 typedef uint8_t (*if_host_ports_read_serial_t)(if_emu_dev_t if_emu_dev);
 typedef void (*if_host_ports_write_serial_t)(if_emu_dev_t if_emu_dev, uint8_t data);
+/*
+ * Submits the completed frame in *done_buffer_pp for presentation and
+ * replaces it with a buffer that is free to render into. Must never block
+ * and must never hand back a buffer that is still being shown.
+ */
 typedef void (*if_host_disp_flip_t)(uint8_t **done_buffer_pp);
+/*
+ * Copies length bytes (multiple of 4, word aligned) between rows of the
+ * display buffers, source may be in another buffer (e.g. previous frame).
+ * The copy may still be in progress when returning, host must have
+ * finished it before the buffer is flipped. Null means the emulator
+ * copies itself.
+ */
+typedef void (*if_host_disp_copy_t)(uint8_t *dst_p, uint8_t *src_p, uint32_t length);
 typedef void (*if_host_ee_tape_play_t)(uint8_t play);
 typedef void (*if_host_ee_tape_motor_t)(uint8_t motor);
+typedef uint8_t *(*if_host_disk_read_sector_t)(uint8_t track, uint8_t sector);
+typedef uint8_t (*if_host_disk_write_sector_t)(uint8_t track, uint8_t sector, uint8_t *data_p);
 
 typedef struct
 {
@@ -335,13 +418,14 @@ typedef struct
 
 typedef struct
 {
-    if_host_ports_read_serial_t ports_read_serial_fp;
-    if_host_ports_write_serial_t ports_write_serial_fp;
+    if_host_ports_read_serial_t ports_read_serial_fp; /* Call before sampling port, other end is caught up to this cycle */
+    if_host_ports_write_serial_t ports_write_serial_fp; /* Delivered to other end at the cycle it was written */
 } if_host_ports_t;
 
 typedef struct
 {
     if_host_disp_flip_t disp_flip_fp;
+    if_host_disp_copy_t disp_copy_fp;
 } if_host_disp_t;
 
 typedef struct
@@ -350,6 +434,12 @@ typedef struct
     if_host_ee_tape_motor_t ee_tape_motor_fp;
 } if_host_ee_t;
 
+typedef struct
+{
+    if_host_disk_read_sector_t disk_read_sector_fp; /* from computer, virtual drive */
+    if_host_disk_write_sector_t disk_write_sector_fp; /* from computer, virtual drive */
+} if_host_disk_t;
+
 /*
  * Host main interface. These
  * functions should be implemented
@@ -367,6 +457,7 @@ typedef struct
     if_host_ports_t if_host_ports;
     if_host_disp_t if_host_disp;
     if_host_ee_t if_host_ee;
+    if_host_disk_t if_host_disk;
 } if_host_t;
 
 #endif